@@ -31,7 +31,25 @@ SOURCES += \
     trnemu.cpp \
     asmparser.cpp \
     mifserializer.cpp \
-    tablewidgetitemanimator.cpp
+    tablewidgetitemanimator.cpp \
+    trnfastemu.cpp \
+    trnconformance.cpp \
+    trntracewriter.cpp \
+    trntracereader.cpp \
+    memoryheatdelegate.cpp \
+    trncoverage.cpp \
+    trnloopdetector.cpp \
+    trnmemory.cpp \
+    trnlogindex.cpp \
+    trnlogstore.cpp \
+    trnlogexporter.cpp \
+    trnprofiler.cpp \
+    asmsymboltable.cpp \
+    trnsweep.cpp \
+    trnfuzzer.cpp \
+    trnlaneemu.cpp \
+    trnpagedmemory.cpp \
+    trnresultcache.cpp
 
 HEADERS += \
         mainwindow.h \
@@ -43,7 +61,29 @@ HEADERS += \
     mifserializer.h \
     tablewidgetitemanimator.h \
     animatedlabel.h \
-    qoverloadlegacy.h
+    qoverloadlegacy.h \
+    trnstate.h \
+    trnfastemu.h \
+    trnconformance.h \
+    trntrace.h \
+    trntracewriter.h \
+    trntracereader.h \
+    trnheatmap.h \
+    memoryheatdelegate.h \
+    asmdebuginfo.h \
+    trncoverage.h \
+    trnloopdetector.h \
+    trnmemory.h \
+    trnlogindex.h \
+    trnlogstore.h \
+    trnlogexporter.h \
+    trnprofiler.h \
+    asmsymboltable.h \
+    trnsweep.h \
+    trnfuzzer.h \
+    trnlaneemu.h \
+    trnpagedmemory.h \
+    trnresultcache.h
 
 FORMS += \
         mainwindow.ui \
@@ -0,0 +1,35 @@
+#ifndef ASMDEBUGINFO_H
+#define ASMDEBUGINFO_H
+#include <QVector>
+#include <QString>
+#include "asmsymboltable.h"
+
+// Maps assembled instructions back to the source lines that produced them
+// Only instructions are in the table. Data from CON and RES has no line of its own
+class AsmDebugInfo
+{
+public:
+    typedef enum {
+        Instruction,
+        // A conditional jump, which either falls through or branches
+        Branch,
+    } EntryKind;
+
+    typedef struct {
+        quint16 addr;
+        quint8 kind;
+        quint32 line;
+    } Entry;
+
+    AsmDebugInfo() : sourcePath(), entries(), symbols() {}
+    inline void clear() { entries.clear(); symbols.clear(); }
+    inline void append(int addr, EntryKind kind, quint64 line) { entries.append(Entry{(quint16)addr, (quint8)kind, (quint32)line}); }
+
+    QString sourcePath;
+    // In the order they were assembled. An ORG can make addresses go backwards
+    QVector<Entry> entries;
+    // Every label, and the address it was given
+    AsmSymbolTable symbols;
+};
+
+#endif // ASMDEBUGINFO_H
@@ -13,8 +13,14 @@
 QHash<QString, TrnOpcodes::TrnOpcode> AsmParser::opmap;
 QHash<QString, quint16> AsmParser::opargmap;
 
-int AsmParser::Parse(QFile& infile, QVector<quint32>& outvec, QString& errstr)
+int AsmParser::Parse(QFile& infile, QVector<quint32>& outvec, QString& errstr, AsmDebugInfo* debugInfo)
 {
+    if(debugInfo)
+    {
+        debugInfo->clear();
+        debugInfo->sourcePath = infile.fileName();
+    }
+
     QHash<QString, int> symboltable;
     QVector<AsmLabelArg> secondpasslabels;
 
@@ -94,6 +100,8 @@ int AsmParser::Parse(QFile& infile, QVector<quint32>& outvec, QString& errstr)
             // Add address
             symboltable[label] = currentmempos;
             qDebug() << "LABELPOS" << currentmempos;
+            if(debugInfo)
+                debugInfo->symbols.insert(currentmempos, label);
         }
 
         // Split arguments on comma
@@ -216,6 +224,8 @@ int AsmParser::Parse(QFile& infile, QVector<quint32>& outvec, QString& errstr)
             }
             memline |= (opargs & 0b1111111111111);
 
+            if(debugInfo)
+                debugInfo->append(currentmempos, IsConditionalJump(op) ? AsmDebugInfo::Branch : AsmDebugInfo::Instruction, lnum);
             VEC_APPEND(memline);
         }
         else
@@ -418,6 +428,21 @@ bool AsmParser::MnemonicHasArgs(const qint8& op)
     }
 }
 
+bool AsmParser::IsConditionalJump(const qint8& op)
+{
+    switch(op)
+    {
+        case TrnOpcodes::JPN:
+        case TrnOpcodes::JAG:
+        case TrnOpcodes::JPZ:
+        case TrnOpcodes::JPO:
+        case TrnOpcodes::JIG:
+            return true;
+        default:
+            return false;
+    }
+}
+
 quint16 AsmParser::MnemonicToOpcodeArg(const QString& mn)
 {
     // Build the map if it hasn't been done already
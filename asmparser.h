@@ -4,16 +4,19 @@
 #include <QFile>
 #include "trnopcodes.h"
 #include <QHash>
+#include "asmdebuginfo.h"
 
 class AsmParser
 {
 public:
-    static int Parse(QFile& infile, QVector<quint32>& outvec, QString& errstr);
+    // If debugInfo is given, it is filled in with the source line of every instruction and the symbol table
+    static int Parse(QFile& infile, QVector<quint32>& outvec, QString& errstr, AsmDebugInfo* debugInfo = nullptr);
 private:
     static qint8 StrToOpcode(const QString& cmd);
     static QHash<QString, TrnOpcodes::TrnOpcode> opmap;
     static QHash<QString, quint16> opargmap;
     static bool MnemonicHasArgs(const qint8& op);
+    static bool IsConditionalJump(const qint8& op);
     static quint16 MnemonicToOpcodeArg(const QString& mn);
 };
 
@@ -0,0 +1,31 @@
+#include "asmsymboltable.h"
+#include <algorithm>
+
+QVector<AsmSymbolTable::Symbol>::const_iterator AsmSymbolTable::lowerBound(int addr) const
+{
+    return std::lower_bound(_symbols.constBegin(), _symbols.constEnd(), addr, [](const Symbol& s, int a) { return s.addr < a; });
+}
+
+void AsmSymbolTable::insert(int addr, const QString& name)
+{
+    // After any that are already at that address
+    auto i = std::upper_bound(_symbols.constBegin(), _symbols.constEnd(), addr, [](int a, const Symbol& s) { return a < s.addr; });
+    _symbols.insert(i - _symbols.constBegin(), Symbol{(quint16)addr, name});
+}
+
+QString AsmSymbolTable::labelAt(int addr) const
+{
+    auto i = lowerBound(addr);
+    if(i == _symbols.constEnd() || i->addr != addr)
+        return QString();
+    return i->name;
+}
+
+int AsmSymbolTable::addressOf(const QString& name) const
+{
+    // Only ever needed for a single lookup, so it isn't worth an index of its own
+    for(const Symbol& s : _symbols)
+        if(s.name == name)
+            return s.addr;
+    return -1;
+}
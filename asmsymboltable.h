@@ -0,0 +1,36 @@
+#ifndef ASMSYMBOLTABLE_H
+#define ASMSYMBOLTABLE_H
+#include <QVector>
+#include <QString>
+
+// The labels of an assembled program, kept sorted by address so that an address can be looked up in O(log n)
+// It outlives the assembler, and is saved along with memory images
+class AsmSymbolTable
+{
+public:
+    typedef struct {
+        quint16 addr;
+        QString name;
+    } Symbol;
+
+    AsmSymbolTable() : _symbols() {}
+    inline void clear() { _symbols.clear(); }
+    inline bool isEmpty() const { return _symbols.isEmpty(); }
+    inline int size() const { return _symbols.size(); }
+    // In address order
+    inline const QVector<Symbol>& symbols() const { return _symbols; }
+
+    // Several labels can share an address, the one added first is the one that is shown
+    void insert(int addr, const QString& name);
+    // The label at addr, or an empty string if there is none
+    QString labelAt(int addr) const;
+    // The address of the label, or -1 if there is no such label
+    int addressOf(const QString& name) const;
+
+private:
+    QVector<Symbol> _symbols;
+    // The first symbol at or after addr
+    QVector<Symbol>::const_iterator lowerBound(int addr) const;
+};
+
+#endif // ASMSYMBOLTABLE_H
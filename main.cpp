@@ -1,8 +1,498 @@
 #include "mainwindow.h"
 #include <QApplication>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QByteArray>
+#include <QTextStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include "trnconformance.h"
+#include "trnfastemu.h"
+#include "trncoverage.h"
+#include "trnprofiler.h"
+#include "trnsweep.h"
+#include "trnfuzzer.h"
+#include "trnlaneemu.h"
+#include "trnresultcache.h"
+#include "asmparser.h"
+#include "trnmemory.h"
+#include <cstring>
+
+// Options that run without the GUI, and thus without needing a display
+static const char* const headlessOptions[] = {
+    "--conformance",
+    "--coverage",
+    "--profile",
+    "--sweep",
+    "--fuzz",
+    "--batch",
+};
+
+static bool isHeadless(int argc, char* argv[])
+{
+    for(int i = 1; i < argc; i++)
+        for(const char* opt : headlessOptions)
+            if(QByteArray(argv[i]).startsWith(opt))
+                return true;
+    return false;
+}
+
+// QTextStream's endl is deprecated as of Qt 5.15, and its replacement Qt::endl isn't there before it
+static void printLine(QTextStream& err, const QString& line)
+{
+    err << line << "\n";
+    err.flush();
+}
+
+// Assembles the program at path, with debug info pointing back at it
+// With zeroFill, the program gets the whole address space, like with "Zero Fill Memory" in the GUI
+static bool assemble(const QString& path, bool zeroFill, QVector<quint32>& pgm, AsmDebugInfo& info, QTextStream& err)
+{
+    QFile f(path);
+    if(!f.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        printLine(err, QCoreApplication::translate("main", "Could not open %1").arg(path));
+        return false;
+    }
+    QString errstr;
+    int line = AsmParser::Parse(f, pgm, errstr, &info);
+    if(line)
+    {
+        printLine(err, QCoreApplication::translate("main", "Parse error in line %1\n%2").arg(line).arg(errstr));
+        return false;
+    }
+    info.sourcePath = QFileInfo(path).absoluteFilePath();
+    if(zeroFill && pgm.size() < TrnMemory::Size)
+        pgm.resize(TrnMemory::Size);
+    return true;
+}
+
+// Like assemble, but without debug info, and the source is only parsed if it isn't in the cache yet
+static bool assembleCached(const QString& path, bool zeroFill, TrnResultCache& cache, QVector<quint32>& pgm, QTextStream& err)
+{
+    QFile f(path);
+    if(!f.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        printLine(err, QCoreApplication::translate("main", "Could not open %1").arg(path));
+        return false;
+    }
+    const QByteArray key = TrnResultCache::imageKey(f.readAll());
+    if(!cache.findImage(key, pgm))
+    {
+        f.seek(0);
+        QString errstr;
+        int line = AsmParser::Parse(f, pgm, errstr);
+        if(line)
+        {
+            printLine(err, QCoreApplication::translate("main", "Parse error in line %1\n%2").arg(line).arg(errstr));
+            return false;
+        }
+        // Not being able to cache it doesn't stop the run, storing the results will fail and say so as well
+        cache.storeImage(key, pgm);
+    }
+    if(zeroFill && pgm.size() < TrnMemory::Size)
+        pgm.resize(TrnMemory::Size);
+    return true;
+}
+
+static bool parseInputs(const QString& list, QVector<quint32>& inputs, QTextStream& err)
+{
+    for(const QString& v : list.split(QChar(',')))
+    {
+        // Skipped by hand, QString::SkipEmptyParts is deprecated and Qt::SkipEmptyParts needs Qt 5.14
+        if(v.isEmpty())
+            continue;
+        bool ok;
+        inputs.append(v.trimmed().toInt(&ok) & 0b11111111111111111111);
+        if(!ok)
+        {
+            printLine(err, QCoreApplication::translate("main", "Invalid input %1").arg(v));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs the program until it stops on its own or after maxInstructions, and reports why if it didn't halt
+static void runToEnd(TrnFastEmu& emu, const QString& list, quint64 maxInstructions, QTextStream& err)
+{
+    emu.setLoopDetection(true);
+    emu.setLoopAcceleration(true);
+    TrnFastEmu::Status st = emu.run(maxInstructions);
+    if(st == TrnFastEmu::OutOfBounds)
+        printLine(err, QCoreApplication::translate("main", "Inputs \"%1\": out of bounds access at %2").arg(list).arg(emu.faultAddress()));
+    else if(st == TrnFastEmu::WaitingForInput)
+        printLine(err, QCoreApplication::translate("main", "Inputs \"%1\": ran out of inputs").arg(list));
+    else if(st == TrnFastEmu::InfiniteLoop)
+        printLine(err, QCoreApplication::translate("main", "Inputs \"%1\": infinite loop of %2 instructions").arg(list).arg(emu.loopPeriod()));
+    else if(st == TrnFastEmu::Running)
+        printLine(err, QCoreApplication::translate("main", "Inputs \"%1\": stopped after %2 instructions").arg(list).arg(maxInstructions));
+}
+
+static bool openOutput(const QString& outPath, QFile& outFile, QTextStream& err)
+{
+    if(outPath.isEmpty())
+        return outFile.open(stdout, QIODevice::WriteOnly);
+    outFile.setFileName(outPath);
+    if(!outFile.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        printLine(err, QCoreApplication::translate("main", "Could not open %1 for writing").arg(outPath));
+        return false;
+    }
+    return true;
+}
+
+// Runs an assembly program once for every input list, and writes the combined coverage in lcov format
+static int runCoverage(const QString& path, bool zeroFill, const QStringList& inputLists, quint64 maxInstructions, const QString& outPath, QTextStream& err)
+{
+    QVector<quint32> pgm;
+    AsmDebugInfo info;
+    if(!assemble(path, zeroFill, pgm, info, err))
+        return 1;
+
+    TrnCoverage total;
+    // Without any inputs, the program still runs once
+    QStringList runs = inputLists.isEmpty() ? QStringList(QString()) : inputLists;
+    for(const QString& list : runs)
+    {
+        QVector<quint32> inputs;
+        if(!parseInputs(list, inputs, err))
+            return 1;
+
+        TrnFastEmu emu(pgm);
+        TrnCoverage c;
+        emu.setCoverage(&c);
+        emu.setInputQueue(inputs);
+        runToEnd(emu, list, maxInstructions, err);
+        total.merge(c);
+    }
+
+    QFile outFile;
+    if(!openOutput(outPath, outFile, err))
+        return 1;
+    QTextStream out(&outFile);
+    total.writeLcov(out, info, QFileInfo(path).completeBaseName());
+    return 0;
+}
+
+// Runs an assembly program once for every input list, and writes where the clock cycles went, by subroutine
+// The format is "summary", "collapsed" (flame graph stacks) or "chrome" (trace events)
+static int runProfile(const QString& path, bool zeroFill, const QStringList& inputLists, quint64 maxInstructions, const QString& format, const QString& outPath, QTextStream& err)
+{
+    if(format != "summary" && format != "collapsed" && format != "chrome")
+    {
+        printLine(err, QCoreApplication::translate("main", "Unknown profile format %1").arg(format));
+        return 1;
+    }
+    QVector<quint32> pgm;
+    AsmDebugInfo info;
+    if(!assemble(path, zeroFill, pgm, info, err))
+        return 1;
+
+    TrnProfiler profiler;
+    QStringList runs = inputLists.isEmpty() ? QStringList(QString()) : inputLists;
+    for(const QString& list : runs)
+    {
+        QVector<quint32> inputs;
+        if(!parseInputs(list, inputs, err))
+            return 1;
+
+        TrnFastEmu emu(pgm);
+        profiler.start(emu.registers().PC, emu.registers().CLOCK);
+        emu.setProfiler(&profiler);
+        emu.setInputQueue(inputs);
+        runToEnd(emu, list, maxInstructions, err);
+        profiler.finish(emu.registers().CLOCK);
+    }
+
+    QFile outFile;
+    if(!openOutput(outPath, outFile, err))
+        return 1;
+    QTextStream out(&outFile);
+    if(format == "collapsed")
+        profiler.writeCollapsed(out, info);
+    else if(format == "chrome")
+        profiler.writeChromeTrace(out, info);
+    else
+        profiler.writeSummary(out, info);
+    return 0;
+}
+
+// Runs an assembly program on every combination of inputs in the ranges, one per INP, and writes what each of them output
+static int runSweep(const QString& path, bool zeroFill, const QStringList& rangeArgs, quint64 maxInstructions, const QString& outPath, QTextStream& err)
+{
+    QVector<TrnSweep::Range> ranges;
+    for(const QString& arg : rangeArgs)
+    {
+        QStringList bounds = arg.split(QChar('-'));
+        bool ok = bounds.size() <= 2;
+        TrnSweep::Range r = {0, 0};
+        if(ok)
+            r.first = bounds.first().trimmed().toUInt(&ok);
+        if(ok)
+            r.last = bounds.last().trimmed().toUInt(&ok);
+        if(!ok || r.first > r.last || r.last > 0b11111111111111111111)
+        {
+            printLine(err, QCoreApplication::translate("main", "Invalid input range %1").arg(arg));
+            return 1;
+        }
+        ranges.append(r);
+    }
+    // Every value of a single input
+    if(ranges.isEmpty())
+        ranges.append(TrnSweep::Range{0, 0b11111111111111111111});
+
+    QVector<quint32> pgm;
+    AsmDebugInfo info;
+    if(!assemble(path, zeroFill, pgm, info, err))
+        return 1;
+
+    TrnSweep sweep(pgm, ranges, maxInstructions);
+    if(!sweep.combinations())
+    {
+        printLine(err, QCoreApplication::translate("main", "Too many input combinations, the most is %1").arg((int)TrnSweep::MaxCombinations));
+        return 1;
+    }
+    sweep.run(QThread::idealThreadCount());
+    printLine(err, QCoreApplication::translate("main", "%1 input combinations, %2 instructions executed instead of %3, %4 of them skipped by loop acceleration")
+                   .arg(sweep.combinations()).arg(sweep.instructionsExecuted()).arg(sweep.instructionsUnshared()).arg(sweep.instructionsAccelerated()));
+
+    QFile outFile;
+    if(!openOutput(outPath, outFile, err))
+        return 1;
+    QTextStream out(&outFile);
+    sweep.writeTable(out);
+    return 0;
+}
+
+// Fuzzes an assembly program's inputs, starting from the input lists, and writes the problems it ran into
+static int runFuzz(const QString& path, bool zeroFill, const QStringList& inputLists, quint64 runs, quint32 seed, quint64 maxInstructions, const QString& outPath, QTextStream& err)
+{
+    QVector<quint32> pgm;
+    AsmDebugInfo info;
+    if(!assemble(path, zeroFill, pgm, info, err))
+        return 1;
+
+    TrnFuzzer fuzzer(pgm, maxInstructions, seed);
+    for(const QString& list : inputLists)
+    {
+        QVector<quint32> inputs;
+        if(!parseInputs(list, inputs, err))
+            return 1;
+        fuzzer.addSeed(inputs);
+    }
+    fuzzer.run(runs, QThread::idealThreadCount());
+
+    QFile outFile;
+    if(!openOutput(outPath, outFile, err))
+        return 1;
+    QTextStream out(&outFile);
+    fuzzer.writeReport(out, info.symbols);
+    return fuzzer.findings().isEmpty() ? 0 : 1;
+}
+
+// Runs an assembly program once for every input list, as many at a time as TrnLaneEmu has lanes,
+// and writes how each run ended and what it output, one line each
+static int runBatch(const QString& path, bool zeroFill, const QStringList& inputLists, const QString& inputFile, quint64 maxInstructions, const QString& outPath,
+                    const QString& cacheDir, QTextStream& err)
+{
+    QStringList lists = inputLists;
+    if(!inputFile.isEmpty())
+    {
+        QFile f(inputFile);
+        if(!f.open(QIODevice::ReadOnly | QIODevice::Text))
+        {
+            printLine(err, QCoreApplication::translate("main", "Could not open %1").arg(inputFile));
+            return 1;
+        }
+        QTextStream in(&f);
+        while(!in.atEnd())
+        {
+            QString line = in.readLine().trimmed();
+            if(!line.isEmpty() && !line.startsWith('#'))
+                lists.append(line);
+        }
+    }
+    if(lists.isEmpty())
+        lists.append(QString());
+
+    QVector<QVector<quint32>> inputs(lists.size());
+    for(int i = 0; i < lists.size(); i++)
+        if(!parseInputs(lists.at(i), inputs[i], err))
+            return 1;
+
+    const bool cached = !cacheDir.isEmpty();
+    TrnResultCache cache(cacheDir);
+    if(cached && !cache.open())
+    {
+        printLine(err, QCoreApplication::translate("main", "Could not create the cache in %1").arg(cacheDir));
+        return 1;
+    }
+
+    QVector<quint32> pgm;
+    if(cached)
+    {
+        if(!assembleCached(path, zeroFill, cache, pgm, err))
+            return 1;
+    }
+    else
+    {
+        AsmDebugInfo info;
+        if(!assemble(path, zeroFill, pgm, info, err))
+            return 1;
+    }
+
+    QFile outFile;
+    if(!openOutput(outPath, outFile, err))
+        return 1;
+
+    // Runs that are in the cache are filled in first, only the others go through the lanes
+    QVector<TrnResultCache::Result> results(inputs.size());
+    QVector<QVector<quint32>> outputs(inputs.size());
+    QVector<QByteArray> keys(inputs.size());
+    QVector<int> pending;
+    const QByteArray image = (cached ? TrnResultCache::imageDigest(pgm) : QByteArray());
+    for(int i = 0; i < inputs.size(); i++)
+    {
+        if(cached)
+            keys[i] = TrnResultCache::resultKey(image, inputs.at(i), maxInstructions);
+        if(!cached || !cache.findResult(keys.at(i), results[i], outputs[i]))
+            pending.append(i);
+    }
+
+    quint64 steps = 0, instructions = 0;
+    bool storeFailed = false;
+    for(int first = 0; first < pending.size(); first += TrnLaneEmu::Lanes)
+    {
+        const int count = qMin((int)TrnLaneEmu::Lanes, pending.size() - first);
+        TrnLaneEmu lanes(pgm);
+        // Lanes left over repeat the last run, which costs nothing, as they stay in its group all the way
+        for(int l = 0; l < TrnLaneEmu::Lanes; l++)
+            lanes.setInputQueue(l, inputs.at(pending.at(first + qMin(l, count - 1))));
+        lanes.run(maxInstructions);
+        steps += lanes.steps();
+
+        for(int l = 0; l < count; l++)
+        {
+            const int run = pending.at(first + l);
+            const TrnState s = lanes.state(l);
+            const QByteArray digest = TrnResultCache::stateDigest(s);
+            TrnResultCache::Result& r = results[run];
+            r.status = lanes.status(l);
+            r.clock = s.CLOCK;
+            r.instructions = lanes.instructionsRetired(l);
+            memcpy(r.digest, digest.constData(), sizeof(r.digest));
+            outputs[run] = lanes.outputs(l);
+            instructions += r.instructions;
+            if(cached && !cache.storeResult(keys.at(run), r, outputs.at(run)))
+                storeFailed = true;
+        }
+    }
+
+    QTextStream out(&outFile);
+    out << "# inputs\tstatus\toutputs\tcycles\tstate\n";
+    for(int i = 0; i < inputs.size(); i++)
+    {
+        const TrnResultCache::Result& r = results.at(i);
+        QStringList in, outs;
+        for(quint32 v : inputs.at(i))
+            in << QString::number(v);
+        for(quint32 v : outputs.at(i))
+            outs << QString::number(v);
+        out << (in.isEmpty() ? QString("-") : in.join(QChar(','))) << "\t" << TrnFastEmu::statusName((TrnFastEmu::Status)r.status) << "\t"
+            << outs.join(QChar(',')) << "\t" << r.clock << "\t" << QString::fromLatin1(QByteArray(r.digest, sizeof(r.digest)).toHex()) << "\n";
+    }
+    if(storeFailed)
+        printLine(err, QCoreApplication::translate("main", "Could not write some of the results to the cache in %1").arg(cacheDir));
+    printLine(err, QCoreApplication::translate("main", "%1 runs, %2 from the cache, %3 instructions in %4 steps").arg(inputs.size()).arg(inputs.size() - pending.size())
+                   .arg(instructions).arg(steps));
+    return 0;
+}
+
+static int runHeadless(int argc, char* argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+
+    QCommandLineOption conformanceOpt("conformance", QCoreApplication::translate("main", "Run <count> random programs on every execution engine and compare them against the reference."), "count");
+    QCommandLineOption seedOpt("seed", QCoreApplication::translate("main", "Seed for the random program generator and the fuzzer."), "seed", "1");
+    QCommandLineOption maxInsnOpt("max-instructions", QCoreApplication::translate("main", "Stop each program after <count> instructions."), "count", "2000");
+    QCommandLineOption coverageOpt("coverage", QCoreApplication::translate("main", "Run the assembly program <file> and write its line and branch coverage in lcov format."), "file");
+    QCommandLineOption profileOpt("profile", QCoreApplication::translate("main", "Run the assembly program <file> and write how many clock cycles each subroutine took."), "file");
+    QCommandLineOption formatOpt("format", QCoreApplication::translate("main", "Profile format: summary, collapsed (flame graph input) or chrome (trace event JSON)."), "format", "summary");
+    QCommandLineOption sweepOpt("sweep", QCoreApplication::translate("main", "Run the assembly program <file> on every combination of inputs, and write a table of what each one output."), "file");
+    QCommandLineOption rangeOpt("range", QCoreApplication::translate("main", "Values a sweep tries for an INP, as <first>-<last>. Give it once for every INP, in order. Defaults to every value of the first one."), "range");
+    QCommandLineOption fuzzOpt("fuzz", QCoreApplication::translate("main", "Run the assembly program <file> on mutated inputs, and report the ones that go out of bounds, run away with the stack, hit an undefined instruction or hang."), "file");
+    QCommandLineOption runsOpt("runs", QCoreApplication::translate("main", "Number of runs the fuzzer makes."), "count", "100000");
+    QCommandLineOption batchOpt("batch", QCoreApplication::translate("main", "Run the assembly program <file> once for every list of inputs, several at a time, and write a table of what each one output."), "file");
+    QCommandLineOption cacheOpt("cache", QCoreApplication::translate("main", "Keep the assembled program and the result of every batch run in the directory <dir>, and reuse them instead of assembling and running again."), "dir");
+    QCommandLineOption inputFileOpt("input-file", QCoreApplication::translate("main", "Read more input lists for a batch run from <file>, one comma separated list per line."), "file");
+    QCommandLineOption zeroFillOpt("zero-fill", QCoreApplication::translate("main", "Let the program use the whole address space, zero filled, instead of only the words it assembled to."));
+    QCommandLineOption inputsOpt("inputs", QCoreApplication::translate("main", "Comma separated inputs for a coverage, profile or batch run, or to start fuzzing from. Can be given several times, for one run each."), "list");
+    QCommandLineOption outputOpt("output", QCoreApplication::translate("main", "Write the coverage, profile, sweep or batch table, or fuzzer report to <file> instead of the standard output."), "file");
+    parser.addOption(conformanceOpt);
+    parser.addOption(seedOpt);
+    parser.addOption(maxInsnOpt);
+    parser.addOption(coverageOpt);
+    parser.addOption(profileOpt);
+    parser.addOption(formatOpt);
+    parser.addOption(sweepOpt);
+    parser.addOption(rangeOpt);
+    parser.addOption(fuzzOpt);
+    parser.addOption(runsOpt);
+    parser.addOption(batchOpt);
+    parser.addOption(inputFileOpt);
+    parser.addOption(cacheOpt);
+    parser.addOption(zeroFillOpt);
+    parser.addOption(inputsOpt);
+    parser.addOption(outputOpt);
+    parser.process(a);
+
+    QTextStream out(stdout);
+    if(parser.isSet(conformanceOpt))
+    {
+        TrnConformance c(parser.value(seedOpt).toUInt(), parser.value(maxInsnOpt).toULongLong());
+        return c.run(parser.value(conformanceOpt).toInt(), out) ? 1 : 0;
+    }
+    if(parser.isSet(coverageOpt))
+    {
+        QTextStream err(stderr);
+        return runCoverage(parser.value(coverageOpt), parser.isSet(zeroFillOpt), parser.values(inputsOpt), parser.value(maxInsnOpt).toULongLong(), parser.value(outputOpt), err);
+    }
+    if(parser.isSet(profileOpt))
+    {
+        QTextStream err(stderr);
+        return runProfile(parser.value(profileOpt), parser.isSet(zeroFillOpt), parser.values(inputsOpt), parser.value(maxInsnOpt).toULongLong(), parser.value(formatOpt),
+                          parser.value(outputOpt), err);
+    }
+    if(parser.isSet(sweepOpt))
+    {
+        QTextStream err(stderr);
+        return runSweep(parser.value(sweepOpt), parser.isSet(zeroFillOpt), parser.values(rangeOpt), parser.value(maxInsnOpt).toULongLong(),
+                        parser.value(outputOpt), err);
+    }
+    if(parser.isSet(fuzzOpt))
+    {
+        QTextStream err(stderr);
+        return runFuzz(parser.value(fuzzOpt), parser.isSet(zeroFillOpt), parser.values(inputsOpt), parser.value(runsOpt).toULongLong(), parser.value(seedOpt).toUInt(),
+                       parser.value(maxInsnOpt).toULongLong(), parser.value(outputOpt), err);
+    }
+    if(parser.isSet(batchOpt))
+    {
+        QTextStream err(stderr);
+        return runBatch(parser.value(batchOpt), parser.isSet(zeroFillOpt), parser.values(inputsOpt), parser.value(inputFileOpt), parser.value(maxInsnOpt).toULongLong(),
+                        parser.value(outputOpt), parser.value(cacheOpt), err);
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
+    if(isHeadless(argc, argv))
+        return runHeadless(argc, argv);
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
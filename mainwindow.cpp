@@ -12,20 +12,41 @@
 #include "mifserializer.h"
 #include <QCloseEvent>
 #include "tablewidgetitemanimator.h"
+#include "trntracewriter.h"
 #include "qoverloadlegacy.h"
 #include <QScrollBar>
 #include <QToolButton>
 #include <QFontDatabase>
 #include <QDesktopServices>
+#include <QtMath>
+#include <QInputDialog>
+#include <QProgressDialog>
+#include <climits>
 
 #define MEM_STR_FORMAT(a, b, ai, di)    QTableWidgetItem* a = new QTableWidgetItem(QString::number(ai)); \
                                         a->setFont(monofont); \
                                         QTableWidgetItem* b = new QTableWidgetItem(QString("%1").arg(di, 20, 2, QChar('0'))); \
                                         b->setFont(monofont)
 
+// Painted by MemoryHeatDelegate
+#define HEAT_COLUMN 3
+
+// Slider positions per decade of Hz
+static const int clockSliderSteps = 100;
+
+static QString formatClockRate(quint64 hz)
+{
+    if(hz >= 1000000)
+        return QObject::tr("%1 MHz").arg((double)hz / 1000000, 0, 'f', 2);
+    if(hz >= 1000)
+        return QObject::tr("%1 kHz").arg((double)hz / 1000, 0, 'f', 2);
+    return QObject::tr("%1 Hz").arg(hz);
+}
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow), emu(nullptr), animator(new TableWidgetItemAnimator(500, this)), pcarrowpos(0), _pcarrow(nullptr), monofont("Monospace"), clockDelay(500)
+    ui(new Ui::MainWindow), emu(nullptr), animator(new TableWidgetItemAnimator(500, this)), pcarrowpos(0), _pcarrow(nullptr), monofont("Monospace"), clockHz(2),
+    traceReader(nullptr), logFrom(0), logTo(0), logStore(new TrnLogStore()), logExporter(nullptr), logMatch(0), heatDelegate(new MemoryHeatDelegate(&heat, this)), clockRateLabel(new QLabel(this))
 {
     ui->setupUi(this);
     connect(ui->actionQuit, &QAction::triggered, this, &MainWindow::close, Qt::QueuedConnection);
@@ -36,6 +57,24 @@ MainWindow::MainWindow(QWidget *parent) :
 
     qRegisterMetaType<TrnEmu::Register>("Register");
     qRegisterMetaType<TrnEmu::OperationType>("OperationType");
+    qRegisterMetaType<TrnState>("TrnState");
+
+    connect(&frameTimer, &QTimer::timeout, this, &MainWindow::renderFrame);
+    ui->statusBar->addPermanentWidget(clockRateLabel);
+    // Right clicking a memory row
+    ui->memoryTable->addAction(ui->actionRun_To_Here);
+    ui->memoryTable->addAction(ui->actionToggle_Breakpoint);
+    ui->memoryTable->addAction(ui->actionToggle_Watchpoint);
+    // Only shown while a trace is open
+    ui->traceScrubber->hide();
+    // The log filter applies live
+    for(QAction* a : { ui->actionLog_Fetch, ui->actionLog_Dereference, ui->actionLog_Execute, ui->actionLog_Clock,
+                       ui->actionLog_Flags, ui->actionLog_Memory_Reads, ui->actionLog_Memory_Writes })
+        connect(a, &QAction::toggled, this, &MainWindow::applyLogFilter);
+    ui->memoryTable->setItemDelegateForColumn(HEAT_COLUMN, heatDelegate);
+    qRegisterMetaType<QVector<int>>("QVector<int>");
+    connect(&logIndex, &TrnLogIndex::searchFinished, this, &MainWindow::logSearchFinished);
+    logIndex.start(QThread::LowPriority);
 
     // Stretch the action column in the horizontal log header
     QHeaderView* hv = ui->logTable->horizontalHeader();
@@ -91,6 +130,8 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->regH->setFont(monofont);
     // And finally the output
     ui->outputLineEdit->setFont(monofont);
+
+    resetGUI();
 }
 
 MainWindow::~MainWindow()
@@ -99,6 +140,7 @@ MainWindow::~MainWindow()
         delete emu;
     if(_pcarrow)
         delete _pcarrow;
+    delete traceReader;
     delete animator;
     delete ui;
 }
@@ -186,9 +228,18 @@ int MainWindow::loadNewFile(QString file)
     fswatcher.addPath(file);
     // Clear the vector before loading the new file
     pgmmem.clear();
+    symbols.clear();
     // Call the correct function for asm or mif
     QString err;
-    int line = (file.toLower().endsWith(".asm") ? AsmParser::Parse(f, pgmmem, err) : MifSerializer::MifToVector(f, pgmmem, err));
+    int line;
+    if(file.toLower().endsWith(".asm"))
+    {
+        AsmDebugInfo info;
+        line = AsmParser::Parse(f, pgmmem, err, &info);
+        symbols = info.symbols;
+    }
+    else
+        line = MifSerializer::MifToVector(f, pgmmem, err, &symbols);
 
     if(line)
     {
@@ -198,17 +249,31 @@ int MainWindow::loadNewFile(QString file)
         QMessageBox::critical(this, tr("Parse error"), tr("Parse error%1\n%2").arg(msgarg, err), QMessageBox::Ok);
         // Clear the memory vector, otherwise it's possible to start executing
         pgmmem.clear();
+        symbols.clear();
         return 1;
     }
 
     // Clear tables
-    ui->logTable->setRowCount(0);
+    clearLog();
+    populateMemoryTable(pgmmem);
+    return 0;
+}
+
+void MainWindow::populateMemoryTable(const QVector<quint32>& mem)
+{
     ui->memoryTable->setRowCount(0);
+    // A running emulator is still counting into it. It starts over on the next run
+    if(!emu)
+    {
+        heat.reset(mem.size());
+        heatDelegate->updateScale();
+    }
 
-    for(int i = 0; i < pgmmem.size(); i++)
+    for(int i = 0; i < mem.size(); i++)
     {
         ui->memoryTable->insertRow(i);
-        MEM_STR_FORMAT(addr, memcontent, i, pgmmem.at(i));
+        MEM_STR_FORMAT(addr, memcontent, i, mem.at(i));
+        decorateAddress(addr, i);
         ui->memoryTable->setItem(i, 0, new QTableWidgetItem());
         ui->memoryTable->setItem(i, 1, addr);
         ui->memoryTable->setItem(i, 2, memcontent);
@@ -225,8 +290,8 @@ int MainWindow::loadNewFile(QString file)
     arrow->setTextAlignment(Qt::AlignCenter);
     ui->memoryTable->setItem(0, 0, arrow);
     pcarrowpos = 0;
-
-    return 0;
+    // Make room for the labels
+    ui->memoryTable->resizeColumnToContents(1);
 }
 
 void MainWindow::askEmuThreadToStop()
@@ -253,6 +318,10 @@ void MainWindow::on_startStopBtn_clicked()
     ui->statusBar->clearMessage();
     ui->outputLineEdit->clear();
 
+    // Back to running the program for real
+    if(traceReader)
+        closeTrace();
+
     // If there's nothing loaded in memory, ask the user to open a file
     if(!pgmmem.length())
     {
@@ -262,13 +331,34 @@ void MainWindow::on_startStopBtn_clicked()
             return;
     }
 
-    // Clear log
-    ui->logTable->setRowCount(0);
+    clearLog();
 
     ui->startStopBtn->setText(tr("Stop"));
     ui->pauseBtn->setEnabled(true);
-    ui->actionLog_Execution_Phase_Only->setEnabled(false);
-    emu = new TrnEmu(clockDelay, pgmmem, ui->actionLog_Execution_Phase_Only->isChecked(), this);
+    ui->actionZero_Fill_Memory->setEnabled(false);
+
+    // With zero fill, the program can use the whole address space, so show all of it
+    QVector<quint32> mem = pgmmem;
+    TrnMemory::OutOfRangePolicy policy = TrnMemory::Fault;
+    if(ui->actionZero_Fill_Memory->isChecked())
+    {
+        policy = TrnMemory::ZeroFill;
+        if(mem.size() < TrnMemory::Size)
+            mem.resize(TrnMemory::Size);
+    }
+    if(ui->memoryTable->rowCount() != mem.size())
+        populateMemoryTable(mem);
+
+    emu = new TrnEmu(clockHz, pgmmem, logCategories(), policy, this);
+    applyLogFilter();
+    heat.reset(mem.size());
+    heatDelegate->updateScale();
+    emu->setHeatMap(&heat);
+    emu->setLoopDetection(true);
+    for(int addr : breakpoints)
+        emu->setBreakpoint(addr, true);
+    for(int addr : watchpoints)
+        emu->setWatchpoint(addr, true);
     connect(emu, &QThread::finished, this, &MainWindow::emuThreadStopped);
     connect(ui->stepBtn, &QPushButton::clicked, emu, &TrnEmu::step);
     connect(emu, &TrnEmu::executionError, this, [this](QString str){ QMessageBox::critical(this, tr("Fatal Execution Error"), str, QMessageBox::Ok); });
@@ -279,9 +369,12 @@ void MainWindow::on_startStopBtn_clicked()
         QScrollBar* s = ui->logTable->verticalScrollBar();
         bool autoscroll = !(s->value() < s->maximum() - 2);
         ui->logTable->insertRow(row);
+        annotateLogValue(str, val);
         ui->logTable->setItem(row, 0, new QTableWidgetItem(QString::number(clock)));
         ui->logTable->setItem(row, 1, new QTableWidgetItem(str));
         ui->logTable->setItem(row, 2, new QTableWidgetItem(val));
+        logStore->append(clock, str, val);
+        logIndex.addRow(str, val);
         if(autoscroll)
             ui->logTable->scrollToBottom();
 
@@ -311,7 +404,43 @@ void MainWindow::on_startStopBtn_clicked()
     connect(emu, OVERLOAD_PTR(SINGLE_ARG(TrnEmu::Register, TrnEmu::OperationType, quint32),TrnEmu, registerUpdated),
             this, OVERLOAD_PTR(SINGLE_ARG(TrnEmu::Register, TrnEmu::OperationType, quint32), MainWindow, registerUpdate));
 
+    connect(emu, &TrnEmu::stateSampled, this, &MainWindow::stateSampled);
+    connect(emu, &TrnEmu::clockRateMeasured, this, [this](quint64 hz) {
+        clockRateLabel->setText(formatClockRate(hz));
+    });
+    connect(emu, &TrnEmu::traceFinished, this, [this](quint64 records, quint64 stalls, QString error) {
+        if(!error.isEmpty())
+            QMessageBox::critical(this, tr("Error writing trace"), tr("Could not write the trace:\n%1").arg(error));
+        else
+            ui->statusBar->showMessage(tr("Trace saved: %1 records, %2 stalls").arg(records).arg(stalls));
+    });
+    connect(emu, &TrnEmu::fastForwardFinished, this, [this]() {
+        // The emulator paused itself
+        ui->stepBtn->setEnabled(true);
+        ui->pauseBtn->setText(tr("Resume"));
+        ui->statusBar->showMessage(tr("Paused"));
+    });
+    connect(emu, &TrnEmu::infiniteLoopDetected, this, [this](quint64 period) {
+        // Paused, just like above
+        ui->stepBtn->setEnabled(true);
+        ui->pauseBtn->setText(tr("Resume"));
+        ui->statusBar->showMessage(tr("Paused in an infinite loop"));
+        QMessageBox::warning(this, tr("Infinite loop"), tr("The program is stuck in an infinite loop. It came back to exactly the same state after %1 instructions, so it will never halt.").arg(period));
+    });
+    connect(emu, &TrnEmu::breakpointHit, this, [this](int addr) {
+        ui->stepBtn->setEnabled(true);
+        ui->pauseBtn->setText(tr("Resume"));
+        ui->statusBar->showMessage(tr("Paused at breakpoint %1").arg(addr));
+    });
+    connect(emu, &TrnEmu::watchpointHit, this, [this](int addr) {
+        ui->stepBtn->setEnabled(true);
+        ui->pauseBtn->setText(tr("Resume"));
+        ui->statusBar->showMessage(tr("Paused after a write to %1").arg(addr));
+    });
+
     resetGUI();
+    shownMem = mem;
+    frameTimer.start(TrnEmu::frameInterval);
 
     // If we have an arrow item stored, set it to position 0
     if(_pcarrow)
@@ -321,11 +450,17 @@ void MainWindow::on_startStopBtn_clicked()
         _pcarrow = nullptr;
     }
 
+    if(!tracePath.isEmpty())
+        startEmuTrace();
+
     emu->start();
 }
 
 void MainWindow::emuThreadStopped()
 {
+    // Show whatever arrived after the last frame
+    renderFrame();
+    frameTimer.stop();
     ui->startStopBtn->setText(tr("Start"));
     ui->pauseBtn->setText(tr("Pause"));
     ui->startStopBtn->setEnabled(true);
@@ -334,7 +469,8 @@ void MainWindow::emuThreadStopped()
     emu->deleteLater();
     emu = nullptr;
     ui->statusBar->showMessage(tr("Emulation finished"));
-    ui->actionLog_Execution_Phase_Only->setEnabled(true);
+    clockRateLabel->clear();
+    ui->actionZero_Fill_Memory->setEnabled(true);
 }
 
 void MainWindow::on_actionSave_Memory_Image_triggered()
@@ -359,8 +495,10 @@ void MainWindow::on_actionSave_Memory_Image_triggered()
         return;
     }
 
-    int line = MifSerializer::VectorToMif(f, pgmmem);
-    if(line)
+    int line = MifSerializer::VectorToMif(f, pgmmem, &symbols);
+    if(line < 0)
+        QMessageBox::critical(this, tr("Error Saving Memory Image"), tr("An error occured while writing label %1 to file").arg(symbols.symbols().at(-line - 1).name), QMessageBox::Ok);
+    else if(line)
         QMessageBox::critical(this, tr("Error Saving Memory Image"), tr("An error occured while writing memory address %1 to file").arg(line), QMessageBox::Ok);
 }
 
@@ -386,6 +524,100 @@ void MainWindow::on_pauseBtn_clicked()
 }
 
 void MainWindow::memoryUpdate(int addr, quint32 data, TrnEmu::OperationType t)
+{
+    // Only the last access to each address within a frame gets shown
+    pendingMem[addr] = qMakePair(data, t);
+}
+
+void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, quint8 val)
+{
+    queueRegister(r, t, val);
+}
+
+void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, quint16 val)
+{
+    queueRegister(r, t, val);
+}
+
+void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, quint32 val)
+{
+    queueRegister(r, t, val);
+}
+
+void MainWindow::queueRegister(TrnEmu::Register r, TrnEmu::OperationType t, quint32 val)
+{
+    PendingRegister& p = pendingRegs[r];
+    p.val = val;
+    p.op = t;
+    p.dirty = true;
+}
+
+#define SAMPLE_REG(r)   if(s.r != shownRegs[TrnEmu::Register::r]) \
+                            queueRegister(TrnEmu::Register::r, TrnEmu::OperationType::InPlace, s.r)
+
+void MainWindow::stateSampled(TrnState s, QBitArray dirtyPages)
+{
+    // Anything still queued is older than this snapshot, so get it out of the way before diffing
+    renderFrame();
+
+    // We don't know what kind of access caused each change, so they all show up as in place
+    SAMPLE_REG(BR);
+    SAMPLE_REG(A);
+    SAMPLE_REG(X);
+    SAMPLE_REG(IR);
+    SAMPLE_REG(SP);
+    SAMPLE_REG(I);
+    SAMPLE_REG(PC);
+    SAMPLE_REG(AR);
+    SAMPLE_REG(SC);
+    SAMPLE_REG(CLOCK);
+    SAMPLE_REG(F);
+    SAMPLE_REG(V);
+    SAMPLE_REG(Z);
+    SAMPLE_REG(S);
+    SAMPLE_REG(H);
+
+    // Words can only have changed in the pages the emulator wrote to
+    int len = qMin(s.memory.size(), shownMem.size());
+    for(int page = 0; page * TrnMemory::PageSize < len; page++)
+    {
+        if(!dirtyPages.isNull() && !dirtyPages.testBit(page))
+            continue;
+        int end = qMin(len, (page + 1) * TrnMemory::PageSize);
+        for(int i = page * TrnMemory::PageSize; i < end; i++)
+            if(s.memory.at(i) != shownMem.at(i))
+                pendingMem[i] = qMakePair(s.memory.at(i), TrnEmu::OperationType::Write);
+    }
+}
+
+void MainWindow::renderFrame()
+{
+    for(int r = 0; r < TrnEmu::REG_MAX; r++)
+    {
+        PendingRegister& p = pendingRegs[r];
+        if(!p.dirty)
+            continue;
+        p.dirty = false;
+        showRegister((TrnEmu::Register)r, p.op, p.val);
+    }
+
+    for(auto i = pendingMem.constBegin(); i != pendingMem.constEnd(); ++i)
+        showMemory(i.key(), i.value().first, i.value().second);
+    pendingMem.clear();
+
+    if(emu)
+        updateHeatColumn();
+}
+
+void MainWindow::updateHeatColumn()
+{
+    heatDelegate->updateScale();
+    // Only the heat column needs repainting, there are no items to update
+    QWidget* vp = ui->memoryTable->viewport();
+    vp->update(ui->memoryTable->columnViewportPosition(HEAT_COLUMN), 0, ui->memoryTable->columnWidth(HEAT_COLUMN), vp->height());
+}
+
+void MainWindow::showMemory(int addr, quint32 data, TrnEmu::OperationType t)
 {
     // This should be safe as it's not possible to start the emulator with nothing in memory
    /* if(addr > ui->memoryTable->rowCount() - 1)
@@ -395,8 +627,12 @@ void MainWindow::memoryUpdate(int addr, quint32 data, TrnEmu::OperationType t)
         // Maybe we should just throw an error?
     }*/
 
+    if(addr < shownMem.size())
+        shownMem[addr] = data;
+
     // Update the row with the new contents
     MEM_STR_FORMAT(a, d, addr, data);
+    decorateAddress(a, addr);
     ui->memoryTable->setItem(addr, 1, a);
     ui->memoryTable->setItem(addr, 2, d);
     const QPalette& p = ui->memoryTable->palette();
@@ -424,15 +660,19 @@ void MainWindow::memoryUpdate(int addr, quint32 data, TrnEmu::OperationType t)
                                         mask = m; \
                                         break
 
-void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, quint8 val)
+void MainWindow::showRegister(TrnEmu::Register r, TrnEmu::OperationType t, quint32 val)
 {
+    shownRegs[r] = val;
+
     AnimatedLabel* l;
-    quint8 len;
-    quint32 mask;
+    // Most registers are 20 bits
+    quint8 len = 20;
+    quint32 mask = 0b11111111111111111111;
     switch(r)
     {
-       REG_CASE_MASK(SC, 2, 0b11);
-       case TrnEmu::Register::F:
+        // 8 bit registers
+        REG_CASE_MASK(SC, 2, 0b11);
+        case TrnEmu::Register::F:
             // Custom handling because F is split to two separate ones in the UI for some reason
             ui->regF1->setText(QString("%1").arg(val & 0b1, 1, 2, QChar('0')));
             animator->startLabelAnimation(ui->regF1, t);
@@ -443,24 +683,15 @@ void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, qui
         REG_CASE_MASK(Z, 1, 1);
         REG_CASE_MASK(S, 1, 1);
         REG_CASE_MASK(H, 1, 1);
-        default:
-            qDebug() << "Unknown 8 bit register" << r;
-            return;
-    }
-    l->setText(QString("%1").arg(val & mask , len, 2, QChar('0')));
-    animator->startLabelAnimation(l, t);
-}
 
-void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, quint16 val)
-{
-    AnimatedLabel* l;
-    switch(r)
-    {
-        REG_CASE(AR);
+        // 16 bit registers
+        REG_CASE_MASK(AR, 13, 0b1111111111111);
         // Handle PC manually to set the arrow in the table
         case TrnEmu::Register::PC:
         {
             l = ui->regPC;
+            len = 13;
+            mask = 0b1111111111111;
             // We can't take the existing item because that will cause the animation to continue on the next line
             // Instead, we copy it (manually) and then clear the original
             QTableWidgetItem* oldarrow = ui->memoryTable->item(pcarrowpos, 0);
@@ -470,7 +701,7 @@ void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, qui
             arrow->setTextAlignment(oldarrow->textAlignment());
             // If the new position is outside the table, store the new arrow
             // We need to do that in case the user restarts without reloading
-            if(val > ui->memoryTable->rowCount() - 1)
+            if(val > (quint32)ui->memoryTable->rowCount() - 1)
             {
                 _pcarrow = arrow;
                 pcarrowpos = 0;
@@ -484,21 +715,10 @@ void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, qui
             pcarrowpos = val;
             break;
         }
-        REG_CASE(I);
-        REG_CASE(SP);
-        default:
-            qDebug() << "Unknown 16 bit register" << val;
-            return;
-    }
-    l->setText(QString("%1").arg(val & 0b1111111111111 , 13, 2, QChar('0')));
-    animator->startLabelAnimation(l, t);
-}
+        REG_CASE_MASK(I, 13, 0b1111111111111);
+        REG_CASE_MASK(SP, 13, 0b1111111111111);
 
-void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, quint32 val)
-{
-    AnimatedLabel* l;
-    switch(r)
-    {
+        // 32 bit registers
         REG_CASE(BR);
         REG_CASE(IR);
         REG_CASE(A);
@@ -509,10 +729,10 @@ void MainWindow::registerUpdate(TrnEmu::Register r, TrnEmu::OperationType t, qui
             animator->startLabelAnimation(ui->clockValue, t);
             return;
         default:
-            qDebug() << "Unknown 32 bit register" << val;
+            qDebug() << "Unknown register" << r;
             return;
     }
-    l->setText(QString("%1").arg(val & 0b11111111111111111111 , 20, 2, QChar('0')));
+    l->setText(QString("%1").arg(val & mask , len, 2, QChar('0')));
     animator->startLabelAnimation(l, t);
 }
 
@@ -575,6 +795,14 @@ void MainWindow::resetGUI()
     ui->regZ->setText(empty1BitReg);
     ui->regS->setText(empty1BitReg);
     ui->regH->setText(empty1BitReg);
+
+    // Forget about anything that hasn't been shown yet
+    for(int r = 0; r < TrnEmu::REG_MAX; r++)
+    {
+        pendingRegs[r].dirty = false;
+        shownRegs[r] = 0;
+    }
+    pendingMem.clear();
 }
 
 void MainWindow::on_inputLineEdit_editingFinished()
@@ -645,66 +873,446 @@ void MainWindow::openWithDefaultApp(QString path)
 
 void MainWindow::on_clockSlider_valueChanged(int value)
 {
+    // The slider is logarithmic, so that it covers everything from 1 Hz to the maximum
+    quint32 hz = qMin(TrnEmu::maxClockRate, (quint32)qRound(qPow(10, (qreal)value / clockSliderSteps)));
     // Block the signals to not create an endless loop
     ui->clockSpinBox->blockSignals(true);
-    ui->clockSpinBox->setValue(value);
+    ui->clockSpinBox->setValue(hz);
     ui->clockSpinBox->blockSignals(false);
-    setEmuDelay(value);
+    setEmuClockRate(hz);
 }
 
 void MainWindow::on_clockSpinBox_valueChanged(int value)
 {
     ui->clockSlider->blockSignals(true);
-    ui->clockSlider->setValue(value);
+    ui->clockSlider->setValue(qRound(qLn(value) / qLn(10) * clockSliderSteps));
     ui->clockSlider->blockSignals(false);
-    setEmuDelay(value);
+    setEmuClockRate(value);
 }
 
-void MainWindow::setEmuDelay(int value)
+void MainWindow::setEmuClockRate(int hz)
 {
-    clockDelay = 1000 / value;
-    animator->setDuration(clockDelay);
+    clockHz = hz;
+    // Animations shorter than a frame would never be seen
+    animator->setDuration(qMax(1000 / hz, (int)TrnEmu::frameInterval));
     if(emu)
-        emu->setDelay(clockDelay);
+        emu->setClockRate(clockHz);
 }
 
-void MainWindow::on_actionSave_Log_triggered()
+void MainWindow::on_actionRun_To_Here_triggered()
+{
+    int row = ui->memoryTable->currentRow();
+    if(row < 0)
+        return;
+    fastForwardEmu(TrnEmu::ToAddress, row);
+}
+
+void MainWindow::clearLog()
+{
+    ui->logTable->setRowCount(0);
+    logStore.reset(new TrnLogStore());
+    logIndex.clear();
+    // Any search still running is about rows that are gone
+    logQuery.clear();
+    logMatches.clear();
+    ui->logSearchLabel->clear();
+}
+
+void MainWindow::on_logSearchEdit_returnPressed()
 {
-    if(emu && !emu->getPaused())
+    QString query = ui->logSearchEdit->text().trimmed();
+    if(query.isEmpty())
+        return;
+    // Enter again on the same query goes to the next match
+    if(query == logQuery && !logMatches.isEmpty())
     {
-        QMessageBox::warning(this, tr("Please pause the emulator"), tr("Can not save log while the emulator is running.\nPlease pause or stop it and try again."), QMessageBox::Ok);
+        logMatch = (logMatch + 1) % logMatches.size();
+        showLogMatch();
         return;
     }
-    int rowcount = ui->logTable->rowCount();
-    if(!rowcount)
+    logQuery = query;
+    logIndex.search(query);
+    ui->logSearchLabel->setText(tr("Searching..."));
+}
+
+void MainWindow::logSearchFinished(QString query, QVector<int> rows)
+{
+    // Superseded by another search, or the log was cleared
+    if(query != logQuery)
+        return;
+    logMatches = rows;
+    logMatch = 0;
+    if(logMatches.isEmpty())
     {
-        QMessageBox::warning(this, tr("Log is empty"), tr("The log is empty.\nPlease run the emulator first to generate messages."), QMessageBox::Ok);
+        ui->logSearchLabel->setText(tr("No matches"));
+        // Searching again looks at the rows that have come in since
+        logQuery.clear();
+        return;
+    }
+    showLogMatch();
+}
+
+void MainWindow::showLogMatch()
+{
+    int row = logMatches.at(logMatch);
+    ui->logTable->selectRow(row);
+    ui->logTable->scrollToItem(ui->logTable->item(row, 1));
+    ui->logSearchLabel->setText(tr("%1 of %2").arg(logMatch + 1).arg(logMatches.size()));
+}
+
+quint32 MainWindow::logCategories() const
+{
+    quint32 c = 0;
+    if(ui->actionLog_Fetch->isChecked())
+        c |= TrnEmu::LogFetch;
+    if(ui->actionLog_Dereference->isChecked())
+        c |= TrnEmu::LogDeref;
+    if(ui->actionLog_Execute->isChecked())
+        c |= TrnEmu::LogExecute;
+    if(ui->actionLog_Clock->isChecked())
+        c |= TrnEmu::LogClock;
+    if(ui->actionLog_Flags->isChecked())
+        c |= TrnEmu::LogFlags;
+    if(ui->actionLog_Memory_Reads->isChecked())
+        c |= TrnEmu::LogMemoryRead;
+    if(ui->actionLog_Memory_Writes->isChecked())
+        c |= TrnEmu::LogMemoryWrite;
+    return c;
+}
+
+void MainWindow::applyLogFilter()
+{
+    if(!emu)
+        return;
+    if(ui->actionLog_Selected_Rows_Only->isChecked())
+        emu->setLogFilter(logCategories(), logFrom, logTo);
+    else
+        emu->setLogFilter(logCategories());
+}
+
+void MainWindow::on_actionLog_Selected_Rows_Only_toggled(bool checked)
+{
+    if(checked)
+    {
+        // Taken once, so that selecting something else afterwards doesn't move it
+        QList<QTableWidgetSelectionRange> ranges = ui->memoryTable->selectedRanges();
+        if(ranges.isEmpty())
+        {
+            QMessageBox::information(this, tr("Nothing selected"), tr("Select the memory rows to log first, for example a whole subroutine"));
+            ui->actionLog_Selected_Rows_Only->setChecked(false);
+            return;
+        }
+        logFrom = ranges.first().topRow();
+        logTo = ranges.first().bottomRow();
+        for(const QTableWidgetSelectionRange& r : ranges)
+        {
+            logFrom = qMin(logFrom, (quint16)r.topRow());
+            logTo = qMax(logTo, (quint16)r.bottomRow());
+        }
+        ui->statusBar->showMessage(tr("Only logging instructions at %1 to %2").arg(logFrom).arg(logTo));
+    }
+    applyLogFilter();
+}
+
+void MainWindow::on_actionToggle_Breakpoint_triggered()
+{
+    int row = ui->memoryTable->currentRow();
+    if(row < 0)
+        return;
+    toggleDebugPoint(breakpoints, row);
+    if(emu)
+        emu->setBreakpoint(row, breakpoints.contains(row));
+}
+
+void MainWindow::on_actionToggle_Watchpoint_triggered()
+{
+    int row = ui->memoryTable->currentRow();
+    if(row < 0)
+        return;
+    toggleDebugPoint(watchpoints, row);
+    if(emu)
+        emu->setWatchpoint(row, watchpoints.contains(row));
+}
+
+void MainWindow::toggleDebugPoint(QSet<int>& set, int addr)
+{
+    if(set.contains(addr))
+        set.remove(addr);
+    else
+        set.insert(addr);
+
+    if(QTableWidgetItem* a = ui->memoryTable->item(addr, 1))
+        decorateAddress(a, addr);
+}
+
+void MainWindow::decorateAddress(QTableWidgetItem* a, int addr)
+{
+    QString label = symbols.labelAt(addr);
+    a->setText(label.isEmpty() ? QString::number(addr) : QString("%1 %2").arg(addr).arg(label));
+
+    // Breakpoints are red and watchpoints blue, both bold
+    bool bp = breakpoints.contains(addr);
+    bool wp = watchpoints.contains(addr);
+    QFont f = a->font();
+    f.setBold(bp || wp);
+    a->setFont(f);
+    if(bp)
+        a->setForeground(Qt::red);
+    else if(wp)
+        a->setForeground(Qt::blue);
+    else
+        a->setForeground(QBrush());
+
+    QStringList tips;
+    if(!label.isEmpty())
+        tips << label;
+    if(bp)
+        tips << tr("Breakpoint");
+    if(wp)
+        tips << tr("Watchpoint");
+    a->setToolTip(tips.join(", "));
+}
+
+void MainWindow::annotateLogValue(const QString& action, QString& val) const
+{
+    // Only loads of the address registers, "PC ← ..." and "AR ← ..."
+    if(symbols.isEmpty() || !(action.startsWith("PC ") || action.startsWith("AR ")))
+        return;
+    bool ok;
+    int addr = val.toInt(&ok);
+    QString label = (ok ? symbols.labelAt(addr) : QString());
+    if(!label.isEmpty())
+        val = QString("%1 (%2)").arg(val, label);
+}
+
+void MainWindow::on_actionRun_Until_Clock_triggered()
+{
+    bool ok;
+    int clock = QInputDialog::getInt(this, tr("Run Until Clock"), tr("Pause when the clock reaches:"), shownRegs[TrnEmu::CLOCK], 0, INT_MAX, 1, &ok);
+    if(!ok)
+        return;
+    fastForwardEmu(TrnEmu::ToClock, clock);
+}
+
+void MainWindow::on_actionStep_Into_triggered()
+{
+    fastForwardEmu(TrnEmu::NextInstruction, 0);
+}
+
+void MainWindow::on_actionStep_Over_triggered()
+{
+    fastForwardEmu(TrnEmu::OverCall, 0);
+}
+
+void MainWindow::on_actionStep_Out_triggered()
+{
+    fastForwardEmu(TrnEmu::OutOfCall, 0);
+}
+
+void MainWindow::fastForwardEmu(TrnEmu::FastForwardTarget target, quint32 value)
+{
+    if(!emu)
+    {
+        on_startStopBtn_clicked();
+        // Nothing to run
+        if(!emu)
+            return;
+    }
+    emu->fastForward(target, value);
+    ui->pauseBtn->setText(tr("Pause"));
+    ui->stepBtn->setEnabled(false);
+    ui->statusBar->showMessage(tr("Fast forwarding"));
+}
+
+void MainWindow::on_actionRecord_Trace_triggered(bool checked)
+{
+    if(!checked)
+    {
+        tracePath.clear();
+        if(emu)
+            emu->stopTrace();
         return;
     }
 
-    QString path = QFileDialog::getSaveFileName(this, tr("Save Log"), QString(), tr("Log File (*.csv)"));
+    tracePath = QFileDialog::getSaveFileName(this, tr("Record Trace"), QString(), tr("Execution Trace (*.trntrace)"));
+    if(tracePath.isEmpty())
+    {
+        ui->actionRecord_Trace->setChecked(false);
+        return;
+    }
+    if(emu)
+        startEmuTrace();
+}
+
+void MainWindow::startEmuTrace()
+{
+    TrnTraceWriter* w = new TrnTraceWriter(tracePath);
+    if(!w->open())
+    {
+        QMessageBox::critical(this, tr("Error opening file"), tr("Could not open %1 for writing").arg(tracePath));
+        delete w;
+        tracePath.clear();
+        ui->actionRecord_Trace->setChecked(false);
+        return;
+    }
+    // The emulator takes it over from here
+    emu->startTrace(w);
+}
+
+void MainWindow::on_actionOpen_Trace_triggered()
+{
+    if(emu)
+    {
+        QMessageBox::warning(this, tr("Please stop the emulator"), tr("Can not open a trace while the emulator is running.\nPlease stop it and try again."), QMessageBox::Ok);
+        return;
+    }
+
+    QString path = QFileDialog::getOpenFileName(this, tr("Open Trace"), QString(), tr("Execution Trace (*.trntrace)"));
     if(path.isEmpty())
         return;
 
-    // If the path doesn't end with .csv, add it
-    if(!path.endsWith(".csv", Qt::CaseInsensitive))
-        path.append(".csv");
+    TrnTraceReader* r = new TrnTraceReader();
+    if(!r->open(path))
+    {
+        QMessageBox::critical(this, tr("Error opening trace"), tr("Could not open %1\n%2").arg(path, r->errorString()));
+        delete r;
+        return;
+    }
+    closeTrace();
+    traceReader = r;
+
+    // The trace starts from its own memory image, which becomes the loaded program
+    pgmmem = traceReader->stateAfter(0).memory;
+    symbols.clear();
+    populateMemoryTable(pgmmem);
+    clearLog();
+    ui->startStopBtn->setEnabled(true);
+    resetGUI();
+    shownMem = pgmmem;
+
+    ui->traceSlider->blockSignals(true);
+    ui->traceSlider->setRange(0, cycleToSlider(traceReader->cycleCount()));
+    ui->traceSlider->setValue(0);
+    ui->traceSlider->blockSignals(false);
+    ui->traceScrubber->show();
+    showTraceCycle(0);
+}
+
+// Very long traces have more cycles than the slider can hold, so it only goes through some of them
+quint64 MainWindow::sliderToCycle(int value) const
+{
+    quint64 count = traceReader->cycleCount();
+    if(count <= INT_MAX)
+        return value;
+    return (quint64)((double)value / INT_MAX * count);
+}
+
+int MainWindow::cycleToSlider(quint64 cycle) const
+{
+    quint64 count = traceReader->cycleCount();
+    if(count <= INT_MAX)
+        return cycle;
+    return (int)((double)cycle / count * INT_MAX);
+}
 
-    QFile f(path);
-    if(!f.open(QIODevice::WriteOnly))
+void MainWindow::on_traceSlider_valueChanged(int value)
+{
+    if(traceReader)
+        showTraceCycle(sliderToCycle(value));
+}
+
+void MainWindow::showTraceCycle(quint64 cycle)
+{
+    // Goes through the same path as the sampled states of a running emulator. Any word may differ from what is shown
+    stateSampled(traceReader->stateAfter(cycle), QBitArray());
+    renderFrame();
+    ui->tracePosLabel->setText(tr("Cycle %1 of %2").arg(cycle).arg(traceReader->cycleCount()));
+}
+
+void MainWindow::on_traceGoToClockBtn_clicked()
+{
+    bool ok;
+    QString str = QInputDialog::getText(this, tr("Go To Clock"), tr("Clock (up to %1):").arg(traceReader->finalClock()), QLineEdit::Normal, QString(), &ok);
+    if(!ok)
+        return;
+    quint64 clock = str.trimmed().toULongLong(&ok);
+    if(!ok)
     {
-        QMessageBox::critical(this, tr("Error Saving Log"), tr("Could not open the file for writing"), QMessageBox::Ok);
+        QMessageBox::warning(this, tr("Invalid clock"), tr("%1 is not a valid clock value").arg(str));
         return;
     }
+    quint64 cycle = traceReader->cyclesAtClock(clock);
+    ui->traceSlider->blockSignals(true);
+    ui->traceSlider->setValue(cycleToSlider(cycle));
+    ui->traceSlider->blockSignals(false);
+    showTraceCycle(cycle);
+}
+
+void MainWindow::on_closeTraceBtn_clicked()
+{
+    closeTrace();
+}
 
-    // Write the header
-    f.write(QString("Clock,Action,Value\n").toUtf8());
-    for(int i = 0; i < rowcount; i++)
+void MainWindow::closeTrace()
+{
+    delete traceReader;
+    traceReader = nullptr;
+    ui->traceScrubber->hide();
+}
+
+void MainWindow::on_actionSave_Log_triggered()
+{
+    if(logExporter)
+    {
+        QMessageBox::warning(this, tr("Already saving"), tr("The log is still being saved. Please wait for it to finish."), QMessageBox::Ok);
+        return;
+    }
+    if(!logStore->size())
     {
-        QString str = QString("%1,%2,%3\n").arg(ui->logTable->item(i, 0)->text(),
-                                                ui->logTable->item(i, 1)->text(),
-                                                ui->logTable->item(i, 2)->text());
+        QMessageBox::warning(this, tr("Log is empty"), tr("The log is empty.\nPlease run the emulator first to generate messages."), QMessageBox::Ok);
+        return;
+    }
 
-        f.write(str.toUtf8());
+    QString csvFilter = tr("Log File (*.csv)");
+    QString binFilter = tr("Binary Log File (*.trnlog)");
+    QString filter;
+    QString path = QFileDialog::getSaveFileName(this, tr("Save Log"), QString(), csvFilter + ";;" + binFilter, &filter);
+    if(path.isEmpty())
+        return;
+
+    // If the path doesn't have the right extension, add it
+    TrnLogExporter::Format format = filter == binFilter || path.endsWith(".trnlog", Qt::CaseInsensitive) ? TrnLogExporter::Binary : TrnLogExporter::Csv;
+    QString ext = format == TrnLogExporter::Binary ? ".trnlog" : ".csv";
+    if(!path.endsWith(ext, Qt::CaseInsensitive))
+        path.append(ext);
+
+    // Everything logged up to now. The emulator can keep running meanwhile
+    logExporter = new TrnLogExporter(logStore, path, format, this);
+    if(!logExporter->open())
+    {
+        QMessageBox::critical(this, tr("Error Saving Log"), tr("Could not open the file for writing:\n%1").arg(logExporter->errorString()), QMessageBox::Ok);
+        delete logExporter;
+        logExporter = nullptr;
+        return;
     }
+
+    QProgressDialog* progress = new QProgressDialog(tr("Saving the log..."), tr("Cancel"), 0, logExporter->rowCount(), this);
+    progress->setAttribute(Qt::WA_DeleteOnClose);
+    // Don't flash it up for small logs
+    progress->setMinimumDuration(500);
+    connect(progress, &QProgressDialog::canceled, logExporter, &TrnLogExporter::cancel);
+    connect(logExporter, &TrnLogExporter::progress, progress, &QProgressDialog::setValue);
+    connect(logExporter, &TrnLogExporter::exportFinished, this, [this, progress](int rows, bool cancelled, QString error) {
+        progress->close();
+        logExporter->wait();
+        logExporter->deleteLater();
+        logExporter = nullptr;
+        if(!error.isEmpty())
+            QMessageBox::critical(this, tr("Error Saving Log"), tr("Could not write the log:\n%1").arg(error), QMessageBox::Ok);
+        else if(cancelled)
+            ui->statusBar->showMessage(tr("Saving the log was cancelled"));
+        else
+            ui->statusBar->showMessage(tr("Log saved: %1 rows").arg(rows));
+    });
+    logExporter->start(QThread::LowPriority);
 }
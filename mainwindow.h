@@ -5,8 +5,20 @@
 #include <QFileSystemWatcher>
 #include <QFile>
 #include <QDateTime>
+#include <QTimer>
+#include <QMap>
+#include <QSet>
+#include <QBitArray>
+#include <QLabel>
 #include "trnemu.h"
 #include "tablewidgetitemanimator.h"
+#include "trntracereader.h"
+#include "trnheatmap.h"
+#include "memoryheatdelegate.h"
+#include "trnlogindex.h"
+#include "trnlogstore.h"
+#include "trnlogexporter.h"
+#include "asmsymboltable.h"
 
 namespace Ui {
 class MainWindow;
@@ -38,8 +50,27 @@ private slots:
     void on_actionExample_Programs_triggered();
     void on_clockSlider_valueChanged(int value);
     void on_clockSpinBox_valueChanged(int value);
+    void on_actionRun_To_Here_triggered();
+    void on_actionRun_Until_Clock_triggered();
+    void on_actionStep_Into_triggered();
+    void on_actionStep_Over_triggered();
+    void on_actionStep_Out_triggered();
+    void on_actionToggle_Breakpoint_triggered();
+    void on_actionToggle_Watchpoint_triggered();
+    void on_actionLog_Selected_Rows_Only_toggled(bool checked);
+    void applyLogFilter();
+    void on_logSearchEdit_returnPressed();
+    void logSearchFinished(QString query, QVector<int> rows);
+    void on_actionRecord_Trace_triggered(bool checked);
+    void on_actionOpen_Trace_triggered();
+    void on_traceSlider_valueChanged(int value);
+    void on_traceGoToClockBtn_clicked();
+    void on_closeTraceBtn_clicked();
 
     void on_actionSave_Log_triggered();
+    // A null dirtyPages means that any page can have changed
+    void stateSampled(TrnState s, QBitArray dirtyPages);
+    void renderFrame();
 
 private:
     Ui::MainWindow *ui;
@@ -49,6 +80,8 @@ private:
     int loadNewFile(QString file);
     TrnEmu* emu;
     QVector<quint32> pgmmem;
+    // Labels of the loaded program, if it has any
+    AsmSymbolTable symbols;
     bool resumeEmuIfRunning();
     void closeEvent(QCloseEvent* e);
     TableWidgetItemAnimator* animator;
@@ -58,8 +91,60 @@ private:
     void askEmuThreadToStop();
     QFont monofont;
     void openWithDefaultApp(QString path);
-    unsigned long clockDelay;
-    void setEmuDelay(int value);
+    quint32 clockHz;
+    void setEmuClockRate(int hz);
+    void fastForwardEmu(TrnEmu::FastForwardTarget target, quint32 value);
+    // Every run is recorded here while set
+    QString tracePath;
+    void startEmuTrace();
+    // Set while scrubbing through a recorded trace
+    TrnTraceReader* traceReader;
+    quint64 sliderToCycle(int value) const;
+    int cycleToSlider(quint64 cycle) const;
+    void showTraceCycle(quint64 cycle);
+    void closeTrace();
+    // What the Log menu is set to
+    quint32 logCategories() const;
+    quint16 logFrom;
+    quint16 logTo;
+    // Every row of the log goes into these as well
+    // A new store is made whenever the log is cleared, an export that is still running keeps the old one
+    QSharedPointer<TrnLogStore> logStore;
+    TrnLogExporter* logExporter;
+    TrnLogIndex logIndex;
+    QString logQuery;
+    QVector<int> logMatches;
+    int logMatch;
+    void clearLog();
+    void showLogMatch();
+    void populateMemoryTable(const QVector<quint32>& mem);
+    // Memory accesses of the current run, shown in the last column of the memory table
+    TrnHeatMap heat;
+    MemoryHeatDelegate* heatDelegate;
+    void updateHeatColumn();
+    // By address. Kept across runs, and handed to every new emulator
+    QSet<int> breakpoints;
+    QSet<int> watchpoints;
+    void toggleDebugPoint(QSet<int>& set, int addr);
+    void decorateAddress(QTableWidgetItem* a, int addr);
+    // Adds the label to log values that are addresses
+    void annotateLogValue(const QString& action, QString& val) const;
+    QLabel* clockRateLabel;
+    // Updates are only collected as they arrive, and shown once per frame by renderFrame()
+    QTimer frameTimer;
+    typedef struct {
+        quint32 val;
+        TrnEmu::OperationType op;
+        bool dirty;
+    } PendingRegister;
+    PendingRegister pendingRegs[TrnEmu::REG_MAX];
+    QMap<int, QPair<quint32, TrnEmu::OperationType>> pendingMem;
+    // What the GUI currently shows, so that sampled states can be diffed against it
+    quint32 shownRegs[TrnEmu::REG_MAX];
+    QVector<quint32> shownMem;
+    void queueRegister(TrnEmu::Register r, TrnEmu::OperationType t, quint32 val);
+    void showRegister(TrnEmu::Register r, TrnEmu::OperationType t, quint32 val);
+    void showMemory(int addr, quint32 data, TrnEmu::OperationType t);
 };
 
 #endif // MAINWINDOW_H
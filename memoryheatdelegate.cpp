@@ -0,0 +1,51 @@
+#include "memoryheatdelegate.h"
+#include <QPainter>
+#include <QHelpEvent>
+#include <QToolTip>
+#include <QtMath>
+
+MemoryHeatDelegate::MemoryHeatDelegate(const TrnHeatMap* heat, QObject* parent) : QStyledItemDelegate(parent),
+    _heat(heat), _max(0), readColour(0x50, 0xFF, 0x50), writeColour(0xFF, 0x50, 0x50)
+{
+}
+
+void MemoryHeatDelegate::updateScale()
+{
+    _max = _heat->maxCount();
+}
+
+// Counts span many orders of magnitude, so they are scaled logarithmically
+int MemoryHeatDelegate::intensity(quint32 count) const
+{
+    if(!count || !_max)
+        return 0;
+    // Anything that was accessed at all stays visible
+    return 40 + qRound(215 * qLn(count) / qLn(qMax(_max, 2u)));
+}
+
+void MemoryHeatDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option, const QModelIndex& index) const
+{
+    QStyledItemDelegate::paint(painter, option, index);
+    int addr = index.row();
+    if(addr >= _heat->size())
+        return;
+
+    // Reads on the left half, writes on the right
+    QRect r = option.rect;
+    QRect left(r.left(), r.top(), r.width() / 2, r.height());
+    QRect right(left.right() + 1, r.top(), r.width() - left.width(), r.height());
+    QColor c = readColour;
+    c.setAlpha(intensity(_heat->reads(addr)));
+    painter->fillRect(left, c);
+    c = writeColour;
+    c.setAlpha(intensity(_heat->writes(addr)));
+    painter->fillRect(right, c);
+}
+
+bool MemoryHeatDelegate::helpEvent(QHelpEvent* event, QAbstractItemView* view, const QStyleOptionViewItem& option, const QModelIndex& index)
+{
+    if(event->type() != QEvent::ToolTip || index.row() >= _heat->size())
+        return QStyledItemDelegate::helpEvent(event, view, option, index);
+    QToolTip::showText(event->globalPos(), tr("%1 reads, %2 writes").arg(_heat->reads(index.row())).arg(_heat->writes(index.row())), view);
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef MEMORYHEATDELEGATE_H
+#define MEMORYHEATDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include "trnheatmap.h"
+
+// Paints the heat column of the memory table straight from the emulator's access counters
+// The column has no items of its own, the view just needs to be repainted once the counters change
+class MemoryHeatDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+public:
+    explicit MemoryHeatDelegate(const TrnHeatMap* heat, QObject* parent = nullptr);
+    void paint(QPainter* painter, const QStyleOptionViewItem& option, const QModelIndex& index) const;
+    bool helpEvent(QHelpEvent* event, QAbstractItemView* view, const QStyleOptionViewItem& option, const QModelIndex& index);
+    // Colours are relative to the hottest address, which is looked up again here
+    void updateScale();
+
+private:
+    const TrnHeatMap* _heat;
+    quint32 _max;
+    const QColor readColour, writeColour;
+    int intensity(quint32 count) const;
+};
+
+#endif // MEMORYHEATDELEGATE_H
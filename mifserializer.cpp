@@ -1,14 +1,38 @@
 #include "mifserializer.h"
 
-int MifSerializer::MifToVector(QFile& f, QVector<quint32>& vec, QString& errstr)
+// "-- LABEL <address> <name>", with the address in binary like everywhere else in the file
+static const QString commentstr("--");
+static const QString labelstr("-- LABEL\t");
+
+int MifSerializer::MifToVector(QFile& f, QVector<quint32>& vec, QString& errstr, AsmSymbolTable* symbols)
 {
+    if(symbols)
+        symbols->clear();
     QByteArray ba = f.readLine();
     int lnum = 0;
     while(ba.length())
     {
         lnum++;
-        // Split the line in the tab character
         QString line(ba);
+        if(line.startsWith(commentstr))
+        {
+            if(symbols && line.startsWith(labelstr))
+            {
+                QVector<QStringRef> split = line.midRef(labelstr.length()).trimmed().split(QChar('\t'));
+                bool ok = (split.length() == 2 && !split.at(1).isEmpty());
+                quint16 addr = (ok ? split.at(0).toUShort(&ok, 2) : 0);
+                if(!ok)
+                {
+                    errstr = QObject::tr("Could not parse label");
+                    return lnum;
+                }
+                symbols->insert(addr, split.at(1).toString());
+            }
+            ba = f.readLine();
+            continue;
+        }
+
+        // Split the line in the tab character
         QVector<QStringRef> split = line.splitRef(QChar('\t'));
 
         if(split.length() != 2)
@@ -45,8 +69,18 @@ int MifSerializer::MifToVector(QFile& f, QVector<quint32>& vec, QString& errstr)
 }
 
 // This file must be opened in binary mode
-int MifSerializer::VectorToMif(QFile& f, QVector<quint32>& vec)
+int MifSerializer::VectorToMif(QFile& f, QVector<quint32>& vec, const AsmSymbolTable* symbols)
 {
+    if(symbols)
+    {
+        for(int n = 0; n < symbols->size(); n++)
+        {
+            const AsmSymbolTable::Symbol& s = symbols->symbols().at(n);
+            QString str = QString("%1%2\t%3\n").arg(labelstr).arg(s.addr, 13, 2, QChar('0')).arg(s.name);
+            if(!f.write(str.toUtf8()))
+                return -(n + 1);
+        }
+    }
     for(int i = 0; i < vec.length(); i++)
     {
         QString str = QString("%1\t%2\n").arg(i, 13, 2, QChar('0')).arg(vec.at(i), 20, 2, QChar('0'));
@@ -4,12 +4,15 @@
 #include <QVector>
 #include <QFile>
 #include <QObject>
+#include "asmsymboltable.h"
 
 class MifSerializer
 {
 public:
-    static int MifToVector(QFile& f, QVector<quint32>& vec, QString& errstr);
-    static int VectorToMif(QFile& f, QVector<quint32>& vec);
+    // Symbols are stored in comment lines, which other tools skip. If symbols is given, it is filled with them
+    static int MifToVector(QFile& f, QVector<quint32>& vec, QString& errstr, AsmSymbolTable* symbols = nullptr);
+    // Returns 0 on success. A write error returns the memory address + 1, or -(n + 1) if it was the line of the nth symbol
+    static int VectorToMif(QFile& f, QVector<quint32>& vec, const AsmSymbolTable* symbols = nullptr);
 };
 
 #endif // MIFSERIALIZER_H
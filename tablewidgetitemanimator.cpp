@@ -65,7 +65,15 @@ void TableWidgetItemAnimator::startLabelAnimation(AnimatedLabel* l, const TrnEmu
     if(!labelbg)
         labelbg = new QColor(l->palette().window().color());
 
-    QPropertyAnimation* anim = new QPropertyAnimation(l, "bgColour");
+    // Reuse the same animation for each label, restarting it if it's still running
+    QPropertyAnimation* anim = labelAnims.value(l);
+    if(!anim)
+    {
+        anim = new QPropertyAnimation(l, "bgColour", this);
+        anim->setEasingCurve(QEasingCurve::InOutCubic);
+        labelAnims.insert(l, anim);
+    }
+    anim->stop();
     anim->setDuration(sleepDuration);
     switch(op)
     {
@@ -78,9 +86,8 @@ void TableWidgetItemAnimator::startLabelAnimation(AnimatedLabel* l, const TrnEmu
         case TrnEmu::InPlace:
             anim->setStartValue(orange);
     }
-    anim->setEasingCurve(QEasingCurve::InOutCubic);
     anim->setEndValue(*labelbg);
-    anim->start(QAbstractAnimation::DeleteWhenStopped);
+    anim->start();
 }
 
 void TableWidgetItemAnimator::setReadColour(const QColor& c)
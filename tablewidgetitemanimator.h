@@ -5,6 +5,7 @@
 #include <QPropertyAnimation>
 #include <QTableWidgetItem>
 #include <QLabel>
+#include <QHash>
 #include "trnemu.h"
 #include "animatedlabel.h"
 
@@ -44,6 +45,8 @@ private:
     QPropertyAnimation* readAnim;
     QPropertyAnimation* writeAnim;
     QColor* labelbg;
+    // Owned by this object
+    QHash<AnimatedLabel*, QPropertyAnimation*> labelAnims;
     unsigned long sleepDuration;
 };
 
@@ -0,0 +1,393 @@
+#include "trnconformance.h"
+#include "trnemu.h"
+#include "trnfastemu.h"
+#include "trnlaneemu.h"
+#include "trnopcodes.h"
+#include <QStringList>
+
+// The reference. TrnEmu is driven synchronously, one cycle at a time, without ever starting its thread
+class TrnReferenceEngine : public TrnConformanceEngine
+{
+public:
+    TrnReferenceEngine() : _emu(nullptr), _retired(0) {}
+    ~TrnReferenceEngine() { delete _emu; }
+    QString name() const { return QString("TrnEmu"); }
+    void load(const QVector<quint32>& pgm, const QVector<quint32>& inputs)
+    {
+        delete _emu;
+        _emu = new TrnEmu(0, pgm, TrnEmu::LogExecutionPhaseOnly, TrnMemory::Fault, nullptr);
+        _emu->setInputQueue(inputs);
+        _retired = 0;
+    }
+    bool step()
+    {
+        bool ok;
+        do
+            ok = _emu->runCycle();
+        while(ok && _emu->getRegisterState().F != 0b00);
+
+        // A halt also counts as a completed instruction
+        if(ok || _emu->getRegisterState().H)
+            _retired++;
+        return ok;
+    }
+    quint64 instructionsRetired() const { return _retired; }
+    TrnState state() const { return _emu->getState(); }
+    // Runs the cycles of the next instruction that come before its execute phase, which is the only one that can block
+    bool stepToExecute()
+    {
+        bool ok = true;
+        while(ok && _emu->getRegisterState().F != 0b11)
+            ok = _emu->runCycle();
+        return ok;
+    }
+private:
+    TrnEmu* _emu;
+    quint64 _retired;
+};
+
+// With loop acceleration, it goes through the program in chunks, so that skipped loops are compared as well
+class TrnFastEngine : public TrnConformanceEngine
+{
+public:
+    explicit TrnFastEngine(bool accelerate) : _emu(nullptr), _accelerate(accelerate) {}
+    ~TrnFastEngine() { delete _emu; }
+    QString name() const { return QString(_accelerate ? "TrnFastEmu (accelerated)" : "TrnFastEmu"); }
+    void load(const QVector<quint32>& pgm, const QVector<quint32>& inputs)
+    {
+        delete _emu;
+        _emu = new TrnFastEmu(pgm);
+        _emu->setInputQueue(inputs);
+        _emu->setLoopAcceleration(_accelerate);
+    }
+    bool step() { return (_accelerate ? _emu->run(64) : _emu->step()) == TrnFastEmu::Running; }
+    quint64 instructionsRetired() const { return _emu->instructionsRetired(); }
+    TrnState state() const { return _emu->state(); }
+    bool waitingForInput() const { return _emu->status() == TrnFastEmu::WaitingForInput; }
+private:
+    TrnFastEmu* _emu;
+    bool _accelerate;
+};
+
+// The test case runs in the last lane, and every other lane gets inputs of its own, which send it down other paths
+// Whenever the lanes split up and meet again, the one being compared has to come out unaffected
+class TrnLaneEngine : public TrnConformanceEngine
+{
+public:
+    TrnLaneEngine() : _emu(nullptr) {}
+    ~TrnLaneEngine() { delete _emu; }
+    QString name() const { return QString("TrnLaneEmu"); }
+    void load(const QVector<quint32>& pgm, const QVector<quint32>& inputs)
+    {
+        delete _emu;
+        _emu = new TrnLaneEmu(pgm);
+        for(int l = 0; l < TrnLaneEmu::Lanes - 1; l++)
+        {
+            // Off by a little, and every other lane with the sign flipped as well
+            QVector<quint32> other;
+            for(quint32 v : inputs)
+                other.append(((l % 2 ? ~v : v) + l) & 0b11111111111111111111);
+            // And some run out of inputs early
+            _emu->setInputQueue(l, other.mid(0, other.size() - l % 3));
+        }
+        _emu->setInputQueue(Watched, inputs);
+    }
+    bool step()
+    {
+        const quint64 retired = _emu->instructionsRetired(Watched);
+        while(_emu->status(Watched) == TrnFastEmu::Running && _emu->instructionsRetired(Watched) == retired)
+            _emu->step();
+        return _emu->status(Watched) == TrnFastEmu::Running;
+    }
+    quint64 instructionsRetired() const { return _emu->instructionsRetired(Watched); }
+    TrnState state() const { return _emu->state(Watched); }
+    bool waitingForInput() const { return _emu->status(Watched) == TrnFastEmu::WaitingForInput; }
+private:
+    enum { Watched = TrnLaneEmu::Lanes - 1 };
+    TrnLaneEmu* _emu;
+};
+
+TrnConformance::TrnConformance(quint32 seed, quint64 maxInstructions) :
+    _rng(seed), _maxInstructions(maxInstructions), _reference(new TrnReferenceEngine()), _engines()
+{
+    // Every alternative engine should be registered here
+    _engines.append(new TrnFastEngine(false));
+    _engines.append(new TrnFastEngine(true));
+    _engines.append(new TrnLaneEngine());
+}
+
+TrnConformance::~TrnConformance()
+{
+    delete _reference;
+    foreach(TrnConformanceEngine* e, _engines)
+        delete e;
+}
+
+quint32 TrnConformance::randomInstruction(int pgmlen)
+{
+    quint32 opcode = _rng() % 32;
+    quint32 word = opcode << 15;
+
+    // Sprinkle some indexed and indirect references
+    if(_rng() % 8 == 0)
+        word |= 0b10000000000000;
+    if(_rng() % 8 == 0)
+        word |= 0b100000000000000;
+
+    switch(opcode)
+    {
+        case TrnOpcodes::INA:
+            // Include the two unused variants
+            word |= _rng() % 8;
+            break;
+        case TrnOpcodes::SHAL:
+            word |= _rng() % 4;
+            break;
+        case TrnOpcodes::SAXL:
+        case TrnOpcodes::INP:
+            word |= _rng() % 2;
+            break;
+        default:
+            // Mostly valid addresses, with a few just out of bounds
+            if(_rng() % 16)
+                word |= _rng() % pgmlen;
+            else
+                word |= pgmlen + _rng() % 4;
+            break;
+    }
+    return word;
+}
+
+TrnConformance::TestCase TrnConformance::generate()
+{
+    TestCase t;
+    int len = 8 + _rng() % 41;
+    for(int i = 0; i < len; i++)
+    {
+        // A quarter of the memory is plain data
+        if(_rng() % 4 == 0)
+            t.program.append(_rng() & 0b11111111111111111111);
+        else
+            t.program.append(randomInstruction(len));
+    }
+    // Give it a chance to stop gracefully instead of running off the end
+    t.program.append((quint32)TrnOpcodes::HLT << 15);
+
+    int inputs = _rng() % 9;
+    for(int i = 0; i < inputs; i++)
+        t.inputs.append(_rng() & 0b11111111111111111111);
+    return t;
+}
+
+#define DIFF_REG(r) if(ref.r != alt.r) \
+                        diffs.append(QString("%1: %2 %3, %4 %5").arg(#r, refname, QString::number(ref.r), altname, QString::number(alt.r)))
+
+static QStringList diffStates(const TrnState& ref, const TrnState& alt, const QString& refname, const QString& altname)
+{
+    QStringList diffs;
+    DIFF_REG(BR);
+    DIFF_REG(A);
+    DIFF_REG(X);
+    DIFF_REG(IR);
+    DIFF_REG(CLOCK);
+    DIFF_REG(SP);
+    DIFF_REG(I);
+    DIFF_REG(PC);
+    DIFF_REG(AR);
+    DIFF_REG(SC);
+    DIFF_REG(F);
+    DIFF_REG(V);
+    DIFF_REG(Z);
+    DIFF_REG(S);
+    DIFF_REG(H);
+    if(ref.overflow != alt.overflow)
+        diffs.append(QString("overflow: %1 %2, %3 %4").arg(refname, QString::number(ref.overflow), altname, QString::number(alt.overflow)));
+
+    if(ref.memory.size() != alt.memory.size())
+        diffs.append(QString("Memory size: %1 %2, %3 %4").arg(refname, QString::number(ref.memory.size()), altname, QString::number(alt.memory.size())));
+
+    int len = qMin(ref.memory.size(), alt.memory.size());
+    for(int i = 0; i < len; i++)
+        if(ref.memory.at(i) != alt.memory.at(i))
+            diffs.append(QString("[%1]: %2 %3, %4 %5").arg(QString::number(i), refname, QString::number(ref.memory.at(i)), altname, QString::number(alt.memory.at(i))));
+    return diffs;
+}
+
+QString TrnConformance::compare(const TestCase& t, TrnConformanceEngine* alt)
+{
+    _reference->load(t.program, t.inputs);
+    alt->load(t.program, t.inputs);
+
+    while(alt->instructionsRetired() < _maxInstructions)
+    {
+        bool altok = alt->step();
+
+        // The alternative engine might have retired more than one instruction at once, so catch up
+        bool refok = true;
+        while(refok && _reference->instructionsRetired() < alt->instructionsRetired())
+            refok = _reference->step();
+
+        // Out of inputs, it stopped right before the execute phase of an INP, which the reference would block in
+        bool waiting = alt->waitingForInput();
+        if(refok && waiting && _reference->instructionsRetired() == alt->instructionsRetired())
+            refok = _reference->stepToExecute();
+        // If it stopped in the middle of an instruction, the reference has to as well
+        else if(refok && !altok && _reference->instructionsRetired() == alt->instructionsRetired())
+            refok = _reference->step();
+
+        TrnState refstate = _reference->state();
+        TrnState altstate = alt->state();
+        QString where = QString("After instruction %1 (PC %2): ").arg(QString::number(_reference->instructionsRetired()), QString::number(refstate.PC));
+
+        if(_reference->instructionsRetired() != alt->instructionsRetired())
+            return where + QString("%1 retired %2 instructions").arg(alt->name(), QString::number(alt->instructionsRetired()));
+
+        QStringList diffs = diffStates(refstate, altstate, _reference->name(), alt->name());
+        if(!diffs.isEmpty())
+            return where + diffs.join("; ");
+
+        // Comparison stops there, as the reference can't go on either
+        if(waiting)
+            break;
+
+        if(refok != altok)
+            return where + QString("%1 %2, %3 %4").arg(_reference->name(), refok ? "continued" : "stopped", alt->name(), altok ? "continued" : "stopped");
+
+        if(!altok)
+            break;
+    }
+    return QString();
+}
+
+TrnConformance::TestCase TrnConformance::shrink(const TestCase& t, TrnConformanceEngine* alt)
+{
+    TestCase best = t;
+    bool progress = true;
+    while(progress)
+    {
+        progress = false;
+
+        // Chop words off the end of the program
+        while(best.program.size() > 1)
+        {
+            TestCase cand = best;
+            cand.program.removeLast();
+            if(compare(cand, alt).isEmpty())
+                break;
+            best = cand;
+            progress = true;
+        }
+
+        // Remove whole words
+        for(int i = 0; i < best.program.size() && best.program.size() > 1; i++)
+        {
+            TestCase cand = best;
+            cand.program.remove(i);
+            if(compare(cand, alt).isEmpty())
+                continue;
+            best = cand;
+            progress = true;
+            i--;
+        }
+
+        // Simplify each word. First to a NOP, then without references, and finally without an argument
+        for(int i = 0; i < best.program.size(); i++)
+        {
+            quint32 word = best.program.at(i);
+            const quint32 candidates[] = { 0, word & ~0b110000000000000u, word & ~0b1111111111111u };
+            for(quint32 c : candidates)
+            {
+                if(c == best.program.at(i))
+                    continue;
+                TestCase cand = best;
+                cand.program[i] = c;
+                if(compare(cand, alt).isEmpty())
+                    continue;
+                best = cand;
+                progress = true;
+                break;
+            }
+        }
+
+        // And finally, get rid of inputs
+        while(!best.inputs.isEmpty())
+        {
+            TestCase cand = best;
+            cand.inputs.removeLast();
+            if(compare(cand, alt).isEmpty())
+                break;
+            best = cand;
+            progress = true;
+        }
+    }
+    return best;
+}
+
+QString TrnConformance::disassemble(quint32 word)
+{
+    static const char* const mnemonics[32] = {
+        "NOP", "LDA", "LDX", "LDI", "STA", "STX", "STI", "ENA",
+        "PSH", "POP", "INA", "ENI", "LSP", "ADA", "SUB", "AND",
+        "ORA", "XOR", "CMA", "JMP", "JPN", "JAG", "JPZ", "JPO",
+        "JSR", "JIG", "SHAL", "SSP", "SAXL", "INP", "RET", "HLT",
+    };
+    static const char* const inplace[8] = { "INA", "INX", "INI", "DCA", "DCX", "DCI", "IN?", "IN?" };
+    static const char* const shifts[4] = { "SHAL", "SHAR", "SHXL", "SHXR" };
+
+    quint32 opcode = (word >> 15) & 0b11111;
+    QString arg = QString::number(word & 0b1111111111111);
+    QString mn;
+    switch(opcode)
+    {
+        case TrnOpcodes::INA:
+            return inplace[word & 0b111];
+        case TrnOpcodes::SHAL:
+            return shifts[word & 0b11];
+        case TrnOpcodes::SAXL:
+            return (word & 0b1) ? "SAXR" : "SAXL";
+        case TrnOpcodes::INP:
+            return (word & 0b1) ? "OUT" : "INP";
+        case TrnOpcodes::NOP:
+        case TrnOpcodes::CMA:
+        case TrnOpcodes::PSH:
+        case TrnOpcodes::POP:
+        case TrnOpcodes::RET:
+        case TrnOpcodes::HLT:
+            return mnemonics[opcode];
+        default:
+            mn = mnemonics[opcode];
+    }
+
+    if(word & 0b10000000000000)
+        mn.append(",I");
+    if(word & 0b100000000000000)
+        arg = QString("(%1)").arg(arg);
+    return QString("%1 %2").arg(mn, arg);
+}
+
+int TrnConformance::run(int count, QTextStream& out)
+{
+    int failures = 0;
+    for(int i = 0; i < count; i++)
+    {
+        TestCase t = generate();
+        foreach(TrnConformanceEngine* e, _engines)
+        {
+            if(compare(t, e).isEmpty())
+                continue;
+
+            failures++;
+            TestCase min = shrink(t, e);
+            out << QString("Program %1 diverges on %2\n").arg(QString::number(i), e->name());
+            out << compare(min, e) << "\n";
+            for(int addr = 0; addr < min.program.size(); addr++)
+                out << QString("\t%1\t%2\t%3\n").arg(QString::number(addr)).arg(min.program.at(addr), 20, 2, QChar('0')).arg(disassemble(min.program.at(addr)));
+            QStringList inputs;
+            foreach(quint32 in, min.inputs)
+                inputs.append(QString::number(in));
+            out << QString("\tInputs: %1\n").arg(inputs.join(", "));
+        }
+    }
+    out << QString("%1 programs, %2 divergences\n").arg(QString::number(count), QString::number(failures));
+    return failures;
+}
@@ -0,0 +1,56 @@
+#ifndef TRNCONFORMANCE_H
+#define TRNCONFORMANCE_H
+#include <QVector>
+#include <QString>
+#include <QTextStream>
+#include <random>
+#include "trnstate.h"
+
+// Wraps an execution engine so that it can be driven by the conformance harness
+class TrnConformanceEngine
+{
+public:
+    virtual ~TrnConformanceEngine() {}
+    virtual QString name() const = 0;
+    virtual void load(const QVector<quint32>& pgm, const QVector<quint32>& inputs) = 0;
+    // Executes at least one whole instruction
+    // Returns false once the engine can not continue (halt or error)
+    virtual bool step() = 0;
+    virtual quint64 instructionsRetired() const = 0;
+    virtual TrnState state() const = 0;
+    // If this returns true, the test case ran out of inputs in front of an INP and comparison stops there
+    virtual bool waitingForInput() const { return false; }
+};
+
+class TrnReferenceEngine;
+
+// Runs randomly generated programs on TrnEmu and on every other engine in lockstep,
+// comparing the full architectural state after every instruction
+class TrnConformance
+{
+public:
+    TrnConformance(quint32 seed, quint64 maxInstructions);
+    ~TrnConformance();
+    typedef struct {
+        QVector<quint32> program;
+        QVector<quint32> inputs;
+    } TestCase;
+
+    // Returns the number of failing test cases
+    int run(int count, QTextStream& out);
+    TestCase generate();
+    // Returns an empty string if the engine agrees with the reference
+    QString compare(const TestCase& t, TrnConformanceEngine* alt);
+    // Reduces a failing test case to a (locally) minimal one that still fails
+    TestCase shrink(const TestCase& t, TrnConformanceEngine* alt);
+    static QString disassemble(quint32 word);
+
+private:
+    std::mt19937 _rng;
+    quint64 _maxInstructions;
+    TrnReferenceEngine* _reference;
+    QVector<TrnConformanceEngine*> _engines;
+    quint32 randomInstruction(int pgmlen);
+};
+
+#endif // TRNCONFORMANCE_H
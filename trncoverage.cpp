@@ -0,0 +1,54 @@
+#include "trncoverage.h"
+#include <QMap>
+
+void TrnCoverage::merge(const TrnCoverage& o)
+{
+    for(int i = 0; i < Words; i++)
+    {
+        _executed[i] |= o._executed[i];
+        _taken[i] |= o._taken[i];
+        _notTaken[i] |= o._notTaken[i];
+    }
+}
+
+void TrnCoverage::writeLcov(QTextStream& out, const AsmDebugInfo& info, const QString& testName) const
+{
+    // lcov wants every line once and in order, even if an ORG placed code over some other code
+    QMap<quint32, bool> lines;
+    QMap<quint32, AsmDebugInfo::Entry> branches;
+    for(const AsmDebugInfo::Entry& e : info.entries)
+    {
+        lines[e.line] = lines.value(e.line) || executed(e.addr);
+        if(e.kind == AsmDebugInfo::Branch)
+            branches[e.line] = e;
+    }
+
+    out << "TN:" << testName << "\n";
+    out << "SF:" << info.sourcePath << "\n";
+
+    int branchesHit = 0;
+    for(auto i = branches.constBegin(); i != branches.constEnd(); ++i)
+    {
+        quint16 addr = i.value().addr;
+        // Branches of a line that never ran are reported as "-" instead of 0
+        bool ran = executed(addr);
+        const bool outcomes[2] = { notTaken(addr), taken(addr) };
+        for(int b = 0; b < 2; b++)
+        {
+            out << "BRDA:" << i.key() << ",0," << b << "," << (ran ? QString::number(outcomes[b]) : QString("-")) << "\n";
+            branchesHit += outcomes[b];
+        }
+    }
+    out << "BRF:" << branches.size() * 2 << "\n";
+    out << "BRH:" << branchesHit << "\n";
+
+    int linesHit = 0;
+    for(auto i = lines.constBegin(); i != lines.constEnd(); ++i)
+    {
+        out << "DA:" << i.key() << "," << (int)i.value() << "\n";
+        linesHit += i.value();
+    }
+    out << "LF:" << lines.size() << "\n";
+    out << "LH:" << linesHit << "\n";
+    out << "end_of_record\n";
+}
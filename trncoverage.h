@@ -0,0 +1,53 @@
+#ifndef TRNCOVERAGE_H
+#define TRNCOVERAGE_H
+#include <QtGlobal>
+#include <QTextStream>
+#include <cstring>
+#include "asmdebuginfo.h"
+
+// Which instructions were executed and which way conditional jumps went, as bitmaps over the whole address space
+// Setting a bit is cheap enough to leave it on for batch runs
+class TrnCoverage
+{
+public:
+    enum {
+        // 13 bit addresses
+        AddressSpace = 8192,
+        Words = AddressSpace / 64,
+    };
+
+    TrnCoverage() { clear(); }
+    inline void clear()
+    {
+        memset(_executed, 0, sizeof(_executed));
+        memset(_taken, 0, sizeof(_taken));
+        memset(_notTaken, 0, sizeof(_notTaken));
+    }
+
+    inline void markExecuted(quint16 addr) { set(_executed, addr); }
+    inline void markBranch(quint16 addr, bool taken) { set(taken ? _taken : _notTaken, addr); }
+    inline bool executed(quint16 addr) const { return test(_executed, addr); }
+    inline bool taken(quint16 addr) const { return test(_taken, addr); }
+    inline bool notTaken(quint16 addr) const { return test(_notTaken, addr); }
+
+    // Adds up the coverage of several runs
+    void merge(const TrnCoverage& o);
+    // Writes a single lcov tracefile record for the source in the debug info
+    void writeLcov(QTextStream& out, const AsmDebugInfo& info, const QString& testName) const;
+
+private:
+    quint64 _executed[Words];
+    quint64 _taken[Words];
+    quint64 _notTaken[Words];
+    static inline void set(quint64* map, quint16 addr)
+    {
+        if(addr < AddressSpace)
+            map[addr >> 6] |= (quint64)1 << (addr & 0b111111);
+    }
+    static inline bool test(const quint64* map, quint16 addr)
+    {
+        return addr < AddressSpace && (map[addr >> 6] >> (addr & 0b111111)) & 1;
+    }
+};
+
+#endif // TRNCOVERAGE_H
@@ -1,8 +1,10 @@
 #include "trnemu.h"
 #include <QDebug>
-#include <QMutex>
-#include <QMutexLocker>
+#include <thread>
 #include "trnopcodes.h"
+#include "trntracewriter.h"
+#include "trnheatmap.h"
+#include "trnloopdetector.h"
 
 // Note: The original TRN checks for overflow only under the following conditions
 // A = A + BR (ADA/SUB)
@@ -34,21 +36,34 @@ static const QString clockpulse = QObject::tr("Clock pulse");
 static const QString regldderef("%1 ← [%2]");
 static const QString regstderef("[%1] ← %2");
 
-#define EMIT_LOG(arg, val)  if(_logAllPhases || _printToLog) \
-                                emit executionLog(regCLOCK, arg, val)
+// These are only used in functions templated on a CyclePolicy
+// Whatever the policy leaves out is compiled out, runtime check included
+// A line belongs to the phase it happens in, and possibly to a more specific category as well
+// It's only logged if all of them pass the filter, which is checked before anything is formatted
+#define EMIT_LOG_AS(category, arg, val) if((Policy & LogPolicy) && ((_logContext | (category)) & ~_logMask) == 0 && !_fastForwarding) \
+                                            emit executionLog(regCLOCK, arg, val)
+
+#define EMIT_LOG(arg, val)  EMIT_LOG_AS(0, arg, val)
+
+// While sampling, the GUI is sent the whole state once per frame instead of every single update
+#define EMIT_REG_UPDATE(r, t, v)    if((Policy & EventPolicy) && !_sampled) \
+                                        emit registerUpdated(r, t, v)
+
+#define EMIT_MEM_UPDATE(a, d, t)    if((Policy & EventPolicy) && !_sampled) \
+                                        emit memoryUpdated(a, d, t)
 
 #define REG_LOAD(dst, src)  reg##dst = reg##src; \
                             EMIT_LOG(regassign.arg(regToString[Register::dst], regToString[Register::src]), QString::number(reg##src)); \
-                            emit registerUpdated(Register::src, OperationType::Read, reg##src); \
-                            emit registerUpdated(Register::dst, OperationType::Write, reg##dst)
+                            EMIT_REG_UPDATE(Register::src, OperationType::Read, reg##src); \
+                            EMIT_REG_UPDATE(Register::dst, OperationType::Write, reg##dst)
 
 #define REG_LOAD_MASK(dst, src, mask)   reg##dst = reg##src & mask; \
                                         EMIT_LOG(regassignmask.arg(regToString[Register::dst], regToString[Register::src], \
                                             QString("0b%1").arg(mask, 13, 2, QChar('0'))), \
                                             QString::number(reg##dst)\
                                         ); \
-                                        emit registerUpdated(Register::src, OperationType::Read, reg##src); \
-                                        emit registerUpdated(Register::dst, OperationType::Write, reg##dst)
+                                        EMIT_REG_UPDATE(Register::src, OperationType::Read, reg##src); \
+                                        EMIT_REG_UPDATE(Register::dst, OperationType::Write, reg##dst)
 
 #define REG_LOAD_OR_MASK(dst, src, mask)    reg##dst &= ~mask; \
                                             reg##dst |= reg##src & mask; \
@@ -56,686 +71,1165 @@ static const QString regstderef("[%1] ← %2");
                                               QString("0b%1").arg(mask, 13, 2, QChar('0'))), \
                                               QString::number(reg##dst)\
                                             ); \
-                                            emit registerUpdated(Register::src, OperationType::Read, reg##src); \
-                                            emit registerUpdated(Register::dst, OperationType::Write, reg##dst)
+                                            EMIT_REG_UPDATE(Register::src, OperationType::Read, reg##src); \
+                                            EMIT_REG_UPDATE(Register::dst, OperationType::Write, reg##dst)
+
+// There is at most one memory access per F cycle, so remembering the last one is enough for the trace
+#define TRACE_MEM(f, a, d)  if(Policy & HookPolicy) \
+                            { \
+                                _memFlags = f; \
+                                _memAddr = a; \
+                                _memData = d; \
+                            }
 
-#define REG_LOAD_DEREF(dst, src)    if((unsigned int)_memory.length() <= reg##src) \
+#define REG_LOAD_DEREF(dst, src)    if(!_memory.contains(reg##src)) \
                                     { \
                                         emit executionError(outofbounds.arg(reg##src)); \
-                                        return; \
+                                        return false; \
                                     } \
                                     reg##dst = _memory.at(reg##src); \
-                                    EMIT_LOG(regldderef.arg(regToString[Register::dst], regToString[Register::src]), QString::number(reg##dst));\
-                                    emit memoryUpdated(reg##src, reg##dst, OperationType::Read)
+                                    if((Policy & HookPolicy) && _heat) \
+                                        _heat->countRead(reg##src); \
+                                    TRACE_MEM(TrnTrace::MemRead, reg##src, reg##dst); \
+                                    EMIT_LOG_AS(LogMemoryRead, regldderef.arg(regToString[Register::dst], regToString[Register::src]), QString::number(reg##dst));\
+                                    EMIT_MEM_UPDATE(reg##src, reg##dst, OperationType::Read)
 
-#define REG_STORE_DEREF(dst, src)   if((unsigned int)_memory.length() <= reg##dst) \
+#define REG_STORE_DEREF(dst, src)   if(!_memory.contains(reg##dst)) \
                                     { \
                                         emit executionError(outofbounds.arg(reg##src)); \
-                                        return; \
+                                        return false; \
                                     } \
-                                    _memory[reg##dst] = reg##src; \
-                                    EMIT_LOG(regstderef.arg(regToString[Register::dst], regToString[Register::src]), QString::number(reg##dst));\
-                                    emit memoryUpdated(reg##dst, reg##src, OperationType::Write)
+                                    if((Policy & HookPolicy) && _loopCheck) \
+                                        _loop->memoryWritten(reg##dst, _memory.at(reg##dst), reg##src); \
+                                    _memory.write(reg##dst, reg##src); \
+                                    if((Policy & HookPolicy) && _memory.hasFlag(reg##dst, TrnMemory::Watchpoint)) \
+                                        _watchHit = reg##dst; \
+                                    if((Policy & HookPolicy) && _heat) \
+                                        _heat->countWrite(reg##dst); \
+                                    TRACE_MEM(TrnTrace::MemWrite, reg##dst, reg##src); \
+                                    EMIT_LOG_AS(LogMemoryWrite, regstderef.arg(regToString[Register::dst], regToString[Register::src]), QString::number(reg##dst));\
+                                    EMIT_MEM_UPDATE(reg##dst, reg##src, OperationType::Write)
 
 #define REG_INCR(dst)   reg##dst++; \
                         reg##dst &= 0b11111111111111111111; \
                         EMIT_LOG(regincr.arg(regToString[Register::dst]), QString::number(reg##dst)); \
-                        emit registerUpdated(Register::dst, OperationType::InPlace, reg##dst)
+                        EMIT_REG_UPDATE(Register::dst, OperationType::InPlace, reg##dst)
 
 #define REG_DECR(dst)   reg##dst--; \
                         reg##dst &= 0b11111111111111111111; \
                         EMIT_LOG(regdecr.arg(regToString[Register::dst]), QString::number(reg##dst)); \
-                        emit registerUpdated(Register::dst, OperationType::InPlace, reg##dst)
+                        EMIT_REG_UPDATE(Register::dst, OperationType::InPlace, reg##dst)
 
 #define REG_ZERO(dst)   reg##dst = 0; \
                         EMIT_LOG(regzero.arg(regToString[Register::dst]), QString::number(reg##dst)); \
-                        emit registerUpdated(Register::dst, OperationType::InPlace, reg##dst)
+                        EMIT_REG_UPDATE(Register::dst, OperationType::InPlace, reg##dst)
 
-// Avoid printing SC++ during execution only logging
+// SC++ is logged as part of the clock, not the phase
 #define PHASE_END()     { \
-                            bool restore = _printToLog; \
-                            _printToLog = false; \
+                            if(Policy & LogPolicy) \
+                                _logContext |= LogClock; \
                             REG_INCR(SC); \
+                            if(Policy & LogPolicy) \
+                                _logContext &= ~LogClock; \
                             checkpoint(); \
-                            _printToLog = restore; \
                         }
 
 #define DO_READ()   REG_LOAD_DEREF(BR, AR)
 #define DO_WRITE()  REG_STORE_DEREF(AR, BR)
 
-TrnEmu::TrnEmu(unsigned long sleepInterval, QVector<quint32> pgm, bool logExecutionPhaseOnly, QObject* parent) :
-    QThread(parent), _memory(pgm), _isProcessing(new QMutex()), _intervalMutex(new QMutex()), _sleepInterval(sleepInterval), _cond(new QWaitCondition()),
-    _inputCond(new QWaitCondition()), _shouldPause(false), _paused(false), overflow(false), _logAllPhases(!logExecutionPhaseOnly), _printToLog(false)
+TrnEmu::TrnEmu(quint32 clockHz, const QVector<quint32>& pgm, quint32 logCategories, TrnMemory::OutOfRangePolicy policy, QObject* parent) :
+    QThread(parent), _memory(pgm, policy), _clockHz(clockHz), _shouldPause(false), _paused(false), _stepsRequested(0),
+    _ffRequested(false), _ffRequestTarget(ToAddress), _ffRequestValue(0), _traceRequest(nullptr), _traceStopRequested(false), _input(0), _watchpoints(0), _logCategories(logCategories), _logRange(0xFFFF0000), overflow(false), _logMask(logCategories), _logContext(0), _logInsn(0),
+    _sampled(false), _rateClock(0), _fastForwarding(false), _ffTarget(ToAddress), _ffValue(0), _ffCallPending(false),
+    _trace(nullptr), _inCycle(false), _traceRequestPending(false), _memFlags(0), _memAddr(0), _memData(0), _heat(nullptr), _loopCheck(false), _loop(new TrnLoopDetector()), _inputsRead(0),
+    _sampleImage(_memory.toVector()), _watchHit(-1), _cycleEvents(true)
 {
     reset();
+    _sampleTimer.start();
+    resetPacing(clockHz);
 }
 
 TrnEmu::~TrnEmu()
 {
-    delete _cond;
-    delete _inputCond;
-    delete _isProcessing;
-    delete _intervalMutex;
+    // The thread is no longer running at this point
+    delete _trace;
+    delete _traceRequest.load();
+    delete _loop;
 }
 
 void TrnEmu::run()
 {
+    if(_loopCheck)
+        _loop->reset(_memory.constData(), _memory.size());
+
+    // Pick up anything requested before the thread started, such as a fast forward
+    if(_shouldPause.load(std::memory_order_relaxed))
+        waitWhilePaused();
+
     while(!isInterruptionRequested())
     {
-        // Tick!
-        clock_tick();
-        quint8 opcode;
+        if(!runCycle())
+            break;
+        if(_traceRequestPending)
+            applyTraceRequests();
 
-        switch(regF)
+        if(_fastForwarding && fastForwardReached())
         {
-            case 0b00:
-                EMIT_LOG("Fetching next instruction", QString());
-
-                REG_LOAD(AR, PC);
-                PHASE_END();
-
-                clock_tick();
-                DO_READ();
-                REG_INCR(PC);
-                PHASE_END();
-
-                clock_tick();
-                REG_LOAD(IR, BR);
-                REG_LOAD_MASK(AR, BR, 0b1111111111111);
-                PHASE_END();
-
-                clock_tick();
-                // Detect the type of reference
-                if(regIR & 0b10000000000000) // Indexed
-                    regF = 0b01;
-                else if(regIR & 0b100000000000000) // Indirect
-                    regF = 0b10;
-                else
-                    regF = 0b11; // None
-                break;
-
-            case 0b01:
-                EMIT_LOG("Dereferencing argument", QString("Indexed"));
-                regAR = (regIR & 0b1111111111111) + regI;
-                EMIT_LOG("AR ← (IR & 0b1111111111111) + I", QString::number(regAR));
-                emit registerUpdated(Register::IR, OperationType::Read, regIR);
-                emit registerUpdated(Register::I, OperationType::Read, regI);
-                emit registerUpdated(Register::AR, OperationType::Write, regAR);
-
-                // Now that we're done, check if we also need to perform an indirect deref
-                if(regIR & 0b100000000000000)
-                    regF = 0b10;
-                else
-                    regF = 0b11;
-                break;
-
-            case 0b10:
-                EMIT_LOG("Dereferencing argument", QString("Indirect"));
-                DO_READ();
-                PHASE_END();
-
-                clock_tick();
-                REG_LOAD_MASK(AR, BR, 0b1111111111111);
-                regF = 0b11;
-                break;
-
-            case 0b11:
-                opcode = (regIR >> 15) & 0b11111;
-                _printToLog = true;
-                EMIT_LOG("Executing instruction", QString());
-                // Decode and execute
-                switch(opcode)
-                {
-                    case TrnOpcodes::NOP:
-                        EMIT_LOG(tr("No Operation"), "NOP");
-                        break;
+            finishFastForward();
+            waitWhilePaused();
+        }
+        else
+            checkDebugPoints();
 
-                    case TrnOpcodes::LDA:
-                        EMIT_LOG(tr("Load argument to register A"), "LDA");
-                        DO_READ();
-                        PHASE_END();
+        if(_loopCheck && regF == 0b00)
+            checkForLoop();
+    }
+    // Make sure the GUI ends up with the final state
+    if(_sampled)
+        emitSampledState();
+    endTrace();
+    qDebug() << "TRN Emulation thread has ended";
+}
 
-                        clock_tick();
-                        REG_LOAD(A, BR);
-                        break;
+bool TrnEmu::runCycle()
+{
+    // Only pay for what is actually in use right now
+    int policy = 0;
+    if(!_fastForwarding)
+        policy |= LogPolicy;
+    if(!_sampled)
+        policy |= EventPolicy;
+    if(_heat || _loopCheck || _trace || _watchpoints.load(std::memory_order_relaxed))
+        policy |= HookPolicy;
+    _cycleEvents = policy & EventPolicy;
+
+    _inCycle = true;
+    if(!_trace)
+    {
+        bool ok = (this->*cycleVariants[policy])();
+        _inCycle = false;
+        return finishCycle(ok);
+    }
 
-                    case TrnOpcodes::LDX:
-                        EMIT_LOG(tr("Load argument to register X"), "LDX");
-                        DO_READ();
-                        PHASE_END();
+    TrnTrace::Registers before;
+    getRegisters(before);
+    _memFlags = 0;
+    bool ok = (this->*cycleVariants[policy])();
+    _inCycle = false;
+    TrnTrace::Registers after;
+    getRegisters(after);
+    if(_trace)
+        _trace->recordCycle(before, after, _memFlags, _memAddr, _memData, !ok);
+    return finishCycle(ok);
+}
 
-                        clock_tick();
-                        REG_LOAD(X, BR);
-                        break;
+bool TrnEmu::finishCycle(bool ok)
+{
+    // Sampling stopped halfway through a cycle that had its per access signals compiled out
+    // The GUI didn't hear about the rest of it, so it needs another snapshot
+    if(!_cycleEvents && !_sampled)
+        emitSampledState();
+    _cycleEvents = true;
+    return ok;
+}
 
-                    case TrnOpcodes::LDI:
-                        EMIT_LOG(tr("Load BR's data to register I"), "LDI");
-                        DO_READ();
-                        PHASE_END();
+void TrnEmu::getRegisters(quint32* r) const
+{
+    r[Register::BR] = regBR;
+    r[Register::A] = regA;
+    r[Register::X] = regX;
+    r[Register::IR] = regIR;
+    r[Register::SP] = regSP;
+    r[Register::I] = regI;
+    r[Register::PC] = regPC;
+    r[Register::AR] = regAR;
+    r[Register::SC] = regSC;
+    r[Register::CLOCK] = regCLOCK;
+    r[Register::F] = regF;
+    r[Register::V] = regV;
+    r[Register::Z] = regZ;
+    r[Register::S] = regS;
+    r[Register::H] = regH;
+    r[TrnTrace::Overflow] = overflow;
+}
 
-                        clock_tick();
-                        REG_LOAD_MASK(I, BR, 0b1111111111111);
-                        break;
+template<int Policy>
+bool TrnEmu::executeCycle()
+{
+    if(Policy & LogPolicy)
+        updateLogFilter();
+    // Tick!
+    clock_tick<Policy>();
+    quint8 opcode;
 
-                    case TrnOpcodes::STA:
-                        EMIT_LOG(tr("Store register A to the argument address"), "STA");
-                        REG_LOAD(BR, A);
-                        PHASE_END();
+    switch(regF)
+    {
+        case 0b00:
+            EMIT_LOG("Fetching next instruction", QString());
+
+            REG_LOAD(AR, PC);
+            PHASE_END();
+
+            clock_tick<Policy>();
+            DO_READ();
+            _memory.mark(regAR, TrnMemory::Executed);
+            REG_INCR(PC);
+            PHASE_END();
+
+            clock_tick<Policy>();
+            REG_LOAD(IR, BR);
+            REG_LOAD_MASK(AR, BR, 0b1111111111111);
+            PHASE_END();
+
+            clock_tick<Policy>();
+            // Detect the type of reference
+            if(regIR & 0b10000000000000) // Indexed
+                regF = 0b01;
+            else if(regIR & 0b100000000000000) // Indirect
+                regF = 0b10;
+            else
+                regF = 0b11; // None
+            break;
+
+        case 0b01:
+            EMIT_LOG("Dereferencing argument", QString("Indexed"));
+            regAR = (regIR & 0b1111111111111) + regI;
+            EMIT_LOG("AR ← (IR & 0b1111111111111) + I", QString::number(regAR));
+            EMIT_REG_UPDATE(Register::IR, OperationType::Read, regIR);
+            EMIT_REG_UPDATE(Register::I, OperationType::Read, regI);
+            EMIT_REG_UPDATE(Register::AR, OperationType::Write, regAR);
+
+            // Now that we're done, check if we also need to perform an indirect deref
+            if(regIR & 0b100000000000000)
+                regF = 0b10;
+            else
+                regF = 0b11;
+            break;
+
+        case 0b10:
+            EMIT_LOG("Dereferencing argument", QString("Indirect"));
+            DO_READ();
+            PHASE_END();
+
+            clock_tick<Policy>();
+            REG_LOAD_MASK(AR, BR, 0b1111111111111);
+            regF = 0b11;
+            break;
+
+        case 0b11:
+            opcode = (regIR >> 15) & 0b11111;
+            EMIT_LOG("Executing instruction", QString());
+            // Decode and execute
+            switch(opcode)
+            {
+                case TrnOpcodes::NOP:
+                    EMIT_LOG(tr("No Operation"), "NOP");
+                    break;
+
+                case TrnOpcodes::LDA:
+                    EMIT_LOG(tr("Load argument to register A"), "LDA");
+                    DO_READ();
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    REG_LOAD(A, BR);
+                    break;
+
+                case TrnOpcodes::LDX:
+                    EMIT_LOG(tr("Load argument to register X"), "LDX");
+                    DO_READ();
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    REG_LOAD(X, BR);
+                    break;
+
+                case TrnOpcodes::LDI:
+                    EMIT_LOG(tr("Load BR's data to register I"), "LDI");
+                    DO_READ();
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    REG_LOAD_MASK(I, BR, 0b1111111111111);
+                    break;
+
+                case TrnOpcodes::STA:
+                    EMIT_LOG(tr("Store register A to the argument address"), "STA");
+                    REG_LOAD(BR, A);
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    DO_WRITE();
+                    break;
+
+                case TrnOpcodes::STX:
+                    EMIT_LOG(tr("Store register X to the argument address"), "STX");
+                    REG_LOAD(BR, X);
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    DO_WRITE();
+                    break;
+
+                case TrnOpcodes::STI:
+                    EMIT_LOG(tr("Store register I's data to the argument address"), "STI");
+                    // Zero the opcode and E/D fields, and then copy the data from the I register
+                    regBR &= (regI & 0b1111111111111);
+                    EMIT_LOG(regassignandmask.arg("BR", "I", "0b1111111111111"), QString::number(regBR));
+                    EMIT_REG_UPDATE(Register::I, OperationType::Read, regI);
+                    EMIT_REG_UPDATE(Register::BR, OperationType::Write, regBR);
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    DO_WRITE();
+                    break;
+
+                case TrnOpcodes::ENA:
+                    EMIT_LOG(tr("Load argument to register A"), "ENA");
+
+                    // Sign extension
+                    // It's pretty easy since we're always going from 13 bits to 20
+                    // If the sign bit is 1, we just OR 0b1111111000000000000
+                    // If it's not, we can just leave it as-is, as it will default to 0 due to how REG_LOAD_MASK works
+                    regA = regIR & 0b1111111111111;
+                    if(regA & 0b1000000000000)
+                        regA |= 0b11111110000000000000;
+                    EMIT_LOG(regassignmask.arg(regToString[Register::A], regToString[Register::IR],
+                        QString("0b1111111111111")),
+                        QString::number(regA)
+                    );
+                    EMIT_REG_UPDATE(Register::IR, OperationType::Read, regIR);
+                    EMIT_REG_UPDATE(Register::A, OperationType::Write, regA);
+
+                    PHASE_END();
+                    break;
+
+                case TrnOpcodes::PSH:
+                    EMIT_LOG(tr("Push to the stack"), "PSH");
+                    REG_INCR(SP);
+                    REG_LOAD(BR, A);
+                    PHASE_END();
+                    clock_tick<Policy>();
+
+                    REG_LOAD(AR, SP);
+                    PHASE_END();
+                    clock_tick<Policy>();
+
+                    DO_WRITE();
+                    break;
+
+                case TrnOpcodes::POP:
+                    EMIT_LOG(tr("Pop from the stack"), "POP");
+                    REG_LOAD(AR, SP);
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    DO_READ();
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    REG_LOAD(A, BR);
+                    REG_DECR(SP);
+                    break;
+
+                // Same opcode for INA, INX, INI, DCA, DCX, DCI
+                case TrnOpcodes::INA:
+                    switch(regIR & 0b111)
+                    {
+                        case InPlaceRegUpdateArg::INA:
+                            EMIT_LOG(tr("Increment register A"), "INA");
+                            EMIT_LOG(tr("Decrement register A"), "DCA");
+                            {
+                                bool firstsign = regA & 0b10000000000000000000;
 
-                        clock_tick();
-                        DO_WRITE();
-                        break;
+                                REG_INCR(A);
+                                if(firstsign == false && (regA & 0b10000000000000000000) != firstsign)
+                                    overflow = true;
+                                else
+                                    overflow = false;
+                            }
+                            break;
+                        case InPlaceRegUpdateArg::INX:
+                            EMIT_LOG(tr("Increment register X"), "INX");
+                            REG_INCR(X);
+                            break;
+                        case InPlaceRegUpdateArg::INI:
+                            EMIT_LOG(tr("Increment register I"), "INI");
+                            REG_INCR(I);
+                            break;
+                        case InPlaceRegUpdateArg::DCA:
+                            EMIT_LOG(tr("Decrement register A"), "DCA");
+                            {
+                                bool firstsign = regA & 0b10000000000000000000;
 
-                    case TrnOpcodes::STX:
-                        EMIT_LOG(tr("Store register X to the argument address"), "STX");
-                        REG_LOAD(BR, X);
-                        PHASE_END();
+                                REG_DECR(A);
+                                if(firstsign == true && (regA & 0b10000000000000000000) != firstsign)
+                                    overflow = true;
+                                else
+                                    overflow = false;
+                            }
+                            break;
+                        case InPlaceRegUpdateArg::DCX:
+                            EMIT_LOG(tr("Decrement register X"), "DCX");
+                            REG_DECR(X);
+                            break;
+                        case InPlaceRegUpdateArg::DCI:
+                            EMIT_LOG(tr("Decrement register I"), "DCI");
+                            REG_DECR(I);
+                            break;
+                    }
+                    break;
 
-                        clock_tick();
-                        DO_WRITE();
-                        break;
+                case TrnOpcodes::ENI:
+                    EMIT_LOG(tr("Load IR's argument to register I"), "ENI");
+                    REG_LOAD_MASK(I, IR, 0b1111111111111);
+                    break;
 
-                    case TrnOpcodes::STI:
-                        EMIT_LOG(tr("Store register I's data to the argument address"), "STI");
-                        // Zero the opcode and E/D fields, and then copy the data from the I register
-                        regBR &= (regI & 0b1111111111111);
-                        EMIT_LOG(regassignandmask.arg("BR", "I", "0b1111111111111"), QString::number(regBR));
-                        emit registerUpdated(Register::I, OperationType::Read, regI);
-                        emit registerUpdated(Register::BR, OperationType::Write, regBR);
-                        PHASE_END();
+                case TrnOpcodes::LSP:
+                    EMIT_LOG(tr("Load stack pointer"), "LSP");
+                    DO_READ();
+                    PHASE_END();
 
-                        clock_tick();
-                        DO_WRITE();
-                        break;
+                    clock_tick<Policy>();
+                    REG_LOAD_MASK(SP, BR, 0b1111111111111);
+                    break;
 
-                    case TrnOpcodes::ENA:
-                        EMIT_LOG(tr("Load argument to register A"), "ENA");
-
-                        // Sign extension
-                        // It's pretty easy since we're always going from 13 bits to 20
-                        // If the sign bit is 1, we just OR 0b1111111000000000000
-                        // If it's not, we can just leave it as-is, as it will default to 0 due to how REG_LOAD_MASK works
-                        regA = regIR & 0b1111111111111;
-                        if(regA & 0b1000000000000)
-                            regA |= 0b11111110000000000000;
-                        EMIT_LOG(regassignmask.arg(regToString[Register::A], regToString[Register::IR],
-                            QString("0b1111111111111")),
-                            QString::number(regA)
-                        );
-                        emit registerUpdated(Register::IR, OperationType::Read, regIR);
-                        emit registerUpdated(Register::A, OperationType::Write, regA);
+                case TrnOpcodes::ADA:
+                    EMIT_LOG(tr("Add memory value to A, and store the result to A"), "ADA");
+                    DO_READ();
+                    PHASE_END();
 
-                        PHASE_END();
-                        break;
+                    clock_tick<Policy>();
+                    {
+                        bool firstsign = regA & 0b10000000000000000000;
+                        bool secondsign = regBR & 0b10000000000000000000;
 
-                    case TrnOpcodes::PSH:
-                        EMIT_LOG(tr("Push to the stack"), "PSH");
-                        REG_INCR(SP);
-                        REG_LOAD(BR, A);
-                        PHASE_END();
-                        clock_tick();
+                        regA += regBR;
+                        if(firstsign == secondsign && (regA & 0b10000000000000000000) != firstsign)
+                            overflow = true;
+                        else
+                            overflow = false;
+                    }
+                    EMIT_LOG("A = A + BR", QString::number(regA));
+                    EMIT_REG_UPDATE(Register::BR, OperationType::Read, regBR);
+                    EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                    break;
 
-                        REG_LOAD(AR, SP);
-                        PHASE_END();
-                        clock_tick();
+                case TrnOpcodes::SUB:
+                    EMIT_LOG(tr("Subtract memory value from A, and store the result to A"), "SUB");
+                    DO_READ();
+                    PHASE_END();
 
-                        DO_WRITE();
-                        break;
+                    clock_tick<Policy>();
+                    {
 
-                    case TrnOpcodes::POP:
-                        EMIT_LOG(tr("Pop from the stack"), "POP");
-                        REG_LOAD(AR, SP);
-                        PHASE_END();
+                        regBR = ~regBR;
+                        EMIT_LOG("BR = ~BR", QString::number(regBR));
+                        EMIT_REG_UPDATE(Register::BR, OperationType::InPlace, regBR);
+                        bool firstsign = regA & 0b10000000000000000000;
+                        bool secondsign = regBR & 0b10000000000000000000;
 
-                        clock_tick();
-                        DO_READ();
+                        REG_INCR(A);
                         PHASE_END();
 
-                        clock_tick();
-                        REG_LOAD(A, BR);
-                        REG_DECR(SP);
-                        break;
+                        clock_tick<Policy>();
 
-                    // Same opcode for INA, INX, INI, DCA, DCX, DCI
-                    case TrnOpcodes::INA:
-                        switch(regIR & 0b111)
-                        {
-                            case InPlaceRegUpdateArg::INA:
-                                EMIT_LOG(tr("Increment register A"), "INA");
-                                EMIT_LOG(tr("Decrement register A"), "DCA");
-                                {
-                                    bool firstsign = regA & 0b10000000000000000000;
-
-                                    REG_INCR(A);
-                                    if(firstsign == false && (regA & 0b10000000000000000000) != firstsign)
-                                        overflow = true;
-                                    else
-                                        overflow = false;
-                                }
-                                break;
-                            case InPlaceRegUpdateArg::INX:
-                                EMIT_LOG(tr("Increment register X"), "INX");
-                                REG_INCR(X);
-                                break;
-                            case InPlaceRegUpdateArg::INI:
-                                EMIT_LOG(tr("Increment register I"), "INI");
-                                REG_INCR(I);
-                                break;
-                            case InPlaceRegUpdateArg::DCA:
-                                EMIT_LOG(tr("Decrement register A"), "DCA");
-                                {
-                                    bool firstsign = regA & 0b10000000000000000000;
-
-                                    REG_DECR(A);
-                                    if(firstsign == true && (regA & 0b10000000000000000000) != firstsign)
-                                        overflow = true;
-                                    else
-                                        overflow = false;
-                                }
-                                break;
-                            case InPlaceRegUpdateArg::DCX:
-                                EMIT_LOG(tr("Decrement register X"), "DCX");
-                                REG_DECR(X);
-                                break;
-                            case InPlaceRegUpdateArg::DCI:
-                                EMIT_LOG(tr("Decrement register I"), "DCI");
-                                REG_DECR(I);
-                                break;
-                        }
-                        break;
+                        regA += regBR;
+                        if(firstsign == secondsign && (regA & 0b10000000000000000000) != firstsign)
+                            overflow = true;
+                        else
+                            overflow = false;
+                    }
 
-                    case TrnOpcodes::ENI:
-                        EMIT_LOG(tr("Load IR's argument to register I"), "ENI");
-                        REG_LOAD_MASK(I, IR, 0b1111111111111);
-                        break;
+                    EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                    EMIT_REG_UPDATE(Register::BR, OperationType::Read, regBR);
+                    break;
+
+                case TrnOpcodes::AND:
+                    EMIT_LOG(tr("AND registers A and BR"), "AND");
+                    DO_READ();
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    regA &= regBR;
+                    EMIT_LOG("A = A & BR", QString::number(regA));
+                    EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                    EMIT_REG_UPDATE(Register::BR, OperationType::Read, regBR);
+                    break;
+
+                case TrnOpcodes::ORA:
+                    EMIT_LOG(tr("OR registers A and BR"), "ORA");
+                    DO_READ();
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    regA |= regBR;
+                    EMIT_LOG("A = A | BR", QString::number(regA));
+                    EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                    EMIT_REG_UPDATE(Register::BR, OperationType::Read, regBR);
+                    break;
+
+                case TrnOpcodes::XOR:
+                    EMIT_LOG(tr("XOR registers A and BR"), "XOR");
+                    DO_READ();
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    regA ^= regBR;
+                    EMIT_LOG("A = A ^ BR", QString::number(regA));
+                    EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                    EMIT_REG_UPDATE(Register::BR, OperationType::Read, regBR);
+                    break;
+
+                case TrnOpcodes::CMA:
+                    EMIT_LOG(tr("Calculate register A's complement"), "CMA");
+                    regA = (~regA) & 0b11111111111111111111;
+                    EMIT_LOG("A = ~A", QString::number(regA));
+                    EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                    break;
+
+                case TrnOpcodes::JMP:
+                    EMIT_LOG(tr("Jump to address"), "JMP");
+                    REG_LOAD_MASK(PC, BR, 0b1111111111111);
+                    break;
+
+                case TrnOpcodes::JPN:
+                    EMIT_LOG(tr("Jump to address if A is negative"), "JPN");
+                    if(regS)
+                        REG_LOAD_MASK(PC, BR, 0b1111111111111);
+                    break;
 
-                    case TrnOpcodes::LSP:
-                        EMIT_LOG(tr("Load stack pointer"), "LSP");
-                        DO_READ();
-                        PHASE_END();
+                case TrnOpcodes::JAG:
+                    EMIT_LOG(tr("Jump to address if A is greater than zero"), "JAG");
+                    if(!(regS || regZ))
+                        REG_LOAD_MASK(PC, BR, 0b1111111111111);
+                    break;
 
-                        clock_tick();
-                        REG_LOAD_MASK(SP, BR, 0b1111111111111);
-                        break;
+                case TrnOpcodes::JPZ:
+                    EMIT_LOG(tr("Jump to address if A is zero"), "JPZ");
+                    if(regZ)
+                        REG_LOAD_MASK(PC, BR, 0b1111111111111);
+                    break;
 
-                    case TrnOpcodes::ADA:
-                        EMIT_LOG(tr("Add memory value to A, and store the result to A"), "ADA");
-                        DO_READ();
-                        PHASE_END();
+                case TrnOpcodes::JPO:
+                    EMIT_LOG(tr("Jump to address if overflow has occurred"), "JPO");
+                    if(regV)
+                    {
+                        REG_LOAD_MASK(PC, BR, 0b1111111111111);
+                        REG_ZERO(V); // Reset the overflow
+                    }
+                    break;
+
+                case TrnOpcodes::JSR:
+                    EMIT_LOG(tr("Jump to subroutine address"), "JSR");
+                    REG_INCR(SP);
+                    PHASE_END();
+
+                    // For some reason these are executed in the same clock cycle
+                    //clock_tick<Policy>();
+                    REG_LOAD(AR, SP);
+                    REG_LOAD_OR_MASK(BR, PC, 0b1111111111111);
+                    PHASE_END();
+
+                    clock_tick<Policy>();
+                    DO_WRITE();
+                    REG_LOAD_MASK(PC, IR, 0b1111111111111);
+                    break;
+
+                case TrnOpcodes::JIG:
+                    EMIT_LOG(tr("Jump to address if I is greater than zero"), "JIG");
+                    // Check if the first 10 bits are greater than 0, and then make sure the 20th bit is 0
+                    if((regI & 0b01111111111111111111) > 0 && (regI & 0b10000000000000000000) == 0)
+                        REG_LOAD_MASK(PC, BR, 0b1111111111111);
+                    break;
 
-                        clock_tick();
-                        {
-                            bool firstsign = regA & 0b10000000000000000000;
-                            bool secondsign = regBR & 0b10000000000000000000;
-
-                            regA += regBR;
-                            if(firstsign == secondsign && (regA & 0b10000000000000000000) != firstsign)
-                                overflow = true;
-                            else
-                                overflow = false;
-                        }
-                        emit executionLog(regCLOCK, "A = A + BR", QString::number(regA));
-                        emit registerUpdated(Register::BR, OperationType::Read, regBR);
-                        emit registerUpdated(Register::A, OperationType::InPlace, regA);
+                case TrnOpcodes::SHAL:
+                    switch(regIR & 0b11)
+                    {
+                    case 0b00:
+                        EMIT_LOG(tr("Left shift register A"), "SHAL");
+                        regA <<= 1;
+                        EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                        EMIT_LOG(tr("A << 1"), QString::number(regA));
                         break;
+                    case 0b01:
+                        EMIT_LOG(tr("Right shift register A"), "SHAR");
+                        regA >>= 1;
+                        EMIT_LOG(tr("A >> 1"), QString::number(regA));
+                        EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                        break;
+                    case 0b10:
+                        EMIT_LOG(tr("Left shift register X"), "SHXL");
+                        regX <<= 1;
+                        EMIT_LOG(tr("X << 1"), QString::number(regX));
+                        EMIT_REG_UPDATE(Register::X, OperationType::InPlace, regX);
+                        break;
+                    case 0b11:
+                        EMIT_LOG(tr("Right shift register X"), "SHXR");
+                        regX >>= 1;
+                        EMIT_LOG(tr("X >> 1"), QString::number(regX));
+                        EMIT_REG_UPDATE(Register::X, OperationType::InPlace, regX);
+                        break;
+                    }
+                    break;
 
-                    case TrnOpcodes::SUB:
-                        EMIT_LOG(tr("Subtract memory value from A, and store the result to A"), "SUB");
-                        DO_READ();
-                        PHASE_END();
-
-                        clock_tick();
-                        {
-
-                            regBR = ~regBR;
-                            emit executionLog(regCLOCK, "BR = ~BR", QString::number(regA));
-                            emit registerUpdated(Register::BR, OperationType::InPlace, regBR);
-                            bool firstsign = regA & 0b10000000000000000000;
-                            bool secondsign = regBR & 0b10000000000000000000;
+                case TrnOpcodes::SSP:
+                    EMIT_LOG(tr("Store stack pointer to memory"), "SSP");
+                    REG_LOAD_OR_MASK(BR, SP, 0b1111111111111);
+                    PHASE_END();
 
-                            REG_INCR(A);
-                            PHASE_END();
+                    clock_tick<Policy>();
+                    DO_WRITE();
+                    break;
 
-                            clock_tick();
+                case TrnOpcodes::SAXL:
+                {
+                    // Combine A and X into a 64 bit register
+                    // U means unused
+                    // 0bUUUUUUUUUUUUUUUUUUUUUUUUAAAAAAAAAAAAAAAAAAAAXXXXXXXXXXXXXXXXXXXX
+                    // Only 40 bits will be used
+                    quint64 axregs = ((quint64)regX & 0b11111111111111111111) | ((((quint64)regA) & 0b11111111111111111111) << 20);
 
-                            regA += regBR;
-                            if(firstsign == secondsign && (regA & 0b10000000000000000000) != firstsign)
-                                overflow = true;
-                            else
-                                overflow = false;
-                        }
+                    if(regIR & 0b1)
+                    {
+                        // SAXR
+                        EMIT_LOG(tr("Shift registers A and X combined to the right"), "SAXR");
+                        axregs = axregs >> 1;
+                    }
+                    else
+                    {
+                        // SAXL
+                        EMIT_LOG(tr("Shift registers A and X combined to the left"), "SAXL");
+                        axregs = axregs << 1;
+                    }
 
-                        emit registerUpdated(Register::A, OperationType::InPlace, regA);
-                        emit registerUpdated(Register::BR, OperationType::Read, regBR);
-                        break;
+                    // Split them up again
+                    regX = axregs & 0b11111111111111111111;
+                    regA = (axregs >> 20) & 0b11111111111111111111;
+                    EMIT_REG_UPDATE(Register::X, OperationType::InPlace, regX);
+                    EMIT_REG_UPDATE(Register::A, OperationType::InPlace, regA);
+                    break;
+                }
 
-                    case TrnOpcodes::AND:
-                        EMIT_LOG(tr("AND registers A and BR"), "AND");
-                        DO_READ();
+                // More instructions here
+                case TrnOpcodes::OUT:
+                    // If the argument is 0b1, then output
+                    if(regIR & 0b1)
+                    {
+                        EMIT_LOG(tr("Output to console"), "OUT");
+                        REG_LOAD(BR, A);
                         PHASE_END();
 
-                        clock_tick();
-                        regA &= regBR;
-                        EMIT_LOG("A = A & BR", QString::number(regA));
-                        emit registerUpdated(Register::A, OperationType::InPlace, regA);
-                        emit registerUpdated(Register::BR, OperationType::Read, regBR);
-                        break;
-
-                    case TrnOpcodes::ORA:
-                        EMIT_LOG(tr("OR registers A and BR"), "ORA");
-                        DO_READ();
+                        clock_tick<Policy>();
+                        emit outputSet(regBR);
+                    }
+                    else
+                    {
+                        EMIT_LOG(tr("Read user input"), "INP");
+                        // Preset inputs are consumed first, without bothering the user
+                        if(!_inputQueue.isEmpty())
+                            regBR = _inputQueue.takeFirst();
+                        else
+                        {
+                            // Let the GUI catch up before bothering the user
+                            if(_sampled)
+                                emitSampledState();
+                            emit requestInput();
+                            _inputSem.acquire();
+                            regBR = _input.load(std::memory_order_relaxed);
+                            // Don't rush through the ticks that were missed while waiting
+                            resetPacing(_paceHz);
+                        }
+                        _inputsRead++;
                         PHASE_END();
 
-                        clock_tick();
-                        regA |= regBR;
-                        EMIT_LOG("A = A | BR", QString::number(regA));
-                        emit registerUpdated(Register::A, OperationType::InPlace, regA);
-                        emit registerUpdated(Register::BR, OperationType::Read, regBR);
-                        break;
+                        clock_tick<Policy>();
+                        REG_LOAD(A, BR);
+                    }
+                    break;
 
-                    case TrnOpcodes::XOR:
-                        EMIT_LOG(tr("XOR registers A and BR"), "XOR");
-                        DO_READ();
-                        PHASE_END();
+                case TrnOpcodes::RET:
+                    EMIT_LOG(tr("Return from subroutine"), "RET");
+                    REG_LOAD(AR, SP);
+                    PHASE_END();
 
-                        clock_tick();
-                        regA ^= regBR;
-                        EMIT_LOG("A = A ^ BR", QString::number(regA));
-                        emit registerUpdated(Register::A, OperationType::InPlace, regA);
-                        emit registerUpdated(Register::BR, OperationType::Read, regBR);
-                        break;
+                    clock_tick<Policy>();
+                    DO_READ();
+                    PHASE_END();
 
-                    case TrnOpcodes::CMA:
-                        EMIT_LOG(tr("Calculate register A's complement"), "CMA");
-                        regA = (~regA) & 0b11111111111111111111;
-                        EMIT_LOG("A = ~A", QString::number(regA));
-                        emit registerUpdated(Register::A, OperationType::InPlace, regA);
-                        break;
+                    clock_tick<Policy>();
+                    REG_LOAD_MASK(PC, BR, 0b1111111111111);
+                    REG_DECR(SP);
+                    REG_ZERO(F);
+                    PHASE_END();
 
-                    case TrnOpcodes::JMP:
-                        EMIT_LOG(tr("Jump to address"), "JMP");
-                        REG_LOAD_MASK(PC, BR, 0b1111111111111);
-                        break;
+                    clock_tick<Policy>();
+                    // Manually zero out SC here and go back to the start of the loop due to how this instruction has to be implemented
+                    REG_ZERO(SC);
+                    return true;
 
-                    case TrnOpcodes::JPN:
-                        EMIT_LOG(tr("Jump to address if A is negative"), "JPN");
-                        if(regS)
-                            REG_LOAD_MASK(PC, BR, 0b1111111111111);
-                        break;
+                case TrnOpcodes::HLT:
+                {
+                    regH = 1;
+                    EMIT_LOG(tr("Halt"), "HLT");
+                    QString num = QString::number(1);
+                    EMIT_LOG(regassign.arg(regToString[Register::H], num), num);
+                    EMIT_REG_UPDATE(Register::H, OperationType::InPlace, (quint8)1);
+                    return false;
+                }
+                default:
+                    qDebug() << "Invalid opcode";
+                    emit executionError(tr("Invalid opcode %1").arg(opcode, 5, 2, QChar('0')));
+                    return false;
+            }
+            regF = 0b00;
+            break;
 
-                    case TrnOpcodes::JAG:
-                        EMIT_LOG(tr("Jump to address if A is greater than zero"), "JAG");
-                        if(!(regS || regZ))
-                            REG_LOAD_MASK(PC, BR, 0b1111111111111);
-                        break;
+    }
+    // Always set SC to 0 after executing an instruction
+    if(Policy & LogPolicy)
+        _logContext |= LogClock;
+    REG_ZERO(SC);
+    if(Policy & LogPolicy)
+        _logContext &= ~LogClock;
 
-                    case TrnOpcodes::JPZ:
-                        EMIT_LOG(tr("Jump to address if A is zero"), "JPZ");
-                        if(regZ)
-                            REG_LOAD_MASK(PC, BR, 0b1111111111111);
-                        break;
+    EMIT_REG_UPDATE(Register::F, OperationType::InPlace, regF);
 
-                    case TrnOpcodes::JPO:
-                        EMIT_LOG(tr("Jump to address if overflow has occurred"), "JPO");
-                        if(regV)
-                        {
-                            REG_LOAD_MASK(PC, BR, 0b1111111111111);
-                            REG_ZERO(V); // Reset the overflow
-                        }
-                        break;
+    // TRN checks these at the end of each phase, so we'll do the same here, even though it's a bit wasteful
+    // Only update the UI if the state has changed
 
-                    case TrnOpcodes::JSR:
-                        EMIT_LOG(tr("Jump to subroutine address"), "JSR");
-                        REG_INCR(SP);
-                        PHASE_END();
+    // Check for Zero
+    quint8 isZero = !(regA & 0b11111111111111111111);
+    // This only works because regZ can either be 0 or 1, otherwise we'd need to !!regZ
+    updateFlagReg<Policy>(regZ, isZero, Register::Z);
 
-                        // For some reason these are executed in the same clock cycle
-                        //clock_tick();
-                        REG_LOAD(AR, SP);
-                        REG_LOAD_OR_MASK(BR, PC, 0b1111111111111);
-                        PHASE_END();
+    // Check for sign. It's the 19th bit
+    quint8 isNegative = !!(regA & 0b10000000000000000000);
+    updateFlagReg<Policy>(regS, isNegative, Register::S);
 
-                        clock_tick();
-                        DO_WRITE();
-                        REG_LOAD_MASK(PC, IR, 0b1111111111111);
-                        break;
+    // Finally, check for overflow
+    // We need to use a separate variable, as it gets checked on every cycle
+    updateFlagReg<Policy>(regV, overflow, Register::V);
 
-                    case TrnOpcodes::JIG:
-                        EMIT_LOG(tr("Jump to address if I is greater than zero"), "JIG");
-                        // Check if the first 10 bits are greater than 0, and then make sure the 20th bit is 0
-                        if((regI & 0b01111111111111111111) > 0 && (regI & 0b10000000000000000000) == 0)
-                            REG_LOAD_MASK(PC, BR, 0b1111111111111);
-                        break;
+    checkpoint();
+    return true;
+}
 
-                    case TrnOpcodes::SHAL:
-                        switch(regIR & 0b11)
-                        {
-                        case 0b00:
-                            EMIT_LOG(tr("Left shift register A"), "SHAL");
-                            regA <<= 1;
-                            emit registerUpdated(Register::A, OperationType::InPlace, regA);
-                            EMIT_LOG(tr("A << 1"), QString::number(regA));
-                            break;
-                        case 0b01:
-                            EMIT_LOG(tr("Right shift register A"), "SHAR");
-                            regA >>= 1;
-                            EMIT_LOG(tr("A >> 1"), QString::number(regA));
-                            emit registerUpdated(Register::A, OperationType::InPlace, regA);
-                            break;
-                        case 0b10:
-                            EMIT_LOG(tr("Left shift register X"), "SHXL");
-                            regX <<= 1;
-                            EMIT_LOG(tr("X << 1"), QString::number(regX));
-                            emit registerUpdated(Register::X, OperationType::InPlace, regX);
-                            break;
-                        case 0b11:
-                            EMIT_LOG(tr("Right shift register X"), "SHXR");
-                            regX >>= 1;
-                            EMIT_LOG(tr("X >> 1"), QString::number(regX));
-                            emit registerUpdated(Register::X, OperationType::InPlace, regX);
-                            break;
-                        }
-                        break;
+const TrnEmu::CycleFunction TrnEmu::cycleVariants[] = {
+    &TrnEmu::executeCycle<0>,
+    &TrnEmu::executeCycle<1>,
+    &TrnEmu::executeCycle<2>,
+    &TrnEmu::executeCycle<3>,
+    &TrnEmu::executeCycle<4>,
+    &TrnEmu::executeCycle<5>,
+    &TrnEmu::executeCycle<6>,
+    &TrnEmu::executeCycle<7>,
+};
+
+template<int Policy>
+void TrnEmu::updateFlagReg(quint8& reg, quint8 isFlag, Register regEnum)
+{
+    if(isFlag == reg)
+        return;
+    reg = isFlag;
+    if(Policy & LogPolicy)
+    {
+        QString num = QString::number(isFlag);
+        EMIT_LOG_AS(LogFlags, regassign.arg(regToString[regEnum], num), num);
+    }
+    EMIT_REG_UPDATE(regEnum, OperationType::InPlace, isFlag);
+}
 
-                    case TrnOpcodes::SSP:
-                        EMIT_LOG(tr("Store stack pointer to memory"), "SSP");
-                        REG_LOAD_OR_MASK(BR, SP, 0b1111111111111);
-                        PHASE_END();
+template<int Policy>
+void TrnEmu::clock_tick()
+{
+    if(!_fastForwarding)
+        pace();
+    regCLOCK++;
+    EMIT_LOG_AS(LogClock, clockpulse, QString::number(regCLOCK));
+    EMIT_REG_UPDATE(Register::CLOCK, OperationType::InPlace, regCLOCK);
+}
 
-                        clock_tick();
-                        DO_WRITE();
-                        break;
+void TrnEmu::updateLogFilter()
+{
+    // The whole instruction is logged or not depending on where it was fetched from, also in the later F cycles
+    if(regF == 0b00)
+        _logInsn = regPC;
+    static const quint8 phaseCategory[] = { LogFetch, LogDeref, LogDeref, LogExecute };
+    _logContext = phaseCategory[regF & 0b11];
+
+    quint32 range = _logRange.load(std::memory_order_relaxed);
+    if(_logInsn >= (range & 0xFFFF) && _logInsn <= range >> 16)
+        _logMask = _logCategories.load(std::memory_order_relaxed);
+    else
+        _logMask = 0;
+}
 
-                    case TrnOpcodes::SAXL:
-                    {
-                        // Combine A and X into a 64 bit register
-                        // U means unused
-                        // 0bUUUUUUUUUUUUUUUUUUUUUUUUAAAAAAAAAAAAAAAAAAAAXXXXXXXXXXXXXXXXXXXX
-                        // Only 40 bits will be used
-                        quint64 axregs = ((quint64)regX & 0b11111111111111111111) | ((((quint64)regA) & 0b11111111111111111111) << 20);
+// Called before every clock tick
+// Instead of sleeping for a fixed amount every time, each tick has a deadline relative to a fixed starting point,
+// so that rounding and oversleeping don't accumulate. The clock is only looked at once per batch of ticks,
+// sized so that it happens about once a millisecond, and the thread then sleeps for whatever slack is left.
+void TrnEmu::pace()
+{
+    if(--_paceCountdown)
+        return;
 
-                        if(regIR & 0b1)
-                        {
-                            // SAXR
-                            EMIT_LOG(tr("Shift registers A and X combined to the right"), "SAXR");
-                            axregs = axregs >> 1;
-                        }
-                        else
-                        {
-                            // SAXL
-                            EMIT_LOG(tr("Shift registers A and X combined to the left"), "SAXL");
-                            axregs = axregs << 1;
-                        }
+    quint32 hz = _clockHz.load(std::memory_order_relaxed);
 
-                        // Split them up again
-                        regX = axregs & 0b11111111111111111111;
-                        regA = (axregs >> 20) & 0b11111111111111111111;
-                        emit registerUpdated(Register::X, OperationType::InPlace, regX);
-                        emit registerUpdated(Register::A, OperationType::InPlace, regA);
-                        break;
-                    }
+    qint64 elapsed = _rateTimer.elapsed();
+    if(elapsed >= 500)
+    {
+        emit clockRateMeasured((quint64)(regCLOCK - _rateClock) * 1000 / elapsed);
+        _rateClock = regCLOCK;
+        _rateTimer.restart();
+    }
 
-                    // More instructions here
-                    case TrnOpcodes::OUT:
-                        // If the argument is 0b1, then output
-                        if(regIR & 0b1)
-                        {
-                            EMIT_LOG(tr("Output to console"), "OUT");
-                            REG_LOAD(BR, A);
-                            PHASE_END();
+    if(hz != _paceHz)
+    {
+        resetPacing(hz);
+        return;
+    }
 
-                            clock_tick();
-                            emit outputSet(regBR);
-                        }
-                        else
-                        {
-                            EMIT_LOG(tr("Read user input"), "INP");
-                            {
-                                QMutexLocker l(_isProcessing);
-                                emit requestInput();
-                                _inputCond->wait(_isProcessing);
-                            }
-                            PHASE_END();
+    _paceCountdown = _paceBatch;
+    if(!hz)
+        return;
 
-                            clock_tick();
-                            REG_LOAD(A, BR);
-                        }
-                        break;
+    _paceTicks += _paceBatch;
+    // Move the starting point forward every second so that the multiplication below can't overflow
+    if(_paceTicks >= hz)
+    {
+        _paceTicks -= hz;
+        _paceStart += std::chrono::seconds(1);
+    }
 
-                    case TrnOpcodes::RET:
-                        EMIT_LOG(tr("Return from subroutine"), "RET");
-                        REG_LOAD(AR, SP);
-                        PHASE_END();
+    std::chrono::steady_clock::time_point deadline = _paceStart + std::chrono::nanoseconds(_paceTicks * 1000000000 / hz);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(now < deadline)
+        std::this_thread::sleep_until(deadline);
+    // If we fell too far behind (the host can't keep up), start over instead of trying to catch up in a burst
+    else if(now - deadline > std::chrono::milliseconds(50))
+        resetPacing(hz);
+}
 
-                        clock_tick();
-                        DO_READ();
-                        PHASE_END();
+void TrnEmu::resetPacing(quint32 hz)
+{
+    _paceHz = hz;
+    _paceStart = std::chrono::steady_clock::now();
+    _paceTicks = 0;
+    // Unthrottled, still check every now and then for rate changes and measurements
+    _paceBatch = hz ? qMax(1u, hz / 1000) : 4096;
+    _paceCountdown = _paceBatch;
+    _rateClock = regCLOCK;
+    _rateTimer.restart();
+}
 
-                        clock_tick();
-                        REG_LOAD_MASK(PC, BR, 0b1111111111111);
-                        REG_DECR(SP);
-                        REG_ZERO(F);
-                        PHASE_END();
+void TrnEmu::checkpoint()
+{
+    if(_fastForwarding)
+    {
+        if(_ffTarget == ToClock && regCLOCK >= _ffValue)
+            finishFastForward();
+    }
+    else
+    {
+        // Faster than the display can refresh, the GUI thread would spend all its time on updates nobody gets to see
+        // Publish a snapshot once per frame instead, and once more when leaving sampled mode so that the GUI catches up
+        bool sampled = !_paceHz || _paceHz > 1000 / frameInterval;
+        if(_sampled && (!sampled || _sampleTimer.elapsed() >= (qint64)frameInterval))
+        {
+            emitSampledState();
+            _sampleTimer.restart();
+        }
+        _sampled = sampled;
+    }
 
-                        clock_tick();
-                        // Manually zero out SC here and go back to the start of the loop due to how this instruction has to be implemented
-                        REG_ZERO(SC);
-                        continue;
+    // This is the only thing the uncontended path pays for
+    if(_shouldPause.load(std::memory_order_relaxed))
+        waitWhilePaused();
+}
 
-                    case TrnOpcodes::HLT:
-                    {
-                        regH = 1;
-                        EMIT_LOG(tr("Halt"), "HLT");
-                        QString num = QString::number(1);
-                        EMIT_LOG(regassign.arg(regToString[Register::H], num), num);
-                        emit registerUpdated(Register::H, OperationType::InPlace, (quint8)1);
-                        return;
-                    }
-                    default:
-                        qDebug() << "Invalid opcode";
-                        emit executionError(tr("Invalid opcode %1").arg(opcode, 5, 2, QChar('0')));
-                        return;
-                }
-                regF = 0b00;
-                _printToLog = false;
-                break;
+void TrnEmu::waitWhilePaused()
+{
+    // Pairs with the release in pause(), so that _paused is up to date below
+    _shouldPause.load(std::memory_order_acquire);
+    // Requests that come in while running (such as starting a trace) only need our attention. A real pause ends any fast forward
+    if(_paused.load(std::memory_order_relaxed))
+    {
+        _fastForwarding = false;
+        if(_sampled || !_cycleEvents)
+            emitSampledState();
+    }
+
+    // Resume, step, fast forward and trace requests all post to the semaphore. Leftover posts (e.g. a resume that arrived before we got here)
+    // only cause another trip around the loop
+    while(_shouldPause.load(std::memory_order_acquire))
+    {
+        _resumeSem.acquire();
+        // Every step lets exactly one phase through, so clicks that come in faster than they are serviced aren't lost
+        // Only taken while there still is one, as resume() can drop the rest at any time
+        int steps = _stepsRequested.load(std::memory_order_acquire);
+        while(steps > 0 && !_stepsRequested.compare_exchange_weak(steps, steps - 1, std::memory_order_acquire))
+            ;
+        if(steps > 0)
+            break;
+
+        // A trace only starts or stops between cycles, so that it never begins halfway through one or loses the end of it
+        if(_traceStopRequested.load(std::memory_order_relaxed) || _traceRequest.load(std::memory_order_relaxed))
+        {
+            if(_inCycle)
+                _traceRequestPending = true;
+            else
+                applyTraceRequests();
+        }
 
+        if(_ffRequested.exchange(false, std::memory_order_acquire))
+        {
+            startFastForward((FastForwardTarget)_ffRequestTarget.load(std::memory_order_relaxed), _ffRequestValue.load(std::memory_order_relaxed));
+            _fastForwarding = true;
+            // Suppresses the per access signals until the final snapshot
+            _sampled = true;
+            _paused.store(false, std::memory_order_relaxed);
+            _shouldPause.store(false, std::memory_order_relaxed);
+            break;
         }
-        // Always set SC to 0 after executing an instruction
-        REG_ZERO(SC);
 
-        emit registerUpdated(Register::F, OperationType::InPlace, regF);
+        if(!_paused.load(std::memory_order_relaxed))
+        {
+            _shouldPause.store(false, std::memory_order_relaxed);
+            break;
+        }
+    }
+    resetPacing(_paceHz);
+}
 
-        // TRN checks these at the end of each phase, so we'll do the same here, even though it's a bit wasteful
-        // Only update the UI if the state has changed
+void TrnEmu::startFastForward(FastForwardTarget target, quint32 value)
+{
+    _ffTarget = target;
+    _ffValue = value;
+    _ffCallPending = false;
+    if(target == OverCall)
+    {
+        // Between the fetch and the execute phase of a JSR, it can be stepped over right away
+        // Anywhere else, wait and see what the next instruction turns out to be
+        _ffCallPending = true;
+        fastForwardReached();
+    }
+    else if(target == OutOfCall)
+        _ffValue = regSP;
+}
 
-        // Check for Zero
-        quint8 isZero = !(regA & 0b11111111111111111111);
-        // This only works because regZ can either be 0 or 1, otherwise we'd need to !!regZ
-        updateFlagReg(regZ, isZero, Register::Z);
+// Checked after every F cycle. ToClock is checked on every tick instead, in checkpoint()
+bool TrnEmu::fastForwardReached()
+{
+    quint8 opcode = (regIR >> 15) & 0b11111;
+    switch(_ffTarget)
+    {
+        case ToAddress:
+            return regF == 0b00 && regPC == _ffValue;
+        case NextInstruction:
+            return regF == 0b00;
+        case OverCall:
+            if(_ffCallPending)
+            {
+                // Anything else is over once it's done, same as NextInstruction
+                if(regF == 0b00 || regSC != 0 || opcode != TrnOpcodes::JSR)
+                    return regF == 0b00;
+                // PC already points at the instruction after the JSR, and the execute phase hasn't pushed it yet
+                _ffValue = regPC | (quint32)regSP << 16;
+                _ffCallPending = false;
+                return false;
+            }
+            // A recursive call returns to the same address, but with SP further up
+            return regF == 0b00 && regPC == (_ffValue & 0xFFFF) && regSP <= _ffValue >> 16;
+        case OutOfCall:
+            return regF == 0b00 && opcode == TrnOpcodes::RET && regSP < _ffValue;
+        default:
+            return false;
+    }
+}
 
-        // Check for sign. It's the 19th bit
-        quint8 isNegative = !!(regA & 0b10000000000000000000);
-        updateFlagReg(regS, isNegative, Register::S);
+void TrnEmu::finishFastForward()
+{
+    // Park on the next check, exactly as if the user had paused
+    _paused.store(true, std::memory_order_relaxed);
+    _shouldPause.store(true, std::memory_order_relaxed);
+    emit fastForwardFinished();
+}
 
-        // Finally, check for overflow
-        // We need to use a separate variable, as it gets checked on every cycle
-        updateFlagReg(regV, overflow, Register::V);
+void TrnEmu::checkDebugPoints()
+{
+    int watch = _watchHit;
+    _watchHit = -1;
+    // Stepping onto one is not a hit, we are already paused
+    if(_paused.load(std::memory_order_relaxed))
+        return;
 
-        checkpoint();
+    if(watch >= 0)
+    {
+        _paused.store(true, std::memory_order_relaxed);
+        _shouldPause.store(true, std::memory_order_relaxed);
+        emit watchpointHit(watch);
     }
-    qDebug() << "TRN Emulation thread has ended";
+    else if(regF == 0b00 && regPC < TrnMemory::Size && _memory.hasFlag(regPC, TrnMemory::Breakpoint))
+    {
+        _paused.store(true, std::memory_order_relaxed);
+        _shouldPause.store(true, std::memory_order_relaxed);
+        emit breakpointHit(regPC);
+    }
+    else
+        return;
+    // Resuming runs this instruction before we look again, so the same breakpoint doesn't hit twice
+    waitWhilePaused();
 }
 
-void TrnEmu::updateFlagReg(quint8& reg, quint8 isFlag, Register regEnum)
+void TrnEmu::checkForLoop()
 {
-    if(isFlag == reg)
+    TrnTrace::Registers r;
+    getRegisters(r);
+    if(!_loop->check(r, _inputsRead, _memory.constData(), _memory.size()))
         return;
-    reg = isFlag;
-    QString num = QString::number(isFlag);
-    EMIT_LOG(regassign.arg(regToString[regEnum], num), num);
-    emit registerUpdated(regEnum, OperationType::InPlace, isFlag);
+
+    // Only once. If the user resumes, they want to watch it go around
+    _loopCheck = false;
+    _paused.store(true, std::memory_order_relaxed);
+    _shouldPause.store(true, std::memory_order_relaxed);
+    emit infiniteLoopDetected(_loop->period());
+    waitWhilePaused();
 }
 
-void TrnEmu::clock_tick()
+void TrnEmu::fastForward(FastForwardTarget target, quint32 value)
 {
-    // Hide the clock in the logs when not needed
-    bool restore = _printToLog;
-    _printToLog = false;
-    regCLOCK++;
-    EMIT_LOG(clockpulse, QString::number(regCLOCK));
-    emit registerUpdated(Register::CLOCK, OperationType::InPlace, regCLOCK);
-    // restore the previous print to log state
-    _printToLog = restore;
+    _ffRequestTarget.store(target, std::memory_order_relaxed);
+    _ffRequestValue.store(value, std::memory_order_relaxed);
+    _ffRequested.store(true, std::memory_order_release);
+    // Go through the pause path, so that the running thread still only checks a single flag
+    _shouldPause.store(true, std::memory_order_release);
+    _resumeSem.release();
 }
 
-void TrnEmu::checkpoint()
+void TrnEmu::startTrace(TrnTraceWriter* w)
+{
+    // If a previous request wasn't picked up yet, it's replaced
+    delete _traceRequest.exchange(w, std::memory_order_release);
+    _shouldPause.store(true, std::memory_order_release);
+    _resumeSem.release();
+}
+
+void TrnEmu::stopTrace()
+{
+    _traceStopRequested.store(true, std::memory_order_release);
+    _shouldPause.store(true, std::memory_order_release);
+    _resumeSem.release();
+}
+
+void TrnEmu::endTrace()
 {
-    // We have to do it this way so as to not block the main thread if the user tries to change the clock
-    // while we're sleeping here
-    _intervalMutex->lock();
-    unsigned long tempInterval = _sleepInterval;
-    _intervalMutex->unlock();
+    if(!_trace)
+        return;
+    _trace->finish();
+    emit traceFinished(_trace->recordCount(), _trace->stallCount(), _trace->errorString());
+    delete _trace;
+    _trace = nullptr;
+}
 
-    QThread::msleep(tempInterval);
+void TrnEmu::applyTraceRequests()
+{
+    _traceRequestPending = false;
+    if(_traceStopRequested.exchange(false, std::memory_order_acquire))
+        endTrace();
+    if(TrnTraceWriter* w = _traceRequest.exchange(nullptr, std::memory_order_acquire))
+    {
+        endTrace();
+        _trace = w;
+        if(!_trace->begin(getState()))
+            endTrace();
+    }
+}
 
-    QMutexLocker l(_isProcessing);
-    if(_shouldPause)
-        _cond->wait(_isProcessing);
+void TrnEmu::setLogFilter(quint32 categories, quint16 from, quint16 to)
+{
+    _logCategories.store(categories, std::memory_order_relaxed);
+    _logRange.store(from | (quint32)to << 16, std::memory_order_relaxed);
 }
 
-void TrnEmu::setDelay(unsigned long interval)
+void TrnEmu::setClockRate(quint32 hz)
 {
-    QMutexLocker l(_intervalMutex);
-    _sleepInterval = interval;
+    _clockHz.store(hz, std::memory_order_relaxed);
 }
 
 void TrnEmu::pause()
 {
-    _paused = true;
-    QMutexLocker l(_isProcessing);
-    _shouldPause = true;
+    _paused.store(true, std::memory_order_relaxed);
+    _shouldPause.store(true, std::memory_order_release);
 }
 
 void TrnEmu::resume()
 {
-    _cond->wakeAll();
-    QMutexLocker l(_isProcessing);
-    _shouldPause = false;
-    _paused = false;
+    // Steps still waiting would otherwise go off the next time it pauses
+    _stepsRequested.store(0, std::memory_order_relaxed);
+    _paused.store(false, std::memory_order_relaxed);
+    _shouldPause.store(false, std::memory_order_release);
+    _resumeSem.release();
+}
+
+void TrnEmu::setInputQueue(const QVector<quint32>& inputs)
+{
+    _inputQueue = inputs;
+}
+
+void TrnEmu::emitSampledState()
+{
+    // Only the pages written since the last sample are copied, and only those need to be diffed by the GUI
+    // The GUI has usually let go of the previous sample by now, so this doesn't detach
+    QBitArray dirty = _memory.takeDirtyPages();
+    _memory.copyPages(_sampleImage.data(), dirty);
+    TrnState s = getRegisterState();
+    s.memory = _sampleImage;
+    emit stateSampled(s, dirty);
+}
+
+TrnState TrnEmu::getState() const
+{
+    TrnState s = getRegisterState();
+    s.memory = _memory.toVector();
+    return s;
+}
+
+TrnState TrnEmu::getRegisterState() const
+{
+    TrnState s;
+    s.BR = regBR;
+    s.A = regA;
+    s.X = regX;
+    s.IR = regIR;
+    s.CLOCK = regCLOCK;
+    s.SP = regSP;
+    s.I = regI;
+    s.PC = regPC;
+    s.AR = regAR;
+    s.SC = regSC;
+    s.F = regF;
+    s.V = regV;
+    s.Z = regZ;
+    s.S = regS;
+    s.H = regH;
+    s.overflow = overflow;
+    return s;
 }
 
 void TrnEmu::setInput(quint32 input)
 {
-    regBR = input;
-    _inputCond->wakeAll();
+    _input.store(input, std::memory_order_relaxed);
+    // The release also publishes the value above
+    _inputSem.release();
 }
 
 void TrnEmu::step()
 {
-    if(_paused)
+    if(_paused.load(std::memory_order_relaxed))
     {
         // Same as resume but doesn't set shouldPause to false
-        _cond->wakeAll();
+        _stepsRequested.fetch_add(1, std::memory_order_release);
+        _resumeSem.release();
     }
 }
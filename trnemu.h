@@ -1,21 +1,41 @@
 #ifndef TRNEMU_H
 #define TRNEMU_H
 #include <QVector>
+#include <QBitArray>
 #include <QThread>
-#include <QMutex>
-#include <QWaitCondition>
+#include <QSemaphore>
+#include <QElapsedTimer>
+#include <atomic>
+#include <chrono>
+#include "trnstate.h"
+#include "trnmemory.h"
+
+class TrnTraceWriter;
+class TrnHeatMap;
+class TrnLoopDetector;
 
 class TrnEmu : public QThread
 {
 Q_OBJECT
 public:
-    TrnEmu(unsigned long sleepInterval, QVector<quint32> pgm, bool logExecutionPhaseOnly, QObject* parent);
+    // A clock rate of 0 runs as fast as possible
+    // logCategories is the initial log filter, see setLogFilter()
+    TrnEmu(quint32 clockHz, const QVector<quint32>& pgm, quint32 logCategories, TrnMemory::OutOfRangePolicy policy, QObject* parent);
     ~TrnEmu();
     void run();
+    // Executes a single F cycle (fetch, indexed, indirect or execute) on the calling thread
+    // Returns false when the emulation can not continue (halt or error)
+    // Must not be used while the thread is running
+    bool runCycle();
     void pause();
     void resume();
-    inline bool getPaused() const { return _paused; }
+    inline bool getPaused() const { return _paused.load(std::memory_order_relaxed); }
     void setInput(quint32 input);
+    // Inputs that INP consumes in order before falling back to asking the user
+    void setInputQueue(const QVector<quint32>& inputs);
+    TrnState getState() const;
+    // Same as getState(), without copying the memory
+    TrnState getRegisterState() const;
     typedef enum {
         // 32 bit regs
         BR,
@@ -89,29 +109,151 @@ public:
         DCI,
     } InPlaceRegUpdateArg;
 
-    void setDelay(unsigned long interval);
+    void setClockRate(quint32 hz);
+
+    typedef enum {
+        LogFetch = 0b0000001,
+        LogDeref = 0b0000010, // The indexed and indirect F cycles
+        LogExecute = 0b0000100,
+        LogClock = 0b0001000, // Clock pulses and SC
+        LogFlags = 0b0010000, // Z, S and V updates at the end of each F cycle
+        LogMemoryRead = 0b0100000,
+        LogMemoryWrite = 0b1000000,
+        LogAll = 0b1111111,
+        LogExecutionPhaseOnly = LogExecute | LogMemoryRead | LogMemoryWrite,
+    } LogCategory;
+    // A line is only logged if the phase it happens in, and its own category if it has one, are all in categories,
+    // and only for instructions fetched from an address in [from, to]
+    // The filter is applied before anything is formatted, so whatever is filtered out costs next to nothing
+    // Can be changed from any thread, also while running. It takes effect from the next F cycle
+    void setLogFilter(quint32 categories, quint16 from = 0, quint16 to = 0xFFFF);
+
+    typedef enum {
+        ToAddress, // Before the instruction at this address is fetched
+        ToClock, // At the first phase boundary where CLOCK >= this
+        // These are relative to where the emulator is when it picks the request up, and ignore the value
+        NextInstruction, // Before the next instruction is fetched
+        OverCall, // Likewise, but a JSR runs until it has returned to the instruction after it, with SP back where it was
+        OutOfCall, // After a RET leaves SP below where it was, which returns from the subroutine that is running
+    } FastForwardTarget;
+    // Runs at full host speed, without any GUI updates or logging, until the target is reached and then pauses
+    // A final stateSampled is emitted when it stops, so the GUI can catch up in one go
+    // Pausing cancels it. Can be called before the thread is started
+    void fastForward(FastForwardTarget target, quint32 value);
+    // Records a trace from the next cycle on, replacing any running one. Takes ownership of an opened writer
+    void startTrace(TrnTraceWriter* w);
+    void stopTrace();
+    // Counts every memory access. Must be set before the thread is started, sized like the memory, and outlive the thread
+    inline void setHeatMap(TrnHeatMap* h) { _heat = h; }
+    // Pauses and emits infiniteLoopDetected the first time the program provably can't halt any more
+    // Must be set before the thread is started
+    inline void setLoopDetection(bool enabled) { _loopCheck = enabled; }
+    // Pause before the instruction at the address is fetched, or right after the word at the address is written
+    // The address must be below TrnMemory::Size. Can be changed from any thread, also while running
+    inline void setBreakpoint(quint16 addr, bool enabled) { _memory.setFlag(addr, TrnMemory::Breakpoint, enabled); }
+    inline void setWatchpoint(quint16 addr, bool enabled)
+    {
+        if(_memory.setFlag(addr, TrnMemory::Watchpoint, enabled))
+            _watchpoints.fetch_add(enabled ? 1 : -1, std::memory_order_relaxed);
+    }
+    // Roughly 60 fps. Faster than this, the GUI is only sent sampled states
+    static const unsigned long frameInterval = 16;
+    static const quint32 maxClockRate = 50000000;
 public slots:
     void step();
 private:
-    QVector<quint32> _memory;
+    TrnMemory _memory;
     quint32 regBR, regA, regX, regIR, regCLOCK;
     quint16 regSP, regI, regPC, regAR;
     quint8 regSC, regF, regV, regZ, regS, regH;
     inline void reset() { regBR = regAR = regA = regX = regIR = regSP = regI = regSC = regCLOCK = regF = regV = regZ = regS = regH = regPC = 0; }
-    QMutex* _isProcessing;
-    QMutex* _intervalMutex;
-    unsigned long _sleepInterval;
-    QWaitCondition* _cond;
-    QWaitCondition* _inputCond;
-    bool _shouldPause;
-    bool _paused; // This is NOT protected by a mutex. Must only be used by the parent thread. Same as getPaused
+    // Controls shared with the GUI thread. The emu thread only polls them with relaxed loads,
+    // and only blocks on a semaphore when it actually has to wait
+    std::atomic<quint32> _clockHz;
+    std::atomic<bool> _shouldPause;
+    std::atomic<bool> _paused;
+    // Steps clicked that haven't let their phase through yet
+    std::atomic<int> _stepsRequested;
+    QSemaphore _resumeSem;
+    std::atomic<bool> _ffRequested;
+    std::atomic<int> _ffRequestTarget;
+    std::atomic<quint32> _ffRequestValue;
+    std::atomic<TrnTraceWriter*> _traceRequest;
+    std::atomic<bool> _traceStopRequested;
+    std::atomic<quint32> _input;
+    QSemaphore _inputSem;
+    std::atomic<int> _watchpoints;
+    std::atomic<quint32> _logCategories;
+    std::atomic<quint32> _logRange; // from | to << 16
     bool overflow;
-    bool _logAllPhases; // emu thread only
-    bool _printToLog; // likewise
+    // The log filter for the current F cycle
+    quint32 _logMask; // emu thread only
+    // The categories of the current line, other than its own. The phase, and the clock while SC is updated
+    quint8 _logContext; // likewise
+    // Where the current instruction was fetched from
+    quint16 _logInsn; // likewise
+    QVector<quint32> _inputQueue; // likewise
+    bool _sampled; // likewise
+    QElapsedTimer _sampleTimer; // likewise
+    // Pacing state. Tick n since _paceStart is due at _paceStart + n / _paceHz
+    std::chrono::steady_clock::time_point _paceStart; // likewise
+    quint64 _paceTicks; // likewise
+    quint32 _paceHz; // likewise
+    quint32 _paceBatch; // likewise
+    quint32 _paceCountdown; // likewise
+    QElapsedTimer _rateTimer; // likewise
+    quint32 _rateClock; // likewise
+    bool _fastForwarding; // likewise
+    FastForwardTarget _ffTarget; // likewise
+    quint32 _ffValue; // likewise
+    // An OverCall that hasn't seen its JSR yet
+    bool _ffCallPending; // likewise
+    TrnTraceWriter* _trace; // likewise
+    // Set while a cycle is executing. Trace requests that come in then wait for the end of the cycle
+    bool _inCycle; // likewise
+    bool _traceRequestPending; // likewise
+    quint8 _memFlags; // likewise
+    quint16 _memAddr; // likewise
+    quint32 _memData; // likewise
+    TrnHeatMap* _heat; // likewise
+    bool _loopCheck; // likewise
+    TrnLoopDetector* _loop; // likewise
+    quint64 _inputsRead; // likewise
+    QVector<quint32> _sampleImage; // likewise
+    int _watchHit; // likewise
+    bool _cycleEvents; // likewise
+    // What a variant of executeCycle is compiled with. Whatever is left out costs nothing, not even a check
+    // runCycle picks the variant for each cycle, based on what is in use at the time
+    typedef enum {
+        LogPolicy = 0b001, // The execution log. Off while fast forwarding
+        EventPolicy = 0b010, // Per access memoryUpdated and registerUpdated signals. Off while sampling
+        HookPolicy = 0b100, // Heat map, loop detection, trace and watchpoints. Off when none of them are set
+    } CyclePolicy;
+    typedef bool (TrnEmu::*CycleFunction)();
+    // Indexed by the CyclePolicy flags
+    static const CycleFunction cycleVariants[8];
     // Private internal functions that should only be called by the emu thread
+    template<int Policy>
     void updateFlagReg(quint8& reg, quint8 isFlag, Register regEnum);
+    template<int Policy>
     void clock_tick();
+    void pace();
+    void resetPacing(quint32 hz);
     void checkpoint();
+    void waitWhilePaused();
+    void startFastForward(FastForwardTarget target, quint32 value);
+    bool fastForwardReached();
+    void finishFastForward();
+    void checkDebugPoints();
+    void checkForLoop();
+    void emitSampledState();
+    template<int Policy>
+    bool executeCycle();
+    bool finishCycle(bool ok);
+    void updateLogFilter();
+    void getRegisters(quint32* r) const;
+    void endTrace();
+    void applyTraceRequests();
 
 signals:
     //void dataModified(Register, OperationType);
@@ -123,6 +265,19 @@ signals:
     void executionError(QString err);
     void outputSet(quint32 out);
     void requestInput();
+    // Replaces memoryUpdated and registerUpdated while the clock is faster than the display
+    // Only the memory pages set in dirtyPages can have changed since the previous one
+    void stateSampled(TrnState state, QBitArray dirtyPages);
+    // Emitted about twice a second with the clock rate actually achieved
+    void clockRateMeasured(quint64 hz);
+    void fastForwardFinished();
+    // The emulator paused itself, as it came back to a state it was already in, period instructions ago
+    void infiniteLoopDetected(quint64 period);
+    // The emulator paused itself on a breakpoint or watchpoint set by the user
+    void breakpointHit(int addr);
+    void watchpointHit(int addr);
+    // The error is empty if everything was written successfully
+    void traceFinished(quint64 records, quint64 stalls, QString error);
 };
 
 #endif // TRNEMU_H
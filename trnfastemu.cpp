@@ -0,0 +1,717 @@
+#include "trnfastemu.h"
+#include "trnopcodes.h"
+#include "trnemu.h"
+#include "trntracewriter.h"
+#include "trncoverage.h"
+#include "trnprofiler.h"
+
+// This mirrors TrnEmu::runCycle() phase by phase, including all of its quirks
+// (see the notes at the top of trnemu.cpp), so that the state after every phase is identical.
+// Any change to the semantics there must be reflected here, and vice versa.
+// Run "bettertrn --conformance" after touching either of them.
+
+TrnFastEmu::TrnFastEmu(const QVector<quint32>& pgm) :
+    _s(), _memory(pgm), _status(Running), _retired(0), _faultAddr(0), _inputs(), _inputPos(0), _outputs(), _trace(nullptr), _memFlags(0), _memAddr(0), _memData(0), _coverage(nullptr), _profiler(nullptr), _edges(nullptr), _prevFetch(0), _undefined(0), _undefinedAddr(0), _loopCheck(false), _accelerate(false), _accelerated(0)
+{
+}
+
+bool TrnFastEmu::read()
+{
+    if((unsigned int)_memory.size() <= _s.AR)
+        return false;
+    _s.BR = _memory.at(_s.AR);
+    _memFlags = TrnTrace::MemRead;
+    _memAddr = _s.AR;
+    _memData = _s.BR;
+    return true;
+}
+
+bool TrnFastEmu::write()
+{
+    if((unsigned int)_memory.size() <= _s.AR)
+        return false;
+    if(_loopCheck)
+        _loop.memoryWritten(_s.AR, _memory.at(_s.AR), _s.BR);
+    _memory.write(_s.AR, _s.BR);
+    _memFlags = TrnTrace::MemWrite;
+    _memAddr = _s.AR;
+    _memData = _s.BR;
+    return true;
+}
+
+TrnFastEmu::Status TrnFastEmu::fault()
+{
+    _faultAddr = _s.AR;
+    _status = OutOfBounds;
+    return _status;
+}
+
+// Direct jumps that can close a loop whose body accelerateLoop() understands
+#define LOOP_JUMP(word) (!((word) & 0b110000000000000) && \
+                         ((((word) >> 15) & 0b11111) == TrnOpcodes::JMP || (((word) >> 15) & 0b11111) == TrnOpcodes::JPN || \
+                          (((word) >> 15) & 0b11111) == TrnOpcodes::JAG || (((word) >> 15) & 0b11111) == TrnOpcodes::JPZ || \
+                          (((word) >> 15) & 0b11111) == TrnOpcodes::JIG))
+
+// Only called in the execute phase, when PC already points past the jump
+inline bool TrnFastEmu::branch(bool taken)
+{
+    if(_coverage)
+        _coverage->markBranch(_s.PC - 1, taken);
+    return taken;
+}
+
+// The usual scheme: each address gets a scrambled location, and an edge is the previous one shifted XOR the current one,
+// so that A to B and B to A, as well as tight loops of A to A, end up in different counters
+inline void TrnFastEmu::markEdge(quint16 addr)
+{
+    quint16 loc = (addr * 40503u) & (EdgeMapSize - 1);
+    quint8& c = _edges[loc ^ _prevFetch];
+    if(c != 0xFF)
+        c++;
+    _prevFetch = loc >> 1;
+}
+
+void TrnFastEmu::cycleEnd()
+{
+    _s.SC = 0;
+    _s.Z = !(_s.A & 0b11111111111111111111);
+    _s.S = !!(_s.A & 0b10000000000000000000);
+    _s.V = _s.overflow;
+}
+
+TrnState TrnFastEmu::state() const
+{
+    TrnState s(_s);
+    s.memory = _memory.toVector();
+    return s;
+}
+
+QString TrnFastEmu::statusName(Status st)
+{
+    switch(st)
+    {
+        case Halted:
+            return "halted";
+        case WaitingForInput:
+            return "needs more input";
+        case OutOfBounds:
+            return "out of bounds";
+        case InfiniteLoop:
+            return "infinite loop";
+        default:
+            return "instruction limit";
+    }
+}
+
+TrnFastEmu::Status TrnFastEmu::runCycle()
+{
+    if(!_trace)
+        return executeCycle();
+
+    TrnTrace::Registers before;
+    TrnTrace::fromState(_s, before);
+    quint32 clock = _s.CLOCK;
+    _memFlags = 0;
+    Status st = executeCycle();
+    // Nothing was executed if it stopped to wait for input, or had already stopped
+    if(_s.CLOCK == clock)
+        return st;
+    TrnTrace::Registers after;
+    TrnTrace::fromState(_s, after);
+    _trace->recordCycle(before, after, _memFlags, _memAddr, _memData, st != Running);
+    return st;
+}
+
+TrnFastEmu::Status TrnFastEmu::executeCycle()
+{
+    if(_status != Running && _status != WaitingForInput)
+        return _status;
+
+    quint8 opcode = (_s.IR >> 15) & 0b11111;
+
+    // Don't start the execute phase of an INP until there is something to read
+    if(_s.F == 0b11 && opcode == TrnOpcodes::INP && !(_s.IR & 0b1) && _inputPos >= _inputs.size())
+    {
+        _status = WaitingForInput;
+        return _status;
+    }
+    _status = Running;
+
+    tick();
+    switch(_s.F)
+    {
+        case 0b00:
+            _s.AR = _s.PC;
+            phaseEnd();
+
+            tick();
+            if(!read())
+                return fault();
+            if(_coverage)
+                _coverage->markExecuted(_s.AR);
+            if(_edges)
+                markEdge(_s.AR);
+            _s.PC++;
+            phaseEnd();
+
+            tick();
+            _s.IR = _s.BR;
+            _s.AR = _s.BR & 0b1111111111111;
+            phaseEnd();
+
+            tick();
+            if(_s.IR & 0b10000000000000)
+                _s.F = 0b01;
+            else if(_s.IR & 0b100000000000000)
+                _s.F = 0b10;
+            else
+                _s.F = 0b11;
+            break;
+
+        case 0b01:
+            _s.AR = (_s.IR & 0b1111111111111) + _s.I;
+            if(_s.IR & 0b100000000000000)
+                _s.F = 0b10;
+            else
+                _s.F = 0b11;
+            break;
+
+        case 0b10:
+            if(!read())
+                return fault();
+            phaseEnd();
+
+            tick();
+            _s.AR = _s.BR & 0b1111111111111;
+            _s.F = 0b11;
+            break;
+
+        case 0b11:
+            switch(opcode)
+            {
+                case TrnOpcodes::NOP:
+                    break;
+
+                case TrnOpcodes::LDA:
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.A = _s.BR;
+                    break;
+
+                case TrnOpcodes::LDX:
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.X = _s.BR;
+                    break;
+
+                case TrnOpcodes::LDI:
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.I = _s.BR & 0b1111111111111;
+                    break;
+
+                case TrnOpcodes::STA:
+                    _s.BR = _s.A;
+                    phaseEnd();
+                    tick();
+                    if(!write())
+                        return fault();
+                    break;
+
+                case TrnOpcodes::STX:
+                    _s.BR = _s.X;
+                    phaseEnd();
+                    tick();
+                    if(!write())
+                        return fault();
+                    break;
+
+                case TrnOpcodes::STI:
+                    _s.BR &= (_s.I & 0b1111111111111);
+                    phaseEnd();
+                    tick();
+                    if(!write())
+                        return fault();
+                    break;
+
+                case TrnOpcodes::ENA:
+                    _s.A = _s.IR & 0b1111111111111;
+                    if(_s.A & 0b1000000000000)
+                        _s.A |= 0b11111110000000000000;
+                    phaseEnd();
+                    break;
+
+                case TrnOpcodes::PSH:
+                    _s.SP++;
+                    _s.BR = _s.A;
+                    phaseEnd();
+                    tick();
+                    _s.AR = _s.SP;
+                    phaseEnd();
+                    tick();
+                    if(!write())
+                        return fault();
+                    break;
+
+                case TrnOpcodes::POP:
+                    _s.AR = _s.SP;
+                    phaseEnd();
+                    tick();
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.A = _s.BR;
+                    _s.SP--;
+                    break;
+
+                case TrnOpcodes::INA:
+                    switch(_s.IR & 0b111)
+                    {
+                        case TrnEmu::INA:
+                        {
+                            bool firstsign = _s.A & 0b10000000000000000000;
+                            _s.A = (_s.A + 1) & 0b11111111111111111111;
+                            if(firstsign == false && (_s.A & 0b10000000000000000000) != firstsign)
+                                _s.overflow = true;
+                            else
+                                _s.overflow = false;
+                            break;
+                        }
+                        case TrnEmu::INX:
+                            _s.X = (_s.X + 1) & 0b11111111111111111111;
+                            break;
+                        case TrnEmu::INI:
+                            _s.I++;
+                            break;
+                        case TrnEmu::DCA:
+                        {
+                            bool firstsign = _s.A & 0b10000000000000000000;
+                            _s.A = (_s.A - 1) & 0b11111111111111111111;
+                            if(firstsign == true && (_s.A & 0b10000000000000000000) != firstsign)
+                                _s.overflow = true;
+                            else
+                                _s.overflow = false;
+                            break;
+                        }
+                        case TrnEmu::DCX:
+                            _s.X = (_s.X - 1) & 0b11111111111111111111;
+                            break;
+                        case TrnEmu::DCI:
+                            _s.I--;
+                            break;
+                        default:
+                            // The encodings left over do nothing, but are worth knowing about
+                            if(!_undefined++)
+                                _undefinedAddr = _s.PC - 1;
+                            break;
+                    }
+                    break;
+
+                case TrnOpcodes::ENI:
+                    _s.I = _s.IR & 0b1111111111111;
+                    break;
+
+                case TrnOpcodes::LSP:
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.SP = _s.BR & 0b1111111111111;
+                    break;
+
+                case TrnOpcodes::ADA:
+                {
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    bool firstsign = _s.A & 0b10000000000000000000;
+                    bool secondsign = _s.BR & 0b10000000000000000000;
+                    _s.A += _s.BR;
+                    if(firstsign == secondsign && (_s.A & 0b10000000000000000000) != firstsign)
+                        _s.overflow = true;
+                    else
+                        _s.overflow = false;
+                    break;
+                }
+
+                case TrnOpcodes::SUB:
+                {
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.BR = ~_s.BR;
+                    bool firstsign = _s.A & 0b10000000000000000000;
+                    bool secondsign = _s.BR & 0b10000000000000000000;
+                    _s.A = (_s.A + 1) & 0b11111111111111111111;
+                    phaseEnd();
+                    tick();
+                    _s.A += _s.BR;
+                    if(firstsign == secondsign && (_s.A & 0b10000000000000000000) != firstsign)
+                        _s.overflow = true;
+                    else
+                        _s.overflow = false;
+                    break;
+                }
+
+                case TrnOpcodes::AND:
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.A &= _s.BR;
+                    break;
+
+                case TrnOpcodes::ORA:
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.A |= _s.BR;
+                    break;
+
+                case TrnOpcodes::XOR:
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.A ^= _s.BR;
+                    break;
+
+                case TrnOpcodes::CMA:
+                    _s.A = (~_s.A) & 0b11111111111111111111;
+                    break;
+
+                case TrnOpcodes::JMP:
+                    _s.PC = _s.BR & 0b1111111111111;
+                    break;
+
+                case TrnOpcodes::JPN:
+                    if(branch(_s.S))
+                        _s.PC = _s.BR & 0b1111111111111;
+                    break;
+
+                case TrnOpcodes::JAG:
+                    if(branch(!(_s.S || _s.Z)))
+                        _s.PC = _s.BR & 0b1111111111111;
+                    break;
+
+                case TrnOpcodes::JPZ:
+                    if(branch(_s.Z))
+                        _s.PC = _s.BR & 0b1111111111111;
+                    break;
+
+                case TrnOpcodes::JPO:
+                    if(branch(_s.V))
+                    {
+                        _s.PC = _s.BR & 0b1111111111111;
+                        _s.V = 0;
+                    }
+                    break;
+
+                case TrnOpcodes::JSR:
+                    _s.SP++;
+                    phaseEnd();
+                    // Same clock cycle, just like TrnEmu
+                    _s.AR = _s.SP;
+                    _s.BR &= ~0b1111111111111;
+                    _s.BR |= _s.PC & 0b1111111111111;
+                    phaseEnd();
+                    tick();
+                    if(!write())
+                        return fault();
+                    _s.PC = _s.IR & 0b1111111111111;
+                    // The JSR itself is the caller's
+                    if(_profiler)
+                        _profiler->call(_s.PC, _s.BR & 0b1111111111111, _s.AR, _s.CLOCK);
+                    break;
+
+                case TrnOpcodes::JIG:
+                    if(branch((_s.I & 0b01111111111111111111) > 0 && (_s.I & 0b10000000000000000000) == 0))
+                        _s.PC = _s.BR & 0b1111111111111;
+                    break;
+
+                case TrnOpcodes::SHAL:
+                    switch(_s.IR & 0b11)
+                    {
+                        case 0b00:
+                            _s.A <<= 1;
+                            break;
+                        case 0b01:
+                            _s.A >>= 1;
+                            break;
+                        case 0b10:
+                            _s.X <<= 1;
+                            break;
+                        case 0b11:
+                            _s.X >>= 1;
+                            break;
+                    }
+                    break;
+
+                case TrnOpcodes::SSP:
+                    _s.BR &= ~0b1111111111111;
+                    _s.BR |= _s.SP & 0b1111111111111;
+                    phaseEnd();
+                    tick();
+                    if(!write())
+                        return fault();
+                    break;
+
+                case TrnOpcodes::SAXL:
+                {
+                    quint64 axregs = ((quint64)_s.X & 0b11111111111111111111) | ((((quint64)_s.A) & 0b11111111111111111111) << 20);
+                    if(_s.IR & 0b1)
+                        axregs = axregs >> 1;
+                    else
+                        axregs = axregs << 1;
+                    _s.X = axregs & 0b11111111111111111111;
+                    _s.A = (axregs >> 20) & 0b11111111111111111111;
+                    break;
+                }
+
+                case TrnOpcodes::OUT:
+                    if(_s.IR & 0b1)
+                    {
+                        _s.BR = _s.A;
+                        phaseEnd();
+                        tick();
+                        _outputs.append(_s.BR);
+                    }
+                    else
+                    {
+                        _s.BR = _inputs.at(_inputPos++);
+                        phaseEnd();
+                        tick();
+                        _s.A = _s.BR;
+                    }
+                    break;
+
+                case TrnOpcodes::RET:
+                    _s.AR = _s.SP;
+                    phaseEnd();
+                    tick();
+                    if(!read())
+                        return fault();
+                    phaseEnd();
+                    tick();
+                    _s.PC = _s.BR & 0b1111111111111;
+                    _s.SP--;
+                    _s.F = 0b00;
+                    phaseEnd();
+                    tick();
+                    // Whereas the RET is the callee's
+                    if(_profiler)
+                        _profiler->ret(_s.PC, _s.AR, _s.CLOCK);
+                    // The flags are not updated after a RET
+                    _s.SC = 0;
+                    return _status;
+
+                case TrnOpcodes::HLT:
+                    _s.H = 1;
+                    _status = Halted;
+                    return _status;
+            }
+            _s.F = 0b00;
+            break;
+    }
+    cycleEnd();
+    return _status;
+}
+
+TrnFastEmu::Status TrnFastEmu::step()
+{
+    if(_status == Halted || _status == OutOfBounds || _status == InfiniteLoop)
+        return _status;
+
+    Status st;
+    do
+        st = runCycle();
+    while(st == Running && _s.F != 0b00);
+
+    // A halt also counts as a completed instruction
+    if(st == Running || st == Halted)
+        _retired++;
+
+    if(st == Running && _loopCheck)
+    {
+        TrnTrace::Registers regs;
+        TrnTrace::fromState(_s, regs);
+        if(_loop.check(regs, _inputPos, _memory))
+        {
+            _status = InfiniteLoop;
+            return _status;
+        }
+    }
+    return st;
+}
+
+void TrnFastEmu::setLoopDetection(bool enabled)
+{
+    _loopCheck = enabled;
+    if(enabled)
+        _loop.reset(_memory);
+}
+
+quint16 TrnFastEmu::loopLowestAddress() const
+{
+    // Goes around once more on a copy, which ends up back in this state, and nothing gets reported while it does
+    TrnFastEmu e(*this);
+    e._status = Running;
+    e._loopCheck = false;
+    e._accelerate = false;
+    e._trace = nullptr;
+    e._coverage = nullptr;
+    e._profiler = nullptr;
+    e._edges = nullptr;
+    quint16 lowest = _s.PC;
+    for(quint64 n = 0; n < _loop.period() && e.step() == Running; n++)
+        lowest = qMin(lowest, e._s.PC);
+    return lowest;
+}
+
+TrnFastEmu::Status TrnFastEmu::run(quint64 maxInstructions)
+{
+    Status st = _status;
+    const quint64 end = (maxInstructions > ~_retired ? ~0ULL : _retired + maxInstructions);
+    while(_retired < end)
+    {
+        // Only meaningful at an instruction boundary, which is anywhere but in the middle of an INP
+        bool boundary = (_s.F == 0b00);
+        quint16 pc = _s.PC;
+        st = step();
+        if(st != Running)
+            break;
+
+        // A backward jump that was taken closes a loop, which might be one that can be skipped over
+        // Not while counting edges, as every trip around the loop counts
+        if(_accelerate && !_trace && !_edges && boundary && _s.PC <= pc && LOOP_JUMP(_s.IR))
+            accelerateLoop(_s.PC, pc, end - _retired);
+    }
+    return st;
+}
+
+bool TrnFastEmu::isPureLoopBody(quint16 first, quint16 last) const
+{
+    if(last - first + 1 > MaxLoopBody || last >= _memory.size())
+        return false;
+    for(int addr = first; addr <= last; addr++)
+    {
+        quint32 word = _memory.at(addr);
+        if(LOOP_JUMP(word))
+            continue;
+        // Indexed and indirect references read memory
+        if(word & 0b110000000000000)
+            return false;
+        quint8 opcode = (word >> 15) & 0b11111;
+        if(opcode != TrnOpcodes::NOP && !(opcode == TrnOpcodes::INA && (word & 0b111) <= TrnEmu::DCI))
+            return false;
+    }
+    return true;
+}
+
+// Values of A that behave the same in a loop body: Z and S don't change within each range,
+// and INA/DCA only overflow when crossing from one to the other
+static inline void regionOfA(qint64 a, qint64& lo, qint64& hi)
+{
+    if(a == 0)
+        lo = hi = 0;
+    else if(a < 0b10000000000000000000)
+    {
+        lo = 1;
+        hi = 0b01111111111111111111;
+    }
+    else
+    {
+        lo = 0b10000000000000000000;
+        hi = 0b11111111111111111111;
+    }
+}
+
+// Likewise for I, which only matters to JIG
+static inline void regionOfI(qint64 i, qint64& lo, qint64& hi)
+{
+    lo = hi = 0;
+    if(i)
+    {
+        lo = 1;
+        hi = 0xFFFF;
+    }
+}
+
+// How many iterations can start at v and change it by d each, without any of the values
+// it takes within an iteration (v + minOff to v + maxOff) leaving [lo, hi]
+static quint64 iterationsWithin(qint64 v, qint64 minOff, qint64 maxOff, qint64 d, qint64 lo, qint64 hi)
+{
+    if(v + minOff < lo || v + maxOff > hi)
+        return 0;
+    if(d > 0)
+        return (hi - v - maxOff) / d + 1;
+    if(d < 0)
+        return (v + minOff - lo) / -d + 1;
+    return ~0ULL;
+}
+
+void TrnFastEmu::accelerateLoop(quint16 head, quint16 last, quint64 budget)
+{
+    if(!isPureLoopBody(head, last))
+        return;
+
+    // Execute one more iteration normally and see what it does
+    // If anything other than A, X and I (and the clock) changes, or if A or I cross over into a range
+    // where the flags or the jumps would behave differently, this isn't a simple counting loop
+    const TrnState before = _s;
+    const quint64 start = _retired;
+    qint64 alo, ahi, ilo, ihi;
+    regionOfA(before.A, alo, ahi);
+    regionOfI(before.I, ilo, ihi);
+    qint64 minA = 0, maxA = 0, minI = 0, maxI = 0;
+    do
+    {
+        if(_retired - start >= budget || step() != Running)
+            return;
+        if(_s.PC < head || _s.PC > last || _retired - start > MaxLoopBody)
+            return;
+        if(_s.A < alo || _s.A > ahi || _s.I < ilo || _s.I > ihi)
+            return;
+        minA = qMin(minA, (qint64)_s.A - before.A);
+        maxA = qMax(maxA, (qint64)_s.A - before.A);
+        minI = qMin(minI, (qint64)_s.I - before.I);
+        maxI = qMax(maxI, (qint64)_s.I - before.I);
+    }
+    while(_s.PC != head || _s.F != 0b00);
+
+    if(_s.BR != before.BR || _s.IR != before.IR || _s.SP != before.SP || _s.AR != before.AR || _s.SC != before.SC ||
+       _s.V != before.V || _s.Z != before.Z || _s.S != before.S || _s.H != before.H || _s.overflow != before.overflow)
+        return;
+
+    const quint64 length = _retired - start;
+    const qint64 dA = (qint64)_s.A - before.A;
+    const qint64 dI = (qint64)_s.I - before.I;
+    // Loops that don't count anything never end, which is for the loop detector to find out
+    if(!dA && !dI)
+        return;
+
+    // Every iteration from here on is identical as long as A and I stay within their ranges
+    quint64 n = (budget - length) / length;
+    n = qMin(n, iterationsWithin(_s.A, minA, maxA, dA, alo, ahi));
+    n = qMin(n, iterationsWithin(_s.I, minI, maxI, dI, ilo, ihi));
+    if(!n)
+        return;
+
+    // n is less than 2^20 here, so none of this can overflow
+    _s.A += n * dA;
+    _s.I += n * dI;
+    _s.X = (_s.X + n * ((_s.X - before.X) & 0b11111111111111111111)) & 0b11111111111111111111;
+    _s.CLOCK += n * (_s.CLOCK - before.CLOCK);
+    _retired += n * length;
+    _accelerated += n * length;
+}
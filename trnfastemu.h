@@ -0,0 +1,120 @@
+#ifndef TRNFASTEMU_H
+#define TRNFASTEMU_H
+#include <QVector>
+#include <QString>
+#include "trnstate.h"
+#include "trnloopdetector.h"
+#include "trnpagedmemory.h"
+
+class TrnTraceWriter;
+class TrnCoverage;
+class TrnProfiler;
+
+// Headless TRN+ engine
+// It executes the exact same phases as TrnEmu, but without any signals, logging or sleeping,
+// so it can be used for batch runs and as an alternative engine for the conformance harness
+class TrnFastEmu
+{
+public:
+    explicit TrnFastEmu(const QVector<quint32>& pgm);
+    typedef enum {
+        Running,
+        Halted,
+        WaitingForInput, // Stopped right before the execute phase of an INP. Resumes once input is available
+        OutOfBounds,
+        InfiniteLoop, // Came back to a state it had already been in, see setLoopDetection()
+    } Status;
+    enum {
+        // Counters in an edge map, see setEdgeMap()
+        EdgeMapSize = 1 << 14,
+    };
+
+    // Executes a single F cycle (fetch, indexed, indirect or execute)
+    Status runCycle();
+    // Executes cycles until the current instruction has finished
+    Status step();
+    // Executes up to maxInstructions instructions
+    Status run(quint64 maxInstructions);
+
+    // How a run ended, as written in tables
+    static QString statusName(Status st);
+
+    // A copy of the whole state, memory included
+    TrnState state() const;
+    // The registers only, without the memory, which is much cheaper
+    inline const TrnState& registers() const { return _s; }
+    inline const TrnPagedMemory& memory() const { return _memory; }
+    inline Status status() const { return _status; }
+    inline quint64 instructionsRetired() const { return _retired; }
+    inline quint32 faultAddress() const { return _faultAddr; }
+
+    inline void appendInput(quint32 input) { _inputs.append(input); }
+    inline void setInputQueue(const QVector<quint32>& inputs) { _inputs = inputs; _inputPos = 0; }
+    inline const QVector<quint32>& outputs() const { return _outputs; }
+
+    // Every cycle from here on is recorded. The writer must have been started with the current state
+    inline void setTraceWriter(TrnTraceWriter* w) { _trace = w; }
+    // Marks every instruction fetched and every conditional jump taken or not from here on
+    inline void setCoverage(TrnCoverage* c) { _coverage = c; }
+    // Reports every JSR and RET from here on. The profiler must have been started with the current PC and clock
+    inline void setProfiler(TrnProfiler* p) { _profiler = p; }
+    // Counts every transition from one fetched instruction to the next into a map of EdgeMapSize hashed counters,
+    // which saturate at 255. The map must be zeroed by the caller
+    inline void setEdgeMap(quint8* map) { _edges = map; _prevFetch = 0; }
+    // How many times one of the INA encodings that don't exist was executed, and the address of the first one
+    inline quint64 undefinedInstructions() const { return _undefined; }
+    inline quint16 firstUndefinedAddress() const { return _undefinedAddr; }
+    // Stops with InfiniteLoop once the program can provably never halt
+    void setLoopDetection(bool enabled);
+    // The number of instructions the loop takes to go around once
+    inline quint64 loopPeriod() const { return _loop.period(); }
+    // The lowest address the loop goes through, which is the same wherever it was found
+    quint16 loopLowestAddress() const;
+    // Lets run() skip whole iterations of simple counting loops (like DCI/JIG countdowns) instead of executing them
+    // The result is exactly the same as executing them. It is never used while a trace or an edge map is being recorded
+    inline void setLoopAcceleration(bool enabled) { _accelerate = enabled; }
+    // How many of the instructions retired were skipped that way
+    inline quint64 instructionsAccelerated() const { return _accelerated; }
+
+private:
+    enum {
+        // Longest loop body, in words, that accelerateLoop() looks at
+        MaxLoopBody = 32,
+    };
+    // Everything but the memory, which is kept in _memory instead
+    TrnState _s;
+    TrnPagedMemory _memory;
+    Status _status;
+    quint64 _retired;
+    quint32 _faultAddr;
+    QVector<quint32> _inputs;
+    int _inputPos;
+    QVector<quint32> _outputs;
+    TrnTraceWriter* _trace;
+    quint8 _memFlags;
+    quint16 _memAddr;
+    quint32 _memData;
+    TrnCoverage* _coverage;
+    TrnProfiler* _profiler;
+    quint8* _edges;
+    quint16 _prevFetch;
+    quint64 _undefined;
+    quint16 _undefinedAddr;
+    bool _loopCheck;
+    TrnLoopDetector _loop;
+    bool _accelerate;
+    quint64 _accelerated;
+    Status executeCycle();
+    inline void tick() { _s.CLOCK++; }
+    inline void phaseEnd() { _s.SC++; }
+    void cycleEnd();
+    bool read();
+    bool write();
+    Status fault();
+    bool branch(bool taken);
+    void markEdge(quint16 addr);
+    bool isPureLoopBody(quint16 first, quint16 last) const;
+    void accelerateLoop(quint16 head, quint16 last, quint64 budget);
+};
+
+#endif // TRNFASTEMU_H
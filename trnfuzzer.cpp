@@ -0,0 +1,338 @@
+#include "trnfuzzer.h"
+#include "trnfastemu.h"
+#include "trnopcodes.h"
+#include <QThread>
+#include <QMutexLocker>
+#include <QStringList>
+#include <algorithm>
+#include <cstring>
+
+// Only there to give every worker its own thread
+class TrnFuzzerWorker : public QThread
+{
+public:
+    TrnFuzzerWorker(TrnFuzzer* fuzzer, quint32 seed) : QThread(), _fuzzer(fuzzer), _seed(seed) {}
+protected:
+    void run() { _fuzzer->work(_seed); }
+private:
+    TrnFuzzer* _fuzzer;
+    quint32 _seed;
+};
+
+// Values that tend to be on one side or the other of a comparison
+static const quint32 interestingValues[] = {
+    0, 1, 2, 3, 7, 8, 10, 16, 100, 255, 256, 1000,
+    0b1111111111111, 0b1000000000000, 0b10000000000000, // Around the 13 bit addresses
+    0b01111111111111111111, 0b10000000000000000000, 0b11111111111111111111, // The largest, the smallest and -1
+};
+
+// AFL style hit count buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127 and 128-255
+static inline quint8 bucket(quint8 count)
+{
+    if(count <= 3)
+        return count ? 1 << (count - 1) : 0;
+    if(count < 8)
+        return 1 << 3;
+    if(count < 16)
+        return 1 << 4;
+    if(count < 32)
+        return 1 << 5;
+    if(count < 128)
+        return 1 << 6;
+    return 1 << 7;
+}
+
+TrnFuzzer::TrnFuzzer(const QVector<quint32>& pgm, quint64 maxInstructions, quint32 seed) :
+    _pgm(pgm), _maxInstructions(maxInstructions), _seed(seed), _seeds(), _corpus(), _seen(TrnFastEmu::EdgeMapSize, 0), _edges(0),
+    _findings(), _signatures(), _nextRun(0), _runs(0)
+{
+}
+
+void TrnFuzzer::addSeed(const QVector<quint32>& inputs)
+{
+    _seeds.append(inputs.mid(0, MaxInputs));
+}
+
+void TrnFuzzer::run(quint64 runs, int threads)
+{
+    // The seeds are always in the corpus, whether they find anything new or not
+    QVector<QVector<quint32>> seeds = _seeds;
+    if(seeds.isEmpty())
+        seeds.append(QVector<quint32>());
+    QVector<quint8> edges(TrnFastEmu::EdgeMapSize);
+    for(const QVector<quint32>& s : seeds)
+    {
+        memset(edges.data(), 0, edges.size());
+        Result r = execute(s, edges.data());
+        addCoverage(edges.data());
+        if(r.found)
+            report(s, r, edges.data());
+        else
+            _corpus.append(s);
+    }
+    // Every seed crashed, so start from scratch
+    if(_corpus.isEmpty())
+        _corpus.append(QVector<quint32>());
+
+    _runs = runs;
+    _nextRun = 0;
+    threads = qMax(threads, 1);
+    QVector<TrnFuzzerWorker*> workers;
+    for(int i = 1; i < threads; i++)
+    {
+        workers.append(new TrnFuzzerWorker(this, _seed + i));
+        workers.last()->start();
+    }
+    work(_seed);
+    for(TrnFuzzerWorker* w : workers)
+    {
+        w->wait();
+        delete w;
+    }
+
+    std::sort(_findings.begin(), _findings.end(), [](const Finding& a, const Finding& b) {
+        return a.kind != b.kind ? a.kind < b.kind : a.addr < b.addr;
+    });
+}
+
+void TrnFuzzer::work(quint32 seed)
+{
+    std::mt19937 rng(seed);
+    QVector<quint8> edges(TrnFastEmu::EdgeMapSize);
+    while(_nextRun.fetch_add(1, std::memory_order_relaxed) < _runs)
+    {
+        QVector<quint32> parent, other;
+        {
+            QMutexLocker l(&_lock);
+            parent = _corpus.at(rng() % _corpus.size());
+            other = _corpus.at(rng() % _corpus.size());
+        }
+        QVector<quint32> inputs = mutate(parent, other, rng);
+
+        memset(edges.data(), 0, edges.size());
+        Result r = execute(inputs, edges.data());
+        if(r.found)
+            report(inputs, r, edges.data());
+        else
+        {
+            QMutexLocker l(&_lock);
+            if(addCoverage(edges.data()))
+                _corpus.append(inputs);
+        }
+    }
+}
+
+// Whether the instruction that faulted is PSH, POP, JSR or RET, the ones accessing memory at SP
+// A fault while fetching leaves the previous instruction in IR, so only the execute phase counts
+static bool stackAccess(const TrnState& s)
+{
+    if(s.F != 0b11)
+        return false;
+    switch((s.IR >> 15) & 0b11111)
+    {
+        case TrnOpcodes::PSH:
+        case TrnOpcodes::POP:
+        case TrnOpcodes::JSR:
+        case TrnOpcodes::RET:
+            return true;
+        default:
+            return false;
+    }
+}
+
+TrnFuzzer::Result TrnFuzzer::execute(const QVector<quint32>& inputs, quint8* edges) const
+{
+    TrnFastEmu emu(_pgm);
+    emu.setInputQueue(inputs);
+    emu.setEdgeMap(edges);
+    // No loop acceleration, the edge map needs the hit count of every trip around a loop
+    emu.setLoopDetection(true);
+    TrnFastEmu::Status st = emu.run(_maxInstructions);
+
+    // Only the registers, so the memory doesn't have to be put back together on every run
+    const TrnState& s = emu.registers();
+    switch(st)
+    {
+        case TrnFastEmu::OutOfBounds:
+            return Result{true, stackAccess(s) ? StackRunaway : OutOfBounds, emu.faultAddress()};
+        case TrnFastEmu::InfiniteLoop:
+            // Where it was caught depends on the inputs before it, so the loop is known by its lowest address instead
+            return Result{true, InfiniteLoop, emu.loopLowestAddress()};
+        case TrnFastEmu::Running:
+            return Result{true, Timeout, s.PC};
+        default:
+            break;
+    }
+
+    // Halted, or ran out of inputs, which is where the input sequence ends and not a problem
+    if(emu.undefinedInstructions())
+        return Result{true, UndefinedInstruction, emu.firstUndefinedAddress()};
+    return Result{false, OutOfBounds, 0};
+}
+
+// Must be called with the lock held, or before the workers start
+bool TrnFuzzer::addCoverage(const quint8* edges)
+{
+    bool found = false;
+    for(int i = 0; i < TrnFastEmu::EdgeMapSize; i++)
+    {
+        if(!edges[i])
+            continue;
+        quint8 b = bucket(edges[i]);
+        if(b & ~_seen[i])
+        {
+            if(!_seen[i])
+                _edges++;
+            _seen[i] |= b;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void TrnFuzzer::report(const QVector<quint32>& inputs, const Result& r, quint8* edges)
+{
+    // Where a timeout stops depends on how far the inputs got it, so they are all the same finding
+    const quint64 signature = (quint64)r.kind << 32 | (r.kind == Timeout ? 0 : r.addr);
+    {
+        QMutexLocker l(&_lock);
+        if(_signatures.contains(signature))
+            return;
+        // Claimed before minimizing, so no other worker spends time on the same one
+        _signatures.insert(signature);
+    }
+    Finding f = {r.kind, r.addr, minimize(inputs, r, edges)};
+    QMutexLocker l(&_lock);
+    _findings.append(f);
+}
+
+QVector<quint32> TrnFuzzer::minimize(QVector<quint32> inputs, const Result& r, quint8* edges) const
+{
+    int budget = MinimizeRuns;
+    auto reproduces = [&](const QVector<quint32>& candidate) {
+        budget--;
+        memset(edges, 0, TrnFastEmu::EdgeMapSize);
+        Result c = execute(candidate, edges);
+        return c.found && c.kind == r.kind && (r.kind == Timeout || c.addr == r.addr);
+    };
+
+    // Fewer inputs first, from the end, as the ones at the end are the most likely not to be read at all
+    for(int i = inputs.size() - 1; i >= 0 && budget > 0; i--)
+    {
+        QVector<quint32> candidate = inputs;
+        candidate.remove(i);
+        if(reproduces(candidate))
+            inputs = candidate;
+    }
+    // Then smaller values, down to 0 if possible
+    for(int i = 0; i < inputs.size() && budget > 0; i++)
+    {
+        while(inputs.at(i) && budget > 0)
+        {
+            QVector<quint32> candidate = inputs;
+            candidate[i] = 0;
+            if(reproduces(candidate))
+            {
+                inputs = candidate;
+                break;
+            }
+            // Halving keeps the magnitude of small values, clearing the lowest bit keeps the sign of negative ones
+            candidate[i] = inputs.at(i) / 2;
+            if(!reproduces(candidate))
+            {
+                candidate[i] = inputs.at(i) & (inputs.at(i) - 1);
+                if(!reproduces(candidate))
+                    break;
+            }
+            inputs = candidate;
+        }
+    }
+    return inputs;
+}
+
+QVector<quint32> TrnFuzzer::mutate(QVector<quint32> inputs, const QVector<quint32>& other, std::mt19937& rng) const
+{
+    const int interesting = sizeof(interestingValues) / sizeof(interestingValues[0]);
+    // A few mutations stacked on top of each other
+    int count = 1 << (rng() % 3);
+    for(int n = 0; n < count; n++)
+    {
+        int op = rng() % 8;
+        // Everything else needs a value to work on
+        if(inputs.isEmpty() && op != 7)
+            op = 4;
+        int i = inputs.isEmpty() ? 0 : rng() % inputs.size();
+        switch(op)
+        {
+            case 0:
+                inputs[i] ^= 1 << (rng() % 20);
+                break;
+            case 1:
+                inputs[i] = interestingValues[rng() % interesting];
+                break;
+            case 2:
+            {
+                quint32 delta = 1 + rng() % 35;
+                inputs[i] = (rng() % 2 ? inputs.at(i) + delta : inputs.at(i) - delta) & 0b11111111111111111111;
+                break;
+            }
+            case 3:
+                inputs[i] = rng() & 0b11111111111111111111;
+                break;
+            case 4:
+                if(inputs.size() < MaxInputs)
+                    inputs.insert(inputs.isEmpty() ? 0 : rng() % (inputs.size() + 1),
+                                  rng() % 2 ? interestingValues[rng() % interesting] : rng() & 0b11111111111111111111);
+                break;
+            case 5:
+                inputs.remove(i);
+                break;
+            case 6:
+                if(inputs.size() < MaxInputs)
+                    inputs.insert(i, inputs.at(i));
+                break;
+            case 7:
+                // The start of this one, and the rest of another
+                if(!other.isEmpty())
+                {
+                    int split = rng() % (other.size() + 1);
+                    inputs.resize(qMin(split, inputs.size()));
+                    inputs += other.mid(split);
+                }
+                break;
+        }
+    }
+    return inputs;
+}
+
+QString TrnFuzzer::kindName(FindingKind kind)
+{
+    switch(kind)
+    {
+        case OutOfBounds:
+            return "out of bounds access";
+        case StackRunaway:
+            return "stack runaway";
+        case UndefinedInstruction:
+            return "undefined instruction";
+        case InfiniteLoop:
+            return "infinite loop";
+        default:
+            return "timeout";
+    }
+}
+
+void TrnFuzzer::writeReport(QTextStream& out, const AsmSymbolTable& symbols) const
+{
+    out << _runs << " runs, " << _corpus.size() << " inputs in the corpus, " << _edges << " edges\n";
+    out << _findings.size() << " findings\n";
+    for(const Finding& f : _findings)
+    {
+        QString label = symbols.labelAt(f.addr);
+        QStringList inputs;
+        for(quint32 v : f.inputs)
+            inputs << QString::number(v);
+        out << kindName(f.kind) << " at " << f.addr << (label.isEmpty() ? QString() : QString(" (%1)").arg(label))
+            << ", inputs: " << (inputs.isEmpty() ? QString("none") : inputs.join(QChar(','))) << "\n";
+    }
+}
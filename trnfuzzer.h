@@ -0,0 +1,80 @@
+#ifndef TRNFUZZER_H
+#define TRNFUZZER_H
+#include <QVector>
+#include <QSet>
+#include <QMutex>
+#include <QTextStream>
+#include <atomic>
+#include <random>
+#include "asmsymboltable.h"
+
+// Looks for input sequences that make a program misbehave
+// Inputs are mutated from a corpus, and one is kept in the corpus if it reached a PC to PC edge (or an edge a number
+// of times) that no input before it had. Every distinct finding is minimized before it is reported
+class TrnFuzzer
+{
+public:
+    typedef enum {
+        OutOfBounds, // A memory access past the end of memory
+        StackRunaway, // Likewise, but at SP, which is where a runaway recursion or a stack underflow ends up
+        UndefinedInstruction, // Executed one of the INA encodings that don't exist, which do nothing
+        InfiniteLoop, // At the lowest address the loop goes through
+        Timeout, // Still running after the maximum number of instructions. There is only ever one of these
+    } FindingKind;
+
+    typedef struct {
+        FindingKind kind;
+        // Where it went wrong: the address accessed, the instruction, the loop, or PC when it was stopped
+        quint32 addr;
+        QVector<quint32> inputs;
+    } Finding;
+
+    enum {
+        // Longest input sequence the mutations build
+        MaxInputs = 64,
+        // Runs spent on minimizing each finding, at most
+        MinimizeRuns = 4096,
+    };
+
+    TrnFuzzer(const QVector<quint32>& pgm, quint64 maxInstructions, quint32 seed);
+    // Inputs to start the corpus with. Without any, it starts from no inputs at all
+    void addSeed(const QVector<quint32>& inputs);
+    // Blocks until all the runs are done
+    void run(quint64 runs, int threads);
+    inline const QVector<Finding>& findings() const { return _findings; }
+    void writeReport(QTextStream& out, const AsmSymbolTable& symbols) const;
+
+    // Called by the worker threads
+    void work(quint32 seed);
+
+private:
+    typedef struct {
+        bool found;
+        FindingKind kind;
+        quint32 addr;
+    } Result;
+
+    QVector<quint32> _pgm;
+    quint64 _maxInstructions;
+    quint32 _seed;
+    QVector<QVector<quint32>> _seeds;
+    // Everything below is shared by the workers, under the lock
+    QMutex _lock;
+    QVector<QVector<quint32>> _corpus;
+    // For every edge, a bit for every hit count bucket any input has reached so far
+    QVector<quint8> _seen;
+    int _edges;
+    QVector<Finding> _findings;
+    QSet<quint64> _signatures;
+    std::atomic<quint64> _nextRun;
+    quint64 _runs;
+
+    Result execute(const QVector<quint32>& inputs, quint8* edges) const;
+    bool addCoverage(const quint8* edges);
+    void report(const QVector<quint32>& inputs, const Result& r, quint8* edges);
+    QVector<quint32> mutate(QVector<quint32> inputs, const QVector<quint32>& other, std::mt19937& rng) const;
+    QVector<quint32> minimize(QVector<quint32> inputs, const Result& r, quint8* edges) const;
+    static QString kindName(FindingKind kind);
+};
+
+#endif // TRNFUZZER_H
@@ -0,0 +1,66 @@
+#ifndef TRNHEATMAP_H
+#define TRNHEATMAP_H
+#include <QtGlobal>
+#include <atomic>
+
+// Per address memory read and write counters
+// The emulator thread is the only one that ever writes to them, so an increment is just a plain load and store,
+// while the GUI can read them at any time without locking
+class TrnHeatMap
+{
+public:
+    TrnHeatMap() : _reads(nullptr), _writes(nullptr), _size(0) {}
+    ~TrnHeatMap()
+    {
+        delete[] _reads;
+        delete[] _writes;
+    }
+
+    // Clears all counters. Must not be called while an emulator is counting
+    void reset(int size)
+    {
+        if(size != _size)
+        {
+            delete[] _reads;
+            delete[] _writes;
+            _reads = new std::atomic<quint32>[size];
+            _writes = new std::atomic<quint32>[size];
+            _size = size;
+        }
+        for(int i = 0; i < _size; i++)
+        {
+            _reads[i].store(0, std::memory_order_relaxed);
+            _writes[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    inline int size() const { return _size; }
+    // The address must already have been bounds checked against the memory, which is the same size
+    inline void countRead(int addr) { increment(_reads[addr]); }
+    inline void countWrite(int addr) { increment(_writes[addr]); }
+    inline quint32 reads(int addr) const { return _reads[addr].load(std::memory_order_relaxed); }
+    inline quint32 writes(int addr) const { return _writes[addr].load(std::memory_order_relaxed); }
+
+    // The highest read or write count of any address
+    quint32 maxCount() const
+    {
+        quint32 m = 0;
+        for(int i = 0; i < _size; i++)
+            m = qMax(m, qMax(reads(i), writes(i)));
+        return m;
+    }
+
+private:
+    std::atomic<quint32>* _reads;
+    std::atomic<quint32>* _writes;
+    int _size;
+    // Saturates instead of wrapping around, so a hot address never suddenly turns cold
+    static inline void increment(std::atomic<quint32>& c)
+    {
+        quint32 v = c.load(std::memory_order_relaxed);
+        if(v != 0xFFFFFFFF)
+            c.store(v + 1, std::memory_order_relaxed);
+    }
+};
+
+#endif // TRNHEATMAP_H
@@ -0,0 +1,646 @@
+#include "trnlaneemu.h"
+#include "trnopcodes.h"
+#include "trnemu.h"
+
+// This mirrors TrnFastEmu::executeCycle() phase by phase, for a group of lanes at a time
+// Everything that depends on IR is the same for every lane in a group, so only the data is per lane
+// Run "bettertrn --conformance" after touching it
+
+// a in the selected lanes, b in the others
+static inline quint32 select(quint32 sel, quint32 a, quint32 b)
+{
+    return (a & sel) | (b & ~sel);
+}
+
+TrnLaneEmu::TrnLaneEmu(const QVector<quint32>& pgm) :
+    _words(pgm.size()), _memory(pgm.size() * Lanes), _steps(0), _laneInstructions(0), _group(0)
+{
+    for(quint32 addr = 0; addr < _words; addr++)
+        for(int l = 0; l < Lanes; l++)
+            _memory[addr * Lanes + l] = pgm.at(addr);
+    for(int l = 0; l < Lanes; l++)
+    {
+        _BR[l] = _A[l] = _X[l] = _IR[l] = _CLOCK[l] = 0;
+        _SP[l] = _I[l] = _PC[l] = _AR[l] = 0;
+        _SC[l] = _F[l] = _V[l] = _Z[l] = _S[l] = _H[l] = _overflow[l] = 0;
+        _status[l] = TrnFastEmu::Running;
+        _retired[l] = 0;
+        _waiting[l] = 0;
+        _faultAddr[l] = 0;
+        _inputPos[l] = 0;
+        _sel[l] = 0;
+    }
+}
+
+TrnState TrnLaneEmu::state(int lane) const
+{
+    TrnState s;
+    s.BR = _BR[lane];
+    s.A = _A[lane];
+    s.X = _X[lane];
+    s.IR = _IR[lane];
+    s.CLOCK = _CLOCK[lane];
+    s.SP = _SP[lane];
+    s.I = _I[lane];
+    s.PC = _PC[lane];
+    s.AR = _AR[lane];
+    s.SC = _SC[lane];
+    s.F = _F[lane];
+    s.V = _V[lane];
+    s.Z = _Z[lane];
+    s.S = _S[lane];
+    s.H = _H[lane];
+    s.overflow = _overflow[lane];
+    s.memory.resize(_words);
+    for(quint32 addr = 0; addr < _words; addr++)
+        s.memory[addr] = _memory.at(addr * Lanes + lane);
+    return s;
+}
+
+bool TrnLaneEmu::step(quint64 maxInstructions)
+{
+    int leader = -1;
+    for(int l = 0; l < Lanes; l++)
+        if(_status[l] == TrnFastEmu::Running && _retired[l] < maxInstructions && (leader < 0 || _PC[l] < _PC[leader]))
+            leader = l;
+    if(leader < 0)
+        return false;
+    // Unless another lane has been waiting for too long, because the ones at lower addresses are in a loop
+    for(int l = 0; l < Lanes; l++)
+        if(_status[l] == TrnFastEmu::Running && _retired[l] < maxInstructions && _waiting[l] > MaxWait && _waiting[l] > _waiting[leader])
+            leader = l;
+
+    // Lanes that wrote over their copy of the instruction have to wait for a group of their own
+    const quint16 pc = _PC[leader];
+    const bool inBounds = pc < _words;
+    const quint32 word = inBounds ? _memory.at(pc * Lanes + leader) : 0;
+    quint32 group = 0;
+    for(int l = 0; l < Lanes; l++)
+        if(_status[l] == TrnFastEmu::Running && _retired[l] < maxInstructions && _PC[l] == pc &&
+           (!inBounds || _memory.at(pc * Lanes + l) == word))
+            group |= 1 << l;
+
+    execute(group, leader);
+
+    // A halt also counts as a completed instruction
+    for(int l = 0; l < Lanes; l++)
+    {
+        if(!(group & (1 << l)))
+        {
+            _waiting[l]++;
+            continue;
+        }
+        _waiting[l] = 0;
+        if(_status[l] != TrnFastEmu::Running && _status[l] != TrnFastEmu::Halted)
+            continue;
+        _retired[l]++;
+        _laneInstructions++;
+    }
+    _steps++;
+    return true;
+}
+
+void TrnLaneEmu::run(quint64 maxInstructions)
+{
+    while(step(maxInstructions))
+        ;
+}
+
+void TrnLaneEmu::tick()
+{
+    for(int l = 0; l < Lanes; l++)
+        _CLOCK[l] += _sel[l] & 1;
+}
+
+void TrnLaneEmu::phaseEnd()
+{
+    for(int l = 0; l < Lanes; l++)
+        _SC[l] += _sel[l] & 1;
+}
+
+void TrnLaneEmu::cycleEnd()
+{
+    for(int l = 0; l < Lanes; l++)
+    {
+        _SC[l] &= ~_sel[l];
+        _Z[l] = select(_sel[l], !(_A[l] & 0b11111111111111111111), _Z[l]);
+        _S[l] = select(_sel[l], !!(_A[l] & 0b10000000000000000000), _S[l]);
+        _V[l] = select(_sel[l], _overflow[l], _V[l]);
+    }
+}
+
+void TrnLaneEmu::fault(int lane)
+{
+    _faultAddr[lane] = _AR[lane];
+    _status[lane] = TrnFastEmu::OutOfBounds;
+    _group &= ~(1 << lane);
+    _sel[lane] = 0;
+}
+
+// Returns false if every lane of the group faulted
+bool TrnLaneEmu::read()
+{
+    for(int l = 0; l < Lanes; l++)
+    {
+        if(!_sel[l])
+            continue;
+        if(_AR[l] >= _words)
+            fault(l);
+        else
+            _BR[l] = _memory.at(_AR[l] * Lanes + l);
+    }
+    return _group;
+}
+
+bool TrnLaneEmu::write()
+{
+    for(int l = 0; l < Lanes; l++)
+    {
+        if(!_sel[l])
+            continue;
+        if(_AR[l] >= _words)
+            fault(l);
+        else
+            _memory[_AR[l] * Lanes + l] = _BR[l];
+    }
+    return _group;
+}
+
+inline void TrnLaneEmu::jumpIf(int lane, bool taken)
+{
+    _PC[lane] = select(_sel[lane] & -(quint32)taken, _BR[lane] & 0b1111111111111, _PC[lane]);
+}
+
+void TrnLaneEmu::execute(quint32 group, int leader)
+{
+    _group = group;
+    for(int l = 0; l < Lanes; l++)
+        _sel[l] = -(quint32)((group >> l) & 1);
+
+    // Fetch
+    tick();
+    for(int l = 0; l < Lanes; l++)
+        _AR[l] = select(_sel[l], _PC[l], _AR[l]);
+    phaseEnd();
+
+    tick();
+    if(!read())
+        return;
+    for(int l = 0; l < Lanes; l++)
+        _PC[l] = (_PC[l] + (_sel[l] & 1)) & 0xFFFF;
+    phaseEnd();
+
+    tick();
+    for(int l = 0; l < Lanes; l++)
+    {
+        _IR[l] = select(_sel[l], _BR[l], _IR[l]);
+        _AR[l] = select(_sel[l], _BR[l] & 0b1111111111111, _AR[l]);
+    }
+    phaseEnd();
+
+    // From here on, IR is the same in every lane
+    const quint32 ir = _IR[leader];
+    quint8 f;
+    tick();
+    if(ir & 0b10000000000000)
+        f = 0b01;
+    else if(ir & 0b100000000000000)
+        f = 0b10;
+    else
+        f = 0b11;
+    for(int l = 0; l < Lanes; l++)
+        _F[l] = select(_sel[l], f, _F[l]);
+    cycleEnd();
+
+    // Indexed
+    if(f == 0b01)
+    {
+        tick();
+        f = (ir & 0b100000000000000) ? 0b10 : 0b11;
+        for(int l = 0; l < Lanes; l++)
+        {
+            _AR[l] = select(_sel[l], ((ir & 0b1111111111111) + _I[l]) & 0xFFFF, _AR[l]);
+            _F[l] = select(_sel[l], f, _F[l]);
+        }
+        cycleEnd();
+    }
+
+    // Indirect
+    if(f == 0b10)
+    {
+        tick();
+        if(!read())
+            return;
+        phaseEnd();
+
+        tick();
+        for(int l = 0; l < Lanes; l++)
+        {
+            _AR[l] = select(_sel[l], _BR[l] & 0b1111111111111, _AR[l]);
+            _F[l] = select(_sel[l], 0b11, _F[l]);
+        }
+        cycleEnd();
+    }
+
+    // Don't start the execute phase of an INP until there is something to read
+    if(((ir >> 15) & 0b11111) == TrnOpcodes::INP && !(ir & 0b1))
+    {
+        for(int l = 0; l < Lanes; l++)
+        {
+            if(_sel[l] && _inputPos[l] >= _inputs[l].size())
+            {
+                _status[l] = TrnFastEmu::WaitingForInput;
+                _group &= ~(1 << l);
+                _sel[l] = 0;
+            }
+        }
+        if(!_group)
+            return;
+    }
+
+    executePhase(ir);
+}
+
+void TrnLaneEmu::executePhase(quint32 ir)
+{
+    tick();
+    switch((ir >> 15) & 0b11111)
+    {
+        case TrnOpcodes::NOP:
+            break;
+
+        case TrnOpcodes::LDA:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+                _A[l] = select(_sel[l], _BR[l], _A[l]);
+            break;
+
+        case TrnOpcodes::LDX:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+                _X[l] = select(_sel[l], _BR[l], _X[l]);
+            break;
+
+        case TrnOpcodes::LDI:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+                _I[l] = select(_sel[l], _BR[l] & 0b1111111111111, _I[l]);
+            break;
+
+        case TrnOpcodes::STA:
+            for(int l = 0; l < Lanes; l++)
+                _BR[l] = select(_sel[l], _A[l], _BR[l]);
+            phaseEnd();
+            tick();
+            if(!write())
+                return;
+            break;
+
+        case TrnOpcodes::STX:
+            for(int l = 0; l < Lanes; l++)
+                _BR[l] = select(_sel[l], _X[l], _BR[l]);
+            phaseEnd();
+            tick();
+            if(!write())
+                return;
+            break;
+
+        case TrnOpcodes::STI:
+            for(int l = 0; l < Lanes; l++)
+                _BR[l] &= (_I[l] & 0b1111111111111) | ~_sel[l];
+            phaseEnd();
+            tick();
+            if(!write())
+                return;
+            break;
+
+        case TrnOpcodes::ENA:
+        {
+            quint32 a = ir & 0b1111111111111;
+            if(a & 0b1000000000000)
+                a |= 0b11111110000000000000;
+            for(int l = 0; l < Lanes; l++)
+                _A[l] = select(_sel[l], a, _A[l]);
+            phaseEnd();
+            break;
+        }
+
+        case TrnOpcodes::PSH:
+            for(int l = 0; l < Lanes; l++)
+            {
+                _SP[l] = (_SP[l] + (_sel[l] & 1)) & 0xFFFF;
+                _BR[l] = select(_sel[l], _A[l], _BR[l]);
+            }
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+                _AR[l] = select(_sel[l], _SP[l], _AR[l]);
+            phaseEnd();
+            tick();
+            if(!write())
+                return;
+            break;
+
+        case TrnOpcodes::POP:
+            for(int l = 0; l < Lanes; l++)
+                _AR[l] = select(_sel[l], _SP[l], _AR[l]);
+            phaseEnd();
+            tick();
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+            {
+                _A[l] = select(_sel[l], _BR[l], _A[l]);
+                _SP[l] = (_SP[l] - (_sel[l] & 1)) & 0xFFFF;
+            }
+            break;
+
+        case TrnOpcodes::INA:
+            switch(ir & 0b111)
+            {
+                case TrnEmu::INA:
+                    for(int l = 0; l < Lanes; l++)
+                    {
+                        bool firstsign = _A[l] & 0b10000000000000000000;
+                        quint32 a = (_A[l] + 1) & 0b11111111111111111111;
+                        bool overflow = firstsign == false && (a & 0b10000000000000000000) != firstsign;
+                        _A[l] = select(_sel[l], a, _A[l]);
+                        _overflow[l] = select(_sel[l], overflow, _overflow[l]);
+                    }
+                    break;
+                case TrnEmu::INX:
+                    for(int l = 0; l < Lanes; l++)
+                        _X[l] = select(_sel[l], (_X[l] + 1) & 0b11111111111111111111, _X[l]);
+                    break;
+                case TrnEmu::INI:
+                    for(int l = 0; l < Lanes; l++)
+                        _I[l] = (_I[l] + (_sel[l] & 1)) & 0xFFFF;
+                    break;
+                case TrnEmu::DCA:
+                    for(int l = 0; l < Lanes; l++)
+                    {
+                        bool firstsign = _A[l] & 0b10000000000000000000;
+                        quint32 a = (_A[l] - 1) & 0b11111111111111111111;
+                        bool overflow = firstsign == true && (a & 0b10000000000000000000) != firstsign;
+                        _A[l] = select(_sel[l], a, _A[l]);
+                        _overflow[l] = select(_sel[l], overflow, _overflow[l]);
+                    }
+                    break;
+                case TrnEmu::DCX:
+                    for(int l = 0; l < Lanes; l++)
+                        _X[l] = select(_sel[l], (_X[l] - 1) & 0b11111111111111111111, _X[l]);
+                    break;
+                case TrnEmu::DCI:
+                    for(int l = 0; l < Lanes; l++)
+                        _I[l] = (_I[l] - (_sel[l] & 1)) & 0xFFFF;
+                    break;
+            }
+            break;
+
+        case TrnOpcodes::ENI:
+            for(int l = 0; l < Lanes; l++)
+                _I[l] = select(_sel[l], ir & 0b1111111111111, _I[l]);
+            break;
+
+        case TrnOpcodes::LSP:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+                _SP[l] = select(_sel[l], _BR[l] & 0b1111111111111, _SP[l]);
+            break;
+
+        case TrnOpcodes::ADA:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+            {
+                bool firstsign = _A[l] & 0b10000000000000000000;
+                bool secondsign = _BR[l] & 0b10000000000000000000;
+                quint32 a = _A[l] + _BR[l];
+                bool overflow = firstsign == secondsign && (a & 0b10000000000000000000) != firstsign;
+                _A[l] = select(_sel[l], a, _A[l]);
+                _overflow[l] = select(_sel[l], overflow, _overflow[l]);
+            }
+            break;
+
+        case TrnOpcodes::SUB:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+            {
+                quint32 br = ~_BR[l];
+                bool firstsign = _A[l] & 0b10000000000000000000;
+                bool secondsign = br & 0b10000000000000000000;
+                quint32 a = ((_A[l] + 1) & 0b11111111111111111111) + br;
+                bool overflow = firstsign == secondsign && (a & 0b10000000000000000000) != firstsign;
+                _BR[l] = select(_sel[l], br, _BR[l]);
+                _A[l] = select(_sel[l], a, _A[l]);
+                _overflow[l] = select(_sel[l], overflow, _overflow[l]);
+            }
+            break;
+
+        case TrnOpcodes::AND:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+                _A[l] &= _BR[l] | ~_sel[l];
+            break;
+
+        case TrnOpcodes::ORA:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+                _A[l] |= _BR[l] & _sel[l];
+            break;
+
+        case TrnOpcodes::XOR:
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+                _A[l] ^= _BR[l] & _sel[l];
+            break;
+
+        case TrnOpcodes::CMA:
+            for(int l = 0; l < Lanes; l++)
+                _A[l] = select(_sel[l], (~_A[l]) & 0b11111111111111111111, _A[l]);
+            break;
+
+        case TrnOpcodes::JMP:
+            for(int l = 0; l < Lanes; l++)
+                jumpIf(l, true);
+            break;
+
+        case TrnOpcodes::JPN:
+            for(int l = 0; l < Lanes; l++)
+                jumpIf(l, _S[l]);
+            break;
+
+        case TrnOpcodes::JAG:
+            for(int l = 0; l < Lanes; l++)
+                jumpIf(l, !(_S[l] || _Z[l]));
+            break;
+
+        case TrnOpcodes::JPZ:
+            for(int l = 0; l < Lanes; l++)
+                jumpIf(l, _Z[l]);
+            break;
+
+        case TrnOpcodes::JPO:
+            for(int l = 0; l < Lanes; l++)
+            {
+                jumpIf(l, _V[l]);
+                _V[l] &= ~_sel[l];
+            }
+            break;
+
+        case TrnOpcodes::JSR:
+            for(int l = 0; l < Lanes; l++)
+                _SP[l] = (_SP[l] + (_sel[l] & 1)) & 0xFFFF;
+            phaseEnd();
+            // Same clock cycle, just like TrnEmu
+            for(int l = 0; l < Lanes; l++)
+            {
+                _AR[l] = select(_sel[l], _SP[l], _AR[l]);
+                _BR[l] = select(_sel[l], (_BR[l] & ~0b1111111111111) | (_PC[l] & 0b1111111111111), _BR[l]);
+            }
+            phaseEnd();
+            tick();
+            if(!write())
+                return;
+            for(int l = 0; l < Lanes; l++)
+                _PC[l] = select(_sel[l], ir & 0b1111111111111, _PC[l]);
+            break;
+
+        case TrnOpcodes::JIG:
+            for(int l = 0; l < Lanes; l++)
+                jumpIf(l, (_I[l] & 0b01111111111111111111) > 0 && (_I[l] & 0b10000000000000000000) == 0);
+            break;
+
+        case TrnOpcodes::SHAL:
+            switch(ir & 0b11)
+            {
+                case 0b00:
+                    for(int l = 0; l < Lanes; l++)
+                        _A[l] = select(_sel[l], _A[l] << 1, _A[l]);
+                    break;
+                case 0b01:
+                    for(int l = 0; l < Lanes; l++)
+                        _A[l] = select(_sel[l], _A[l] >> 1, _A[l]);
+                    break;
+                case 0b10:
+                    for(int l = 0; l < Lanes; l++)
+                        _X[l] = select(_sel[l], _X[l] << 1, _X[l]);
+                    break;
+                case 0b11:
+                    for(int l = 0; l < Lanes; l++)
+                        _X[l] = select(_sel[l], _X[l] >> 1, _X[l]);
+                    break;
+            }
+            break;
+
+        case TrnOpcodes::SSP:
+            for(int l = 0; l < Lanes; l++)
+                _BR[l] = select(_sel[l], (_BR[l] & ~0b1111111111111) | (_SP[l] & 0b1111111111111), _BR[l]);
+            phaseEnd();
+            tick();
+            if(!write())
+                return;
+            break;
+
+        case TrnOpcodes::SAXL:
+            for(int l = 0; l < Lanes; l++)
+            {
+                quint64 axregs = ((quint64)_X[l] & 0b11111111111111111111) | ((((quint64)_A[l]) & 0b11111111111111111111) << 20);
+                if(ir & 0b1)
+                    axregs = axregs >> 1;
+                else
+                    axregs = axregs << 1;
+                _X[l] = select(_sel[l], axregs & 0b11111111111111111111, _X[l]);
+                _A[l] = select(_sel[l], (axregs >> 20) & 0b11111111111111111111, _A[l]);
+            }
+            break;
+
+        case TrnOpcodes::OUT:
+            if(ir & 0b1)
+            {
+                for(int l = 0; l < Lanes; l++)
+                    _BR[l] = select(_sel[l], _A[l], _BR[l]);
+                phaseEnd();
+                tick();
+                for(int l = 0; l < Lanes; l++)
+                    if(_sel[l])
+                        _outputs[l].append(_BR[l]);
+            }
+            else
+            {
+                for(int l = 0; l < Lanes; l++)
+                    if(_sel[l])
+                        _BR[l] = _inputs[l].at(_inputPos[l]++);
+                phaseEnd();
+                tick();
+                for(int l = 0; l < Lanes; l++)
+                    _A[l] = select(_sel[l], _BR[l], _A[l]);
+            }
+            break;
+
+        case TrnOpcodes::RET:
+            for(int l = 0; l < Lanes; l++)
+                _AR[l] = select(_sel[l], _SP[l], _AR[l]);
+            phaseEnd();
+            tick();
+            if(!read())
+                return;
+            phaseEnd();
+            tick();
+            for(int l = 0; l < Lanes; l++)
+            {
+                _PC[l] = select(_sel[l], _BR[l] & 0b1111111111111, _PC[l]);
+                _SP[l] = (_SP[l] - (_sel[l] & 1)) & 0xFFFF;
+                _F[l] &= ~_sel[l];
+            }
+            phaseEnd();
+            tick();
+            // The flags are not updated after a RET
+            for(int l = 0; l < Lanes; l++)
+                _SC[l] &= ~_sel[l];
+            return;
+
+        case TrnOpcodes::HLT:
+            for(int l = 0; l < Lanes; l++)
+            {
+                if(!_sel[l])
+                    continue;
+                _H[l] = 1;
+                _status[l] = TrnFastEmu::Halted;
+            }
+            return;
+    }
+    for(int l = 0; l < Lanes; l++)
+        _F[l] &= ~_sel[l];
+    cycleEnd();
+}
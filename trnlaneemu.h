@@ -0,0 +1,76 @@
+#ifndef TRNLANEEMU_H
+#define TRNLANEEMU_H
+#include <QVector>
+#include "trnstate.h"
+#include "trnfastemu.h"
+
+// Runs the same program on several machines at once, each with its own inputs
+// Every register is an array with one element per lane, and memory is interleaved so that the lanes' copies of a
+// word are next to each other. Each step executes one instruction on every lane that is about to execute the same
+// word at the same address, as one group, with the registers updated by branchless selects over all the lanes
+// that the compiler can turn into vector instructions. Lanes that go different ways at a jump are regrouped
+// whenever they meet at the same address again
+// Like TrnFastEmu, the state after every instruction is exactly the same as TrnEmu's. Loop detection isn't supported
+class TrnLaneEmu
+{
+public:
+    enum {
+        // Eight 32 bit registers make up an AVX2 vector
+        Lanes = 8,
+        // Steps a lane can be left waiting before it goes first, so that one stuck in a loop can't hold up the others
+        MaxWait = 256,
+    };
+
+    explicit TrnLaneEmu(const QVector<quint32>& pgm);
+    inline void setInputQueue(int lane, const QVector<quint32>& inputs) { _inputs[lane] = inputs; _inputPos[lane] = 0; }
+
+    // Executes one instruction on the group of lanes at the lowest address, leaving out the ones that have already
+    // retired maxInstructions. Returns false once no lane can continue
+    // The lowest address goes first as that is where lanes that went different ways through an if or a loop meet again
+    bool step(quint64 maxInstructions = ~0ULL);
+    // Steps until every lane has stopped, or retired maxInstructions
+    void run(quint64 maxInstructions);
+
+    TrnState state(int lane) const;
+    inline TrnFastEmu::Status status(int lane) const { return _status[lane]; }
+    inline quint64 instructionsRetired(int lane) const { return _retired[lane]; }
+    inline quint32 faultAddress(int lane) const { return _faultAddr[lane]; }
+    inline const QVector<quint32>& outputs(int lane) const { return _outputs[lane]; }
+    // Steps taken, and instructions executed over all the lanes in them. The closer their ratio gets to Lanes, the better
+    inline quint64 steps() const { return _steps; }
+    inline quint64 laneInstructions() const { return _laneInstructions; }
+
+private:
+    Q_DISABLE_COPY(TrnLaneEmu)
+
+    quint32 _words;
+    QVector<quint32> _memory;
+    // The 16 and 8 bit registers are 32 bits wide as well, so that every register fills the same vectors
+    quint32 _BR[Lanes], _A[Lanes], _X[Lanes], _IR[Lanes], _CLOCK[Lanes];
+    quint32 _SP[Lanes], _I[Lanes], _PC[Lanes], _AR[Lanes];
+    quint32 _SC[Lanes], _F[Lanes], _V[Lanes], _Z[Lanes], _S[Lanes], _H[Lanes], _overflow[Lanes];
+    TrnFastEmu::Status _status[Lanes];
+    quint64 _retired[Lanes];
+    quint32 _waiting[Lanes];
+    quint32 _faultAddr[Lanes];
+    QVector<quint32> _inputs[Lanes];
+    int _inputPos[Lanes];
+    QVector<quint32> _outputs[Lanes];
+    quint64 _steps;
+    quint64 _laneInstructions;
+    // The lanes of the group being executed, as a bit mask, and as all ones or all zeros per lane for the selects
+    quint32 _group;
+    quint32 _sel[Lanes];
+
+    void execute(quint32 group, int leader);
+    void executePhase(quint32 ir);
+    void tick();
+    void phaseEnd();
+    void cycleEnd();
+    bool read();
+    bool write();
+    void fault(int lane);
+    void jumpIf(int lane, bool taken);
+};
+
+#endif // TRNLANEEMU_H
@@ -0,0 +1,147 @@
+#include "trnlogexporter.h"
+#include <cstring>
+
+TrnLogExporter::TrnLogExporter(QSharedPointer<TrnLogStore> log, const QString& path, Format format, QObject* parent) :
+    QThread(parent), _log(log), _file(path), _format(format), _total(log->size()), _cancel(false)
+{
+}
+
+TrnLogExporter::~TrnLogExporter()
+{
+    cancel();
+    wait();
+}
+
+bool TrnLogExporter::open()
+{
+    if(!_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    _buffer.reserve(BufferSize + 4096);
+    return true;
+}
+
+void TrnLogExporter::run()
+{
+    if(_format == Csv)
+        _buffer.append("Clock,Action,Value\n");
+    else
+    {
+        Header h;
+        memcpy(h.magic, TRNLOG_MAGIC, sizeof(h.magic));
+        h.version = qToLittleEndian<quint32>(Version);
+        h.reserved = 0;
+        _buffer.append((const char*)&h, sizeof(h));
+    }
+
+    QVector<TrnLogStore::Row> rows;
+    int done = 0;
+    bool ok = true;
+    while(ok && done < _total)
+    {
+        if(_cancel.load(std::memory_order_relaxed))
+        {
+            _file.remove();
+            emit exportFinished(done, true, QString());
+            return;
+        }
+        done += _log->read(done, qMin((int)BlockRows, _total - done), rows);
+        ok = _format == Csv ? writeCsv(rows) : writeBlock(rows);
+        emit progress(done, _total);
+    }
+
+    if(ok && _format == Binary)
+    {
+        // The empty block at the end
+        put(0);
+        put(0);
+    }
+    ok = ok && flush();
+    const QString error = ok ? QString() : _file.errorString();
+    if(ok)
+        _file.close();
+    else
+        // Same as when cancelled, what was written so far is of no use
+        _file.remove();
+    emit exportFinished(done, false, error);
+}
+
+bool TrnLogExporter::flush()
+{
+    if(_buffer.isEmpty())
+        return true;
+    bool ok = _file.write(_buffer) == _buffer.size();
+    _buffer.clear();
+    return ok;
+}
+
+QByteArray TrnLogExporter::csvField(const QString& s)
+{
+    // Only quoted when it has to be
+    if(!s.contains(',') && !s.contains('"') && !s.contains('\n'))
+        return s.toUtf8();
+    QString q = s;
+    q.replace('"', "\"\"");
+    QByteArray f;
+    f.append('"').append(q.toUtf8()).append('"');
+    return f;
+}
+
+bool TrnLogExporter::writeCsv(const QVector<TrnLogStore::Row>& rows)
+{
+    for(const TrnLogStore::Row& r : rows)
+    {
+        _buffer.append(QByteArray::number(r.clock));
+        _buffer.append(',');
+        _buffer.append(csvField(r.action));
+        _buffer.append(',');
+        _buffer.append(csvField(r.value));
+        _buffer.append('\n');
+        if(_buffer.size() >= BufferSize && !flush())
+            return false;
+    }
+    return true;
+}
+
+bool TrnLogExporter::writeBlock(const QVector<TrnLogStore::Row>& rows)
+{
+    // Number the strings first, so that the new ones can go in front of the columns
+    QVector<quint32> actions(rows.size());
+    QVector<quint32> values(rows.size());
+    QVector<const QString*> added;
+    for(int i = 0; i < rows.size(); i++)
+    {
+        const QString* s[2] = { &rows.at(i).action, &rows.at(i).value };
+        quint32* idx[2] = { &actions[i], &values[i] };
+        for(int k = 0; k < 2; k++)
+        {
+            auto it = _strings.constFind(*s[k]);
+            if(it != _strings.constEnd())
+                *idx[k] = it.value();
+            else
+            {
+                *idx[k] = _strings.size();
+                _strings.insert(*s[k], *idx[k]);
+                added.append(s[k]);
+            }
+        }
+    }
+
+    put(rows.size());
+    put(added.size());
+    for(const QString* s : added)
+    {
+        QByteArray utf8 = s->toUtf8();
+        put(utf8.size());
+        _buffer.append(utf8);
+    }
+    for(const TrnLogStore::Row& r : rows)
+        put(r.clock);
+    for(int i = 0; i < rows.size(); i++)
+    {
+        actions[i] = qToLittleEndian(actions.at(i));
+        values[i] = qToLittleEndian(values.at(i));
+    }
+    _buffer.append((const char*)actions.constData(), actions.size() * sizeof(quint32));
+    _buffer.append((const char*)values.constData(), values.size() * sizeof(quint32));
+    return _buffer.size() < BufferSize || flush();
+}
@@ -0,0 +1,77 @@
+#ifndef TRNLOGEXPORTER_H
+#define TRNLOGEXPORTER_H
+#include <QThread>
+#include <QFile>
+#include <QSharedPointer>
+#include <QHash>
+#include <QtEndian>
+#include <atomic>
+#include "trnlogstore.h"
+
+#define TRNLOG_MAGIC "TRNLOG\0\0"
+
+// Writes the execution log to a file on its own thread, so it works while the emulator keeps adding to the log
+// Only the rows that were there when the export was created are written
+class TrnLogExporter : public QThread
+{
+    Q_OBJECT
+public:
+    typedef enum {
+        Csv,
+        // Column oriented, with every distinct string only stored once. Everything is little endian
+        // A Header, then blocks of rows until a block of 0 rows. Each block is:
+        // quint32 rows, quint32 new strings, then for every new string its quint32 length and UTF-8 bytes,
+        // then the column of clocks, the column of action string numbers and the column of value string numbers (rows quint32 each)
+        // Strings are numbered in the order they first appear, across blocks
+        Binary,
+    } Format;
+
+    typedef struct {
+        char magic[8];
+        quint32 version;
+        quint32 reserved;
+    } Header;
+
+    enum {
+        Version = 1,
+        BlockRows = 65536,
+        BufferSize = 1 << 20,
+    };
+
+    TrnLogExporter(QSharedPointer<TrnLogStore> log, const QString& path, Format format, QObject* parent = nullptr);
+    // Cancels and waits for the thread
+    ~TrnLogExporter();
+    bool open();
+    inline QString errorString() const { return _file.errorString(); }
+    inline int rowCount() const { return _total; }
+    // Stops as soon as possible, and removes the partly written file
+    inline void cancel() { _cancel.store(true, std::memory_order_relaxed); }
+
+signals:
+    void progress(int rows, int total);
+    // The error is empty on success, otherwise the partly written file is removed. Also emitted when cancelled, with cancelled set
+    void exportFinished(int rows, bool cancelled, QString error);
+
+protected:
+    void run();
+
+private:
+    QSharedPointer<TrnLogStore> _log;
+    QFile _file;
+    Format _format;
+    int _total;
+    std::atomic<bool> _cancel;
+    QByteArray _buffer;
+    QHash<QString, quint32> _strings;
+    bool flush();
+    bool writeCsv(const QVector<TrnLogStore::Row>& rows);
+    bool writeBlock(const QVector<TrnLogStore::Row>& rows);
+    static QByteArray csvField(const QString& s);
+    inline void put(quint32 v)
+    {
+        v = qToLittleEndian(v);
+        _buffer.append((const char*)&v, sizeof(v));
+    }
+};
+
+#endif // TRNLOGEXPORTER_H
@@ -0,0 +1,158 @@
+#include "trnlogindex.h"
+#include <QMutexLocker>
+#include <algorithm>
+#include <iterator>
+
+TrnLogIndex::TrnLogIndex(QObject* parent) : QThread(parent), _queryPending(false), _clearPending(false), _stop(false), _rows(0)
+{
+}
+
+TrnLogIndex::~TrnLogIndex()
+{
+    {
+        QMutexLocker l(&_lock);
+        _stop = true;
+        _wake.wakeOne();
+    }
+    wait();
+}
+
+void TrnLogIndex::addRow(const QString& action, const QString& value)
+{
+    QMutexLocker l(&_lock);
+    _pending.append(qMakePair(action, value));
+    // Once per batch is enough, the thread takes everything that's queued
+    if(_pending.size() == 1)
+        _wake.wakeOne();
+}
+
+void TrnLogIndex::clear()
+{
+    QMutexLocker l(&_lock);
+    _pending.clear();
+    _clearPending = true;
+    _wake.wakeOne();
+}
+
+void TrnLogIndex::search(const QString& query)
+{
+    QMutexLocker l(&_lock);
+    _query = query;
+    _queryPending = true;
+    _wake.wakeOne();
+}
+
+void TrnLogIndex::run()
+{
+    while(true)
+    {
+        QVector<QPair<QString, QString>> batch;
+        QString query;
+        bool queryPending;
+        bool clearPending;
+        {
+            QMutexLocker l(&_lock);
+            while(!_stop && _pending.isEmpty() && !_queryPending && !_clearPending)
+                _wake.wait(&_lock);
+            if(_stop)
+                return;
+            batch.swap(_pending);
+            query = _query;
+            queryPending = _queryPending;
+            clearPending = _clearPending;
+            _queryPending = _clearPending = false;
+        }
+
+        // Anything queued before the clear was dropped by clear() already
+        if(clearPending)
+        {
+            _postings.clear();
+            _rows = 0;
+        }
+        for(const QPair<QString, QString>& row : batch)
+            index(row.first, row.second);
+        // Only after the batch, so that a search always covers every row added before it
+        if(queryPending)
+            emit searchFinished(query, find(query));
+    }
+}
+
+void TrnLogIndex::index(const QString& action, const QString& value)
+{
+    QStringList words;
+    addWords(action, words);
+    addWords(value, words);
+    // These are the only two forms memory accesses are logged in, "[AR] ← BR" and "BR ← [AR]"
+    if(action.startsWith('['))
+        words << "WRITE";
+    else if(action.contains(QString::fromUtf8("← [")))
+        words << "READ";
+
+    for(const QString& w : words)
+    {
+        QVector<int>& rows = _postings[w];
+        // A word that appears twice in a row is only listed once
+        if(rows.isEmpty() || rows.last() != _rows)
+            rows.append(_rows);
+    }
+    _rows++;
+}
+
+QVector<int> TrnLogIndex::find(const QString& query) const
+{
+    QStringList words;
+    addWords(query, words);
+    if(words.isEmpty())
+        return QVector<int>();
+
+    // Start from the rarest word, every other one can only narrow it down
+    QVector<const QVector<int>*> lists;
+    for(const QString& w : words)
+    {
+        auto it = _postings.constFind(w);
+        if(it == _postings.constEnd())
+            return QVector<int>();
+        lists.append(&it.value());
+    }
+    std::sort(lists.begin(), lists.end(), [](const QVector<int>* a, const QVector<int>* b) { return a->size() < b->size(); });
+
+    QVector<int> result = *lists.first();
+    for(int i = 1; i < lists.size() && !result.isEmpty(); i++)
+    {
+        QVector<int> narrowed;
+        std::set_intersection(result.constBegin(), result.constEnd(), lists.at(i)->constBegin(), lists.at(i)->constEnd(), std::back_inserter(narrowed));
+        result.swap(narrowed);
+    }
+    return result;
+}
+
+void TrnLogIndex::addWords(const QString& text, QStringList& words)
+{
+    int start = -1;
+    for(int i = 0; i <= text.size(); i++)
+    {
+        bool wordChar = i < text.size() && (text.at(i).isLetterOrNumber() || text.at(i) == '_');
+        if(wordChar && start < 0)
+            start = i;
+        else if(!wordChar && start >= 0)
+        {
+            words << normalise(text.mid(start, i - start));
+            start = -1;
+        }
+    }
+}
+
+QString TrnLogIndex::normalise(const QString& word)
+{
+    bool ok;
+    quint64 n;
+    if(word.startsWith("0x", Qt::CaseInsensitive))
+        n = word.mid(2).toULongLong(&ok, 16);
+    else if(word.startsWith("0b", Qt::CaseInsensitive))
+        n = word.mid(2).toULongLong(&ok, 2);
+    else
+        n = word.toULongLong(&ok, 10);
+    if(ok)
+        return QString::number(n);
+    return word.toUpper();
+}
@@ -0,0 +1,53 @@
+#ifndef TRNLOGINDEX_H
+#define TRNLOGINDEX_H
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
+#include <QVector>
+#include <QPair>
+#include <QStringList>
+
+// An inverted index over the execution log, so that searching it doesn't mean going through every row
+// Rows are only queued by the GUI thread. Indexing and searching both happen on this thread
+// Every word of a row is indexed (registers, mnemonics and numbers, which are normalised so that 0x40, 0b1000000 and 64 are the same),
+// along with READ or WRITE for memory accesses, whose value is the address written to or the data read
+class TrnLogIndex : public QThread
+{
+    Q_OBJECT
+public:
+    explicit TrnLogIndex(QObject* parent = nullptr);
+    ~TrnLogIndex();
+    // Rows are numbered in the order they are added, starting from 0
+    void addRow(const QString& action, const QString& value);
+    // Forgets all rows, for when the log is cleared
+    void clear();
+    // Looks for the rows that contain every word of the query. The result comes back through searchFinished
+    // Only the latest query is answered if several are waiting
+    void search(const QString& query);
+
+signals:
+    void searchFinished(QString query, QVector<int> rows);
+
+protected:
+    void run();
+
+private:
+    QMutex _lock;
+    QWaitCondition _wake;
+    // Guarded by _lock
+    QVector<QPair<QString, QString>> _pending;
+    QString _query;
+    bool _queryPending;
+    bool _clearPending;
+    bool _stop;
+    // Index thread only
+    QHash<QString, QVector<int>> _postings;
+    int _rows;
+    void index(const QString& action, const QString& value);
+    QVector<int> find(const QString& query) const;
+    static void addWords(const QString& text, QStringList& words);
+    static QString normalise(const QString& word);
+};
+
+#endif // TRNLOGINDEX_H
@@ -0,0 +1,28 @@
+#include "trnlogstore.h"
+
+void TrnLogStore::append(quint32 clock, const QString& action, const QString& value)
+{
+    Row r;
+    r.clock = clock;
+    // The strings are shared with the table, so this doesn't copy any text
+    r.action = action;
+    r.value = value;
+    QWriteLocker l(&_lock);
+    _rows.append(r);
+}
+
+int TrnLogStore::size() const
+{
+    QReadLocker l(&_lock);
+    return _rows.size();
+}
+
+int TrnLogStore::read(int from, int count, QVector<Row>& out) const
+{
+    QReadLocker l(&_lock);
+    count = qMax(0, qMin(count, _rows.size() - from));
+    out.resize(count);
+    for(int i = 0; i < count; i++)
+        out[i] = _rows.at(from + i);
+    return count;
+}
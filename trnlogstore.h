@@ -0,0 +1,30 @@
+#ifndef TRNLOGSTORE_H
+#define TRNLOGSTORE_H
+#include <QVector>
+#include <QString>
+#include <QReadWriteLock>
+
+// Every row of the execution log, independent of the table that shows it
+// Rows are only ever appended, by the GUI thread. Other threads can read the rows that are there at any time,
+// they only hold the lock for as long as it takes to copy a batch out
+class TrnLogStore
+{
+public:
+    typedef struct {
+        quint32 clock;
+        QString action;
+        QString value;
+    } Row;
+
+    TrnLogStore() {}
+    void append(quint32 clock, const QString& action, const QString& value);
+    int size() const;
+    // Copies up to count rows from the given one on into out, replacing what was there. Returns how many were copied
+    int read(int from, int count, QVector<Row>& out) const;
+
+private:
+    mutable QReadWriteLock _lock;
+    QVector<Row> _rows;
+};
+
+#endif // TRNLOGSTORE_H
@@ -0,0 +1,97 @@
+#include "trnloopdetector.h"
+#include <cstring>
+
+// Keys for everything that isn't a memory word, above the 13 bit address space
+#define REG_KEY(r)      (0x10000 + (r))
+#define INPUTS_KEY      0x20000
+
+TrnLoopDetector::TrnLoopDetector() :
+    _memHash(0), _power(1), _lambda(0), _savedHash(0), _savedInputs(0), _savedMemory(), _savedPages(), _haveSaved(false)
+{
+}
+
+void TrnLoopDetector::reset(const quint32* memory, int size)
+{
+    _memHash = 0;
+    for(int i = 0; i < size; i++)
+        _memHash ^= mix(i, memory[i]);
+    _power = 1;
+    _lambda = 0;
+    _haveSaved = false;
+    _savedMemory.clear();
+    _savedPages = TrnPagedMemory();
+}
+
+void TrnLoopDetector::reset(const TrnPagedMemory& memory)
+{
+    _memHash = 0;
+    for(int i = 0; i < memory.size(); i++)
+        _memHash ^= mix(i, memory.at(i));
+    _power = 1;
+    _lambda = 0;
+    _haveSaved = false;
+    _savedMemory.clear();
+    _savedPages = TrnPagedMemory();
+}
+
+quint64 TrnLoopDetector::stateHash(const TrnTrace::Registers regs, quint64 inputs) const
+{
+    quint64 h = _memHash ^ mix(INPUTS_KEY, inputs);
+    // CLOCK never repeats, but nothing depends on it either
+    for(int i = 0; i < TrnTrace::RegisterCount; i++)
+        if(i != TrnEmu::CLOCK)
+            h ^= mix(REG_KEY(i), regs[i]);
+    return h;
+}
+
+bool TrnLoopDetector::matchesSaved(quint64 hash, const TrnTrace::Registers regs, quint64 inputs) const
+{
+    if(!_haveSaved || hash != _savedHash || inputs != _savedInputs)
+        return false;
+    for(int i = 0; i < TrnTrace::RegisterCount; i++)
+        if(i != TrnEmu::CLOCK && regs[i] != _savedRegs[i])
+            return false;
+    return true;
+}
+
+bool TrnLoopDetector::save(quint64 hash, const TrnTrace::Registers regs, quint64 inputs)
+{
+    // Every time the distance reaches the next power of two, the saved state moves up to the current one
+    if(_haveSaved && _lambda != _power)
+        return false;
+    if(_haveSaved)
+        _power *= 2;
+    _lambda = 0;
+    _savedHash = hash;
+    memcpy(_savedRegs, regs, sizeof(_savedRegs));
+    _savedInputs = inputs;
+    _haveSaved = true;
+    return true;
+}
+
+bool TrnLoopDetector::check(const TrnTrace::Registers regs, quint64 inputs, const quint32* memory, int size)
+{
+    quint64 h = stateHash(regs, inputs);
+    _lambda++;
+    if(matchesSaved(h, regs, inputs) && size == _savedMemory.size() && !memcmp(memory, _savedMemory.constData(), size * sizeof(quint32)))
+        return true;
+
+    if(save(h, regs, inputs))
+    {
+        _savedMemory.resize(size);
+        memcpy(_savedMemory.data(), memory, size * sizeof(quint32));
+    }
+    return false;
+}
+
+bool TrnLoopDetector::check(const TrnTrace::Registers regs, quint64 inputs, const TrnPagedMemory& memory)
+{
+    quint64 h = stateHash(regs, inputs);
+    _lambda++;
+    if(matchesSaved(h, regs, inputs) && memory.equals(_savedPages))
+        return true;
+
+    if(save(h, regs, inputs))
+        _savedPages = memory;
+    return false;
+}
@@ -0,0 +1,61 @@
+#ifndef TRNLOOPDETECTOR_H
+#define TRNLOOPDETECTOR_H
+#include <QVector>
+#include "trntrace.h"
+#include "trnpagedmemory.h"
+
+// Finds out when a program is stuck in an infinite loop
+// The machine is deterministic, so once it is back in a state it has already been in (apart from CLOCK),
+// it will go around the same loop forever. States are compared through a hash that is kept up to date on
+// every memory write instead of being recomputed, and sampled at instruction boundaries with Brent's algorithm,
+// so a loop of length L entered after N instructions is found within about 2 * (N + L) instructions
+// A hash match is always confirmed against a full copy of the state, so there are no false positives
+class TrnLoopDetector
+{
+public:
+    TrnLoopDetector();
+    // Starts over with the given memory
+    void reset(const quint32* memory, int size);
+    void reset(const TrnPagedMemory& memory);
+    // Must be called before every memory write
+    inline void memoryWritten(quint32 addr, quint32 oldData, quint32 newData)
+    {
+        _memHash ^= mix(addr, oldData) ^ mix(addr, newData);
+    }
+    // Called at instruction boundaries. inputs is how many inputs have been consumed so far,
+    // as reading another one can take the program somewhere else even from the same state
+    // Returns true if the state has been seen before
+    bool check(const TrnTrace::Registers regs, quint64 inputs, const quint32* memory, int size);
+    bool check(const TrnTrace::Registers regs, quint64 inputs, const TrnPagedMemory& memory);
+    // The number of instructions in the loop, once one has been found
+    inline quint64 period() const { return _lambda; }
+
+private:
+    quint64 _memHash;
+    // Brent's algorithm
+    quint64 _power;
+    quint64 _lambda;
+    quint64 _savedHash;
+    TrnTrace::Registers _savedRegs;
+    quint64 _savedInputs;
+    QVector<quint32> _savedMemory;
+    // Used instead of _savedMemory with paged memory. It only has copies of the pages that were written to
+    TrnPagedMemory _savedPages;
+    bool _haveSaved;
+
+    static inline quint64 mix(quint64 key, quint64 value)
+    {
+        // splitmix64 finalizer
+        quint64 z = (key << 32 | value) + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    quint64 stateHash(const TrnTrace::Registers regs, quint64 inputs) const;
+    // Everything but the memory, which is up to the caller
+    bool matchesSaved(quint64 hash, const TrnTrace::Registers regs, quint64 inputs) const;
+    // Returns true if the state is saved, in which case the caller has to save the memory as well
+    bool save(quint64 hash, const TrnTrace::Registers regs, quint64 inputs);
+};
+
+#endif // TRNLOOPDETECTOR_H
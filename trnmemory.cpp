@@ -0,0 +1,62 @@
+#include "trnmemory.h"
+#include <QtAlgorithms>
+#include <cstring>
+
+TrnMemory::TrnMemory(const QVector<quint32>& pgm, OutOfRangePolicy policy) :
+    _words((quint32*)qMallocAligned(Size * sizeof(quint32), 64)), _flags(new std::atomic<quint8>[Size]),
+    _limit(policy == ZeroFill ? Size : qMin(pgm.size(), (int)Size))
+{
+    int len = qMin(pgm.size(), (int)Size);
+    memcpy(_words, pgm.constData(), len * sizeof(quint32));
+    memset(_words + len, 0, (Size - len) * sizeof(quint32));
+    for(int i = 0; i < Size; i++)
+        _flags[i].store(0, std::memory_order_relaxed);
+    memset(_dirty, 0, sizeof(_dirty));
+}
+
+TrnMemory::~TrnMemory()
+{
+    qFreeAligned(_words);
+    delete[] _flags;
+}
+
+QVector<quint32> TrnMemory::toVector() const
+{
+    QVector<quint32> v(_limit);
+    memcpy(v.data(), _words, _limit * sizeof(quint32));
+    return v;
+}
+
+bool TrnMemory::setFlag(quint32 addr, WordFlag f, bool on)
+{
+    quint8 old;
+    if(on)
+        old = _flags[addr].fetch_or(f, std::memory_order_relaxed);
+    else
+        old = _flags[addr].fetch_and(~f, std::memory_order_relaxed);
+    return !(old & f) == on;
+}
+
+QBitArray TrnMemory::takeDirtyPages()
+{
+    QBitArray pages(Pages);
+    for(int w = 0; w < Pages / 64; w++)
+    {
+        // Usually all clear
+        for(quint64 bits = _dirty[w]; bits; bits &= bits - 1)
+            pages.setBit(w * 64 + qCountTrailingZeroBits(bits));
+        _dirty[w] = 0;
+    }
+    return pages;
+}
+
+void TrnMemory::copyPages(quint32* image, const QBitArray& pages) const
+{
+    for(int p = 0; p < Pages; p++)
+    {
+        if(!pages.testBit(p) || p * PageSize >= (int)_limit)
+            continue;
+        int len = qMin((int)PageSize, (int)_limit - p * PageSize);
+        memcpy(image + p * PageSize, _words + p * PageSize, len * sizeof(quint32));
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef TRNMEMORY_H
+#define TRNMEMORY_H
+#include <QVector>
+#include <QBitArray>
+#include <QtGlobal>
+#include <atomic>
+
+// The whole 13 bit address space as one flat, cache line aligned array
+// Accesses are plain array indexing. The only check left is whether an address is in use at all,
+// which is still needed as AR and PC are wider than 13 bits
+// Next to the words it keeps a flag byte per word, and which pages have been written to,
+// so that whoever mirrors the memory only has to look at the pages that actually changed
+class TrnMemory
+{
+public:
+    enum {
+        Size = 8192,
+        PageSize = 64,
+        Pages = Size / PageSize,
+    };
+
+    // What happens to the words the program doesn't cover
+    typedef enum {
+        Fault, // Accessing them is an error, like anything past the address space
+        ZeroFill, // They read as zero and can be written to
+    } OutOfRangePolicy;
+
+    typedef enum {
+        Breakpoint = 0b0001, // Set by the user
+        Watchpoint = 0b0010, // likewise
+        Executed = 0b0100, // Fetched as an instruction at least once
+        Written = 0b1000, // Written to at least once since the program was loaded
+    } WordFlag;
+
+    // Anything in the program past the address space is dropped
+    explicit TrnMemory(const QVector<quint32>& pgm, OutOfRangePolicy policy = Fault);
+    ~TrnMemory();
+
+    inline bool contains(quint32 addr) const { return addr < _limit; }
+    // The address must have been checked with contains()
+    inline quint32 at(quint32 addr) const { return _words[addr]; }
+    inline void write(quint32 addr, quint32 data)
+    {
+        _words[addr] = data;
+        _dirty[addr / PageSize / 64] |= (quint64)1 << (addr / PageSize % 64);
+        mark(addr, Written);
+    }
+    // The number of words in use
+    inline int size() const { return _limit; }
+    inline const quint32* constData() const { return _words; }
+    QVector<quint32> toVector() const;
+
+    // Flags can be read and changed from any thread, for any address in the address space
+    inline bool hasFlag(quint32 addr, WordFlag f) const { return _flags[addr].load(std::memory_order_relaxed) & f; }
+    // Returns whether the flag changed
+    bool setFlag(quint32 addr, WordFlag f, bool on);
+    // Only pays for the atomic the first time, as the flag is never cleared while running
+    inline void mark(quint32 addr, WordFlag f)
+    {
+        if(!hasFlag(addr, f))
+            _flags[addr].fetch_or(f, std::memory_order_relaxed);
+    }
+
+    // The pages written to since the last call, one bit per page. Only for the thread that writes to the memory
+    QBitArray takeDirtyPages();
+    // Copies the given pages over the same pages of an image of at least size() words
+    void copyPages(quint32* image, const QBitArray& pages) const;
+
+private:
+    quint32* _words;
+    std::atomic<quint8>* _flags;
+    quint64 _dirty[Pages / 64];
+    quint32 _limit;
+    TrnMemory(const TrnMemory&);
+    TrnMemory& operator=(const TrnMemory&);
+};
+
+#endif // TRNMEMORY_H
@@ -0,0 +1,104 @@
+#include "trnpagedmemory.h"
+#include <cstring>
+
+TrnPagedMemory::TrnPagedMemory() :
+    _image(), _pages(), _private()
+{
+}
+
+TrnPagedMemory::TrnPagedMemory(const QVector<quint32>& image) :
+    _image(image), _pages((image.size() + PageSize - 1) / PageSize), _private(_pages.size(), nullptr)
+{
+    for(int p = 0; p < _pages.size(); p++)
+        _pages[p] = _image.constData() + p * PageSize;
+}
+
+TrnPagedMemory::TrnPagedMemory(const TrnPagedMemory& o) :
+    _image(o._image), _pages(o._pages.size()), _private(o._private.size(), nullptr)
+{
+    for(int p = 0; p < _pages.size(); p++)
+    {
+        if(o._private.at(p))
+        {
+            _private[p] = new quint32[PageSize];
+            memcpy(_private[p], o._private.at(p), PageSize * sizeof(quint32));
+            _pages[p] = _private.at(p);
+        }
+        else
+            _pages[p] = _image.constData() + p * PageSize;
+    }
+}
+
+TrnPagedMemory& TrnPagedMemory::operator=(TrnPagedMemory o)
+{
+    swap(o);
+    return *this;
+}
+
+TrnPagedMemory::~TrnPagedMemory()
+{
+    for(quint32* page : _private)
+        delete[] page;
+}
+
+void TrnPagedMemory::swap(TrnPagedMemory& o)
+{
+    _image.swap(o._image);
+    _pages.swap(o._pages);
+    _private.swap(o._private);
+}
+
+quint32* TrnPagedMemory::detach(int page)
+{
+    // The last page can be shorter than the others, but the copy is always a whole page
+    quint32* copy = new quint32[PageSize];
+    const int len = qMin((int)PageSize, _image.size() - page * PageSize);
+    memcpy(copy, _pages.at(page), len * sizeof(quint32));
+    memset(copy + len, 0, (PageSize - len) * sizeof(quint32));
+    _private[page] = copy;
+    _pages[page] = copy;
+    return copy;
+}
+
+QVector<quint32> TrnPagedMemory::toVector() const
+{
+    // Nothing to copy while it is still the image
+    if(!privatePages())
+        return _image;
+    QVector<quint32> v(_image.size());
+    copyTo(v.data());
+    return v;
+}
+
+void TrnPagedMemory::copyTo(quint32* words) const
+{
+    for(int p = 0; p < _pages.size(); p++)
+    {
+        const int len = qMin((int)PageSize, _image.size() - p * PageSize);
+        memcpy(words + p * PageSize, _pages.at(p), len * sizeof(quint32));
+    }
+}
+
+bool TrnPagedMemory::equals(const TrnPagedMemory& o) const
+{
+    if(size() != o.size())
+        return false;
+    for(int p = 0; p < _pages.size(); p++)
+    {
+        if(_pages.at(p) == o._pages.at(p))
+            continue;
+        const int len = qMin((int)PageSize, _image.size() - p * PageSize);
+        if(memcmp(o._pages.at(p), _pages.at(p), len * sizeof(quint32)))
+            return false;
+    }
+    return true;
+}
+
+int TrnPagedMemory::privatePages() const
+{
+    int n = 0;
+    for(quint32* page : _private)
+        if(page)
+            n++;
+    return n;
+}
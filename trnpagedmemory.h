@@ -0,0 +1,55 @@
+#ifndef TRNPAGEDMEMORY_H
+#define TRNPAGEDMEMORY_H
+#include <QVector>
+#include <QtGlobal>
+#include "trnmemory.h"
+
+// Memory for the headless engines, where any number of machines run the same program at once
+// The program they were loaded with is shared between all of them through QVector's implicit sharing, and is never
+// written to. Each machine only gets a private copy of a page once it writes to it, instead of a copy of everything,
+// and a copy of a machine (a fork in a sweep) only copies the pages that machine had made private
+class TrnPagedMemory
+{
+public:
+    enum {
+        PageSize = TrnMemory::PageSize,
+    };
+
+    // Empty, with no words at all
+    TrnPagedMemory();
+    explicit TrnPagedMemory(const QVector<quint32>& image);
+    TrnPagedMemory(const TrnPagedMemory& o);
+    TrnPagedMemory& operator=(TrnPagedMemory o);
+    ~TrnPagedMemory();
+
+    // The number of words, which is the size of the image
+    inline int size() const { return _image.size(); }
+    // The address must be less than size()
+    inline quint32 at(quint32 addr) const { return _pages.at(addr / PageSize)[addr % PageSize]; }
+    inline void write(quint32 addr, quint32 data)
+    {
+        quint32* page = _private.at(addr / PageSize);
+        if(!page)
+            page = detach(addr / PageSize);
+        page[addr % PageSize] = data;
+    }
+
+    QVector<quint32> toVector() const;
+    void copyTo(quint32* words) const;
+    // Pages that both still share with the same image are equal without looking at them
+    bool equals(const TrnPagedMemory& o) const;
+    // Pages that were written to, and are no longer shared with the image
+    int privatePages() const;
+
+private:
+    QVector<quint32> _image;
+    // Where every page is read from, in the image or in its private copy
+    QVector<const quint32*> _pages;
+    // The private copy of every page, or nullptr while it is still shared
+    QVector<quint32*> _private;
+
+    quint32* detach(int page);
+    void swap(TrnPagedMemory& o);
+};
+
+#endif // TRNPAGEDMEMORY_H
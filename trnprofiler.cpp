@@ -0,0 +1,212 @@
+#include "trnprofiler.h"
+#include <QObject>
+#include <QFileInfo>
+#include <QStringList>
+#include <algorithm>
+
+TrnProfiler::TrnProfiler()
+{
+    clear();
+}
+
+void TrnProfiler::clear()
+{
+    _stack.clear();
+    _nodes.clear();
+    _nodeIndex.clear();
+    _stats.clear();
+    _events.clear();
+    _droppedEvents = 0;
+    _time = 0;
+    _lastClock = 0;
+    _mismatches = 0;
+    _abandoned = 0;
+    _maxDepth = 0;
+}
+
+void TrnProfiler::start(quint16 pc, quint32 clock)
+{
+    finish(_lastClock);
+    _lastClock = clock;
+    // The top level code has no return address, and sits below every slot
+    push(pc, 0, 0);
+}
+
+void TrnProfiler::call(quint16 target, quint16 returnAddr, quint16 slot, quint32 clock)
+{
+    advance(clock);
+    // Overwriting a return address means its call is over, even though it never returned
+    while(_stack.size() > 1 && _stack.last().slot >= slot)
+    {
+        pop();
+        _abandoned++;
+    }
+    push(target, returnAddr, slot);
+}
+
+void TrnProfiler::ret(quint16 returnAddr, quint16 slot, quint32 clock)
+{
+    advance(clock);
+    // Normally the call on top, but it could be further down if calls above it were abandoned
+    // Failing that, a call that pushed the same return address before an LSP moved the stack
+    int k = _stack.size() - 1;
+    while(k > 0 && (_stack.at(k).slot != slot || _stack.at(k).returnAddr != returnAddr))
+        k--;
+    if(k == 0)
+    {
+        k = _stack.size() - 1;
+        while(k > 0 && _stack.at(k).returnAddr != returnAddr)
+            k--;
+    }
+    // A return address pushed by hand with PSH, used as a jump
+    if(k == 0)
+    {
+        _mismatches++;
+        return;
+    }
+    while(_stack.size() - 1 > k)
+    {
+        pop();
+        _abandoned++;
+    }
+    pop();
+}
+
+void TrnProfiler::finish(quint32 clock)
+{
+    if(_stack.isEmpty())
+        return;
+    advance(clock);
+    while(!_stack.isEmpty())
+        pop();
+}
+
+void TrnProfiler::advance(quint32 clock)
+{
+    // Unsigned, so that it still works when CLOCK wraps around
+    quint32 delta = clock - _lastClock;
+    _lastClock = clock;
+    if(_stack.isEmpty())
+        return;
+    _time += delta;
+    const Frame& top = _stack.last();
+    _nodes[top.node].self += delta;
+    _stats[top.entry].exclusive += delta;
+}
+
+void TrnProfiler::push(quint16 entry, quint16 returnAddr, quint16 slot)
+{
+    int node = child(_stack.isEmpty() ? -1 : _stack.last().node, entry);
+    Stats& s = _stats[entry];
+    s.calls++;
+    s.active++;
+    _stack.append(Frame{entry, returnAddr, slot, node, _time});
+    // The top level doesn't count
+    _maxDepth = qMax(_maxDepth, _stack.size() - 1);
+}
+
+void TrnProfiler::pop()
+{
+    const Frame f = _stack.takeLast();
+    Stats& s = _stats[f.entry];
+    if(--s.active == 0)
+        s.inclusive += _time - f.start;
+    if(_events.size() < MaxTraceEvents)
+        _events.append(Event{f.entry, (quint16)_stack.size(), f.start, _time - f.start});
+    else
+        _droppedEvents++;
+}
+
+int TrnProfiler::child(int parent, quint16 entry)
+{
+    const quint64 key = ((quint64)(quint32)parent << 16) | entry;
+    auto i = _nodeIndex.constFind(key);
+    if(i != _nodeIndex.constEnd())
+        return i.value();
+    _nodes.append(Node{entry, parent, 0});
+    _nodeIndex.insert(key, _nodes.size() - 1);
+    return _nodes.size() - 1;
+}
+
+QVector<TrnProfiler::Function> TrnProfiler::functions() const
+{
+    QVector<Function> fns;
+    for(auto i = _stats.constBegin(); i != _stats.constEnd(); ++i)
+        fns.append(Function{i.key(), i.value().calls, i.value().inclusive, i.value().exclusive});
+    std::sort(fns.begin(), fns.end(), [](const Function& a, const Function& b) {
+        return a.exclusive != b.exclusive ? a.exclusive > b.exclusive : a.entry < b.entry;
+    });
+    return fns;
+}
+
+QString TrnProfiler::functionName(quint16 entry, const AsmDebugInfo& info)
+{
+    QString label = info.symbols.labelAt(entry);
+    return label.isEmpty() ? QString("@%1").arg(entry) : label;
+}
+
+void TrnProfiler::writeSummary(QTextStream& out, const AsmDebugInfo& info) const
+{
+    out << QObject::tr("%1 cycles, %2 calls deep at most").arg(_time).arg(_maxDepth) << "\n";
+    if(_abandoned || _mismatches)
+        out << QObject::tr("%1 calls never returned, %2 RETs didn't match any call").arg(_abandoned).arg(_mismatches) << "\n";
+    out << "\n";
+    out << QString("%1 %2 %3 %4 %5  %6").arg(QObject::tr("Exclusive"), 12).arg("%", 6).arg(QObject::tr("Inclusive"), 12).arg("%", 6)
+           .arg(QObject::tr("Calls"), 10).arg(QObject::tr("Subroutine")) << "\n";
+    const double total = qMax(_time, (quint64)1);
+    for(const Function& f : functions())
+    {
+        out << QString("%1 %2 %3 %4 %5  %6").arg(f.exclusive, 12).arg(100.0 * f.exclusive / total, 6, 'f', 1)
+               .arg(f.inclusive, 12).arg(100.0 * f.inclusive / total, 6, 'f', 1).arg(f.calls, 10).arg(functionName(f.entry, info)) << "\n";
+    }
+}
+
+void TrnProfiler::writeCollapsed(QTextStream& out, const AsmDebugInfo& info) const
+{
+    QHash<quint16, QString> names;
+    for(const Node& n : _nodes)
+    {
+        if(!n.self)
+            continue;
+        QStringList path;
+        for(int i = &n - _nodes.constData(); i != -1; i = _nodes.at(i).parent)
+        {
+            quint16 entry = _nodes.at(i).entry;
+            if(!names.contains(entry))
+                names.insert(entry, functionName(entry, info));
+            path.prepend(names.value(entry));
+        }
+        out << path.join(QChar(';')) << " " << n.self << "\n";
+    }
+}
+
+static QString jsonString(const QString& s)
+{
+    QString escaped(s);
+    escaped.replace('\\', "\\\\");
+    escaped.replace('"', "\\\"");
+    return "\"" + escaped + "\"";
+}
+
+void TrnProfiler::writeChromeTrace(QTextStream& out, const AsmDebugInfo& info) const
+{
+    // Outer calls before the ones they made, which is the order the viewers nest them in
+    QVector<Event> events(_events);
+    std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+        return a.start != b.start ? a.start < b.start : a.depth < b.depth;
+    });
+
+    out << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":"
+        << jsonString(QFileInfo(info.sourcePath).fileName()) << "}}";
+    QHash<quint16, QString> names;
+    for(const Event& e : events)
+    {
+        if(!names.contains(e.entry))
+            names.insert(e.entry, jsonString(functionName(e.entry, info)));
+        out << ",\n{\"name\":" << names.value(e.entry) << ",\"cat\":\"jsr\",\"ph\":\"X\",\"ts\":" << e.start << ",\"dur\":" << e.duration
+            << ",\"pid\":1,\"tid\":1,\"args\":{\"address\":" << e.entry << ",\"depth\":" << e.depth << "}}";
+    }
+    out << "\n],\"otherData\":{\"source\":" << jsonString(info.sourcePath) << ",\"cycles\":" << _time
+        << ",\"droppedEvents\":" << _droppedEvents << ",\"mismatchedReturns\":" << _mismatches << "}}\n";
+}
@@ -0,0 +1,104 @@
+#ifndef TRNPROFILER_H
+#define TRNPROFILER_H
+#include <QtGlobal>
+#include <QVector>
+#include <QHash>
+#include <QTextStream>
+#include "asmdebuginfo.h"
+
+// Subroutine profiler
+// A shadow call stack follows JSR and RET and attributes every clock cycle to the subroutine that was running,
+// both exclusively (in the subroutine itself) and inclusively (including everything it called)
+// The stack grows upwards, so a JSR that pushes to a slot at or below a frame's return address means that frame was
+// abandoned, by a POP or an LSP, and a RET that reads a return address no frame pushed is just a computed jump
+class TrnProfiler
+{
+public:
+    enum {
+        // Calls that finished after this many were recorded are left out of the Chrome trace
+        MaxTraceEvents = 1000000,
+    };
+
+    typedef struct {
+        quint16 entry;
+        quint64 calls;
+        quint64 inclusive;
+        quint64 exclusive;
+    } Function;
+
+    TrnProfiler();
+    void clear();
+
+    // Starts a run at the given PC and clock. Several runs add up, and follow each other in the trace
+    void start(quint16 pc, quint32 clock);
+    // A JSR wrote returnAddr to slot and jumped to target
+    void call(quint16 target, quint16 returnAddr, quint16 slot, quint32 clock);
+    // A RET read returnAddr from slot and jumped there
+    void ret(quint16 returnAddr, quint16 slot, quint32 clock);
+    // Ends the run, and with it every call still in progress
+    void finish(quint32 clock);
+
+    // RETs that didn't return from any call on the stack
+    inline quint64 mismatches() const { return _mismatches; }
+    // Calls that never returned, because their frame was popped, moved or jumped out of
+    inline quint64 abandoned() const { return _abandoned; }
+    inline int maxDepth() const { return _maxDepth; }
+    inline quint64 cycles() const { return _time; }
+    // Sorted by exclusive cycles, most first
+    QVector<Function> functions() const;
+
+    void writeSummary(QTextStream& out, const AsmDebugInfo& info) const;
+    // One line per call stack, "outer;inner cycles", which is what flamegraph.pl and speedscope read
+    void writeCollapsed(QTextStream& out, const AsmDebugInfo& info) const;
+    // Trace Event Format, for chrome://tracing and Perfetto. One clock cycle is shown as one microsecond
+    void writeChromeTrace(QTextStream& out, const AsmDebugInfo& info) const;
+
+private:
+    typedef struct {
+        quint16 entry;
+        quint16 returnAddr;
+        quint16 slot;
+        int node;
+        quint64 start;
+    } Frame;
+    // A call stack, as a path in the call tree
+    typedef struct {
+        quint16 entry;
+        int parent;
+        quint64 self;
+    } Node;
+    typedef struct {
+        quint16 entry;
+        quint16 depth;
+        quint64 start;
+        quint64 duration;
+    } Event;
+    typedef struct {
+        quint64 calls;
+        quint64 inclusive;
+        quint64 exclusive;
+        // Recursive calls only count towards the inclusive cycles of the outermost one
+        int active;
+    } Stats;
+
+    QVector<Frame> _stack;
+    QVector<Node> _nodes;
+    QHash<quint64, int> _nodeIndex;
+    QHash<quint16, Stats> _stats;
+    QVector<Event> _events;
+    quint64 _droppedEvents;
+    // Cycles since the first run started, so it never wraps around like CLOCK does
+    quint64 _time;
+    quint32 _lastClock;
+    quint64 _mismatches;
+    quint64 _abandoned;
+    int _maxDepth;
+
+    void advance(quint32 clock);
+    void push(quint16 entry, quint16 returnAddr, quint16 slot);
+    void pop();
+    int child(int parent, quint16 entry);
+    static QString functionName(quint16 entry, const AsmDebugInfo& info);
+};
+
+#endif // TRNPROFILER_H
@@ -0,0 +1,164 @@
+#include "trnresultcache.h"
+#include "trntrace.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+
+static void addWord(QCryptographicHash& h, quint32 word)
+{
+    word = qToLittleEndian(word);
+    h.addData((const char*)&word, sizeof(word));
+}
+
+static void addWords(QCryptographicHash& h, const QVector<quint32>& words)
+{
+    addWord(h, words.size());
+    for(quint32 w : words)
+        addWord(h, w);
+}
+
+TrnResultCache::TrnResultCache(const QString& dir) :
+    _dir(dir)
+{
+}
+
+bool TrnResultCache::open()
+{
+    QDir d(_dir);
+    return d.mkpath("images") && d.mkpath("results");
+}
+
+QByteArray TrnResultCache::imageKey(const QByteArray& source)
+{
+    QCryptographicHash h(QCryptographicHash::Sha256);
+    addWord(h, Version);
+    addWord(h, ImageEntry);
+    h.addData(source);
+    return h.result();
+}
+
+QByteArray TrnResultCache::imageDigest(const QVector<quint32>& pgm)
+{
+    QCryptographicHash h(QCryptographicHash::Sha256);
+    addWords(h, pgm);
+    return h.result();
+}
+
+QByteArray TrnResultCache::resultKey(const QByteArray& imageDigest, const QVector<quint32>& inputs, quint64 maxInstructions)
+{
+    QCryptographicHash h(QCryptographicHash::Sha256);
+    addWord(h, Version);
+    addWord(h, ResultEntry);
+    h.addData(imageDigest);
+    addWords(h, inputs);
+    addWord(h, maxInstructions);
+    addWord(h, maxInstructions >> 32);
+    return h.result();
+}
+
+QByteArray TrnResultCache::stateDigest(const TrnState& s)
+{
+    QCryptographicHash h(QCryptographicHash::Sha256);
+    TrnTrace::Registers regs;
+    TrnTrace::fromState(s, regs);
+    for(quint32 r : regs)
+        addWord(h, r);
+    addWords(h, s.memory);
+    return h.result();
+}
+
+QString TrnResultCache::entryPath(EntryKind kind, const QByteArray& key) const
+{
+    return QDir(_dir).filePath(QString(kind == ImageEntry ? "images/" : "results/") + QString::fromLatin1(key.toHex()));
+}
+
+bool TrnResultCache::read(EntryKind kind, const QByteArray& key, QByteArray& payload, quint32& count) const
+{
+    QFile f(entryPath(kind, key));
+    if(!f.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = f.readAll();
+    Header h;
+    if(data.size() < (int)sizeof(h))
+        return false;
+    memcpy(&h, data.constData(), sizeof(h));
+    if(memcmp(h.magic, TRNRESULTCACHE_MAGIC, sizeof(h.magic)) || qFromLittleEndian(h.version) != Version || qFromLittleEndian(h.kind) != (quint32)kind)
+        return false;
+    count = qFromLittleEndian(h.count);
+    payload = data.mid(sizeof(h));
+    return true;
+}
+
+bool TrnResultCache::write(EntryKind kind, const QByteArray& key, const QByteArray& payload, quint32 count)
+{
+    Header h;
+    memcpy(h.magic, TRNRESULTCACHE_MAGIC, sizeof(h.magic));
+    h.version = qToLittleEndian<quint32>(Version);
+    h.kind = qToLittleEndian<quint32>(kind);
+    h.count = qToLittleEndian(count);
+
+    // Written to a temporary file, and only renamed to the entry on commit
+    QSaveFile f(entryPath(kind, key));
+    if(!f.open(QIODevice::WriteOnly))
+        return false;
+    if(f.write((const char*)&h, sizeof(h)) != sizeof(h) || f.write(payload) != payload.size())
+    {
+        f.cancelWriting();
+        return false;
+    }
+    return f.commit();
+}
+
+bool TrnResultCache::findImage(const QByteArray& key, QVector<quint32>& pgm) const
+{
+    QByteArray payload;
+    quint32 count;
+    if(!read(ImageEntry, key, payload, count) || (quint64)payload.size() != (quint64)count * sizeof(quint32))
+        return false;
+    pgm.resize(count);
+    for(quint32 i = 0; i < count; i++)
+        pgm[i] = qFromLittleEndian<quint32>((const uchar*)payload.constData() + i * sizeof(quint32));
+    return true;
+}
+
+bool TrnResultCache::findResult(const QByteArray& key, Result& r, QVector<quint32>& outputs) const
+{
+    QByteArray payload;
+    quint32 count;
+    if(!read(ResultEntry, key, payload, count) || (quint64)payload.size() != sizeof(r) + (quint64)count * sizeof(quint32))
+        return false;
+    memcpy(&r, payload.constData(), sizeof(r));
+    r.status = qFromLittleEndian(r.status);
+    r.clock = qFromLittleEndian(r.clock);
+    r.instructions = qFromLittleEndian(r.instructions);
+    outputs.resize(count);
+    for(quint32 i = 0; i < count; i++)
+        outputs[i] = qFromLittleEndian<quint32>((const uchar*)payload.constData() + sizeof(r) + i * sizeof(quint32));
+    return true;
+}
+
+bool TrnResultCache::storeImage(const QByteArray& key, const QVector<quint32>& pgm)
+{
+    QVector<quint32> words(pgm.size());
+    for(int i = 0; i < pgm.size(); i++)
+        words[i] = qToLittleEndian(pgm.at(i));
+    return write(ImageEntry, key, QByteArray((const char*)words.constData(), words.size() * sizeof(quint32)), words.size());
+}
+
+bool TrnResultCache::storeResult(const QByteArray& key, const Result& r, const QVector<quint32>& outputs)
+{
+    Result le = r;
+    le.status = qToLittleEndian(r.status);
+    le.clock = qToLittleEndian(r.clock);
+    le.instructions = qToLittleEndian(r.instructions);
+    QByteArray payload((const char*)&le, sizeof(le));
+    for(quint32 v : outputs)
+    {
+        v = qToLittleEndian(v);
+        payload.append((const char*)&v, sizeof(v));
+    }
+    return write(ResultEntry, key, payload, outputs.size());
+}
@@ -0,0 +1,70 @@
+#ifndef TRNRESULTCACHE_H
+#define TRNRESULTCACHE_H
+#include <QVector>
+#include <QString>
+#include <QByteArray>
+#include "trnstate.h"
+
+#define TRNRESULTCACHE_MAGIC "TRNCACHE"
+
+// On-disk cache of batch runs, so that a program that was already run on the same inputs isn't run again
+// Every entry is a file named after the SHA-256 of what it depends on, so the directory can be shared between any
+// number of runs, and entries are never invalidated, only added. Results are keyed by the memory image, the inputs
+// and the instruction budget, and assembled images by the source they were assembled from
+// An entry is a Header followed by the little endian words of the image, or by a Result and the outputs
+class TrnResultCache
+{
+public:
+    enum {
+        // Must be bumped whenever the assembler or the machine change what a program assembles to or does,
+        // as it is part of every key
+        Version = 1,
+    };
+
+    typedef enum {
+        ImageEntry,
+        ResultEntry,
+    } EntryKind;
+
+    typedef struct {
+        char magic[8];
+        quint32 version;
+        quint32 kind;
+        // Words after the header, or outputs after the Result
+        quint32 count;
+    } Header;
+
+    typedef struct {
+        quint32 status;
+        quint32 clock;
+        quint64 instructions;
+        // SHA-256 of the registers and memory the run ended with
+        char digest[32];
+    } Result;
+
+    explicit TrnResultCache(const QString& dir);
+    // Creates the directories if they aren't there yet
+    bool open();
+
+    static QByteArray imageKey(const QByteArray& source);
+    // The image only has to be hashed once for all the runs of a batch, with imageDigest()
+    static QByteArray imageDigest(const QVector<quint32>& pgm);
+    static QByteArray resultKey(const QByteArray& imageDigest, const QVector<quint32>& inputs, quint64 maxInstructions);
+    static QByteArray stateDigest(const TrnState& s);
+
+    // Entries that can't be read, or are cut short, are misses
+    bool findImage(const QByteArray& key, QVector<quint32>& pgm) const;
+    bool findResult(const QByteArray& key, Result& r, QVector<quint32>& outputs) const;
+    // An entry only shows up once it has been written completely, so runs sharing the directory never read half of one
+    bool storeImage(const QByteArray& key, const QVector<quint32>& pgm);
+    bool storeResult(const QByteArray& key, const Result& r, const QVector<quint32>& outputs);
+
+private:
+    QString _dir;
+
+    QString entryPath(EntryKind kind, const QByteArray& key) const;
+    bool read(EntryKind kind, const QByteArray& key, QByteArray& payload, quint32& count) const;
+    bool write(EntryKind kind, const QByteArray& key, const QByteArray& payload, quint32 count);
+};
+
+#endif // TRNRESULTCACHE_H
@@ -0,0 +1,35 @@
+#ifndef TRNSTATE_H
+#define TRNSTATE_H
+#include <QVector>
+#include <QtGlobal>
+
+// Full architectural state of the TRN+
+// Used to move the machine state between the different execution engines, and to compare them
+class TrnState
+{
+public:
+    TrnState() : BR(0), A(0), X(0), IR(0), CLOCK(0), SP(0), I(0), PC(0), AR(0), SC(0), F(0), V(0), Z(0), S(0), H(0), overflow(false), memory() {}
+    explicit TrnState(const QVector<quint32>& pgm) : TrnState() { memory = pgm; }
+
+    // 32 bit regs
+    quint32 BR, A, X, IR, CLOCK;
+    // 16 bit regs
+    quint16 SP, I, PC, AR;
+    // 8 bit regs
+    quint8 SC, F, V, Z, S, H;
+    // Copied to V at the end of every phase. It is not reset by JPO, only V is
+    bool overflow;
+    QVector<quint32> memory;
+
+    inline bool registersEqual(const TrnState& o) const
+    {
+        return BR == o.BR && A == o.A && X == o.X && IR == o.IR && CLOCK == o.CLOCK &&
+               SP == o.SP && I == o.I && PC == o.PC && AR == o.AR &&
+               SC == o.SC && F == o.F && V == o.V && Z == o.Z && S == o.S && H == o.H &&
+               overflow == o.overflow;
+    }
+    inline bool operator==(const TrnState& o) const { return registersEqual(o) && memory == o.memory; }
+    inline bool operator!=(const TrnState& o) const { return !(*this == o); }
+};
+
+#endif // TRNSTATE_H
@@ -0,0 +1,195 @@
+#include "trnsweep.h"
+#include <QThread>
+#include <QStringList>
+#include <cstring>
+
+// Only there to give every worker its own thread. They all pull chunks from the same sweep
+class TrnSweepWorker : public QThread
+{
+public:
+    explicit TrnSweepWorker(TrnSweep* sweep) : QThread(), _sweep(sweep) {}
+protected:
+    void run() { _sweep->work(); }
+private:
+    TrnSweep* _sweep;
+};
+
+TrnSweep::TrnSweep(const QVector<quint32>& pgm, const QVector<Range>& ranges, quint64 maxInstructions) :
+    _pgm(pgm), _ranges(ranges), _maxInstructions(maxInstructions), _weight(ranges.size()), _combinations(1), _prefix(pgm),
+    _chunkValues(1), _chunkCount(0), _nextChunk(0), _results(), _chunkResults(nullptr), _executed(0), _unshared(0), _accelerated(0)
+{
+    for(int d = ranges.size() - 1; d >= 0; d--)
+    {
+        _weight[d] = _combinations;
+        if(_combinations)
+            _combinations *= (quint64)ranges.at(d).last - ranges.at(d).first + 1;
+        if(_combinations > MaxCombinations)
+            _combinations = 0;
+    }
+}
+
+quint64 TrnSweep::combinations() const
+{
+    return _combinations;
+}
+
+void TrnSweep::run(int threads)
+{
+    _prefix = TrnFastEmu(_pgm);
+    _prefix.setLoopDetection(true);
+    _prefix.setLoopAcceleration(true);
+    TrnFastEmu::Status st = _prefix.run(_maxInstructions);
+    _executed = _prefix.instructionsRetired();
+    _unshared = 0;
+    _accelerated = _prefix.instructionsAccelerated();
+
+    // Stopped before reading anything, so every combination ends up the same
+    if(st != TrnFastEmu::WaitingForInput || _ranges.isEmpty())
+    {
+        _results = QVector<QVector<quint32>>(1);
+        record(_prefix, st, _combinations, _results[0]);
+        _unshared = _prefix.instructionsRetired() * _combinations;
+        return;
+    }
+
+    threads = qMax(threads, 1);
+    const quint64 values = (quint64)_ranges.at(0).last - _ranges.at(0).first + 1;
+    _chunkValues = qMax<quint64>(1, values / ((quint64)threads * ChunksPerThread));
+    _chunkCount = (values + _chunkValues - 1) / _chunkValues;
+    _results = QVector<QVector<quint32>>(_chunkCount);
+    // Taken before the workers start, so none of them can cause a detach
+    _chunkResults = _results.data();
+    _nextChunk = 0;
+
+    QVector<TrnSweepWorker*> workers;
+    for(int i = 1; i < threads; i++)
+    {
+        workers.append(new TrnSweepWorker(this));
+        workers.last()->start();
+    }
+    // The calling thread does its share too
+    work();
+    for(TrnSweepWorker* w : workers)
+    {
+        w->wait();
+        delete w;
+    }
+}
+
+void TrnSweep::work()
+{
+    quint64 executed = 0;
+    quint64 unshared = 0;
+    quint64 accelerated = 0;
+    while(true)
+    {
+        int c = _nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if(c >= _chunkCount)
+            break;
+        const quint64 first = _ranges.at(0).first + (quint64)c * _chunkValues;
+        const quint64 last = qMin<quint64>(first + _chunkValues - 1, _ranges.at(0).last);
+        sweep(_prefix, 0, first, last, _chunkResults[c], executed, unshared, accelerated);
+    }
+    _executed.fetch_add(executed, std::memory_order_relaxed);
+    _unshared.fetch_add(unshared, std::memory_order_relaxed);
+    _accelerated.fetch_add(accelerated, std::memory_order_relaxed);
+}
+
+void TrnSweep::sweep(const TrnFastEmu& parent, int depth, quint32 first, quint32 last, QVector<quint32>& out, quint64& executed, quint64& unshared, quint64& accelerated)
+{
+    for(quint64 v = first; v <= last; v++)
+    {
+        TrnFastEmu fork(parent);
+        fork.appendInput(v);
+        const quint64 before = fork.instructionsRetired();
+        const quint64 acceleratedBefore = fork.instructionsAccelerated();
+        // Reaching the limit right at an INP counts as reaching it, not as running out of inputs
+        TrnFastEmu::Status st = (before < _maxInstructions ? fork.run(_maxInstructions - before) : TrnFastEmu::Running);
+        executed += fork.instructionsRetired() - before;
+        accelerated += fork.instructionsAccelerated() - acceleratedBefore;
+
+        if(st == TrnFastEmu::WaitingForInput && depth + 1 < _ranges.size())
+            sweep(fork, depth + 1, _ranges.at(depth + 1).first, _ranges.at(depth + 1).last, out, executed, unshared, accelerated);
+        else
+        {
+            // A run that stopped before reading all of its inputs stands for every value of the ones it didn't read
+            record(fork, st, _weight.at(depth), out);
+            unshared += fork.instructionsRetired() * _weight.at(depth);
+        }
+    }
+}
+
+void TrnSweep::record(const TrnFastEmu& emu, TrnFastEmu::Status st, quint64 count, QVector<quint32>& out)
+{
+    const QVector<quint32>& outputs = emu.outputs();
+    for(quint64 i = 0; i < count; i++)
+    {
+        out.append(st);
+        out.append(outputs.size());
+        out.append(outputs);
+    }
+}
+
+void TrnSweep::writeTable(QTextStream& out) const
+{
+    const int dims = _ranges.size();
+    out << "# inputs\tstatus\toutputs\n";
+
+    // Offsets of the current combination into each range, counting up with the last input changing fastest
+    QVector<quint64> digits(dims, 0);
+    // The line being built
+    QVector<quint64> lineDigits;
+    quint64 lineLast = 0;
+    const quint32* lineResult = nullptr;
+    int lineLength = 0;
+
+    auto flush = [&]() {
+        if(!lineResult)
+            return;
+        QStringList inputs;
+        for(int d = 0; d < dims; d++)
+        {
+            quint64 v = _ranges.at(d).first + lineDigits.at(d);
+            if(d == dims - 1 && lineLast != lineDigits.at(d))
+                inputs << QString("%1-%2").arg(v).arg(_ranges.at(d).first + lineLast);
+            else
+                inputs << QString::number(v);
+        }
+        QStringList outputs;
+        for(int i = 0; i < (int)lineResult[1]; i++)
+            outputs << QString::number(lineResult[2 + i]);
+        out << (dims ? inputs.join(QChar(',')) : QString("-")) << "\t" << TrnFastEmu::statusName((TrnFastEmu::Status)lineResult[0]) << "\t" << outputs.join(QChar(',')) << "\n";
+    };
+
+    for(const QVector<quint32>& chunk : _results)
+    {
+        int p = 0;
+        while(p < chunk.size())
+        {
+            const quint32* result = chunk.constData() + p;
+            const int length = 2 + result[1];
+            // Only runs of the last input are merged, anything else starts a new line
+            bool extends = lineResult && dims && digits.at(dims - 1) != 0 && length == lineLength &&
+                           !memcmp(result, lineResult, length * sizeof(quint32));
+            if(extends)
+                lineLast = digits.at(dims - 1);
+            else
+            {
+                flush();
+                lineDigits = digits;
+                lineLast = (dims ? digits.at(dims - 1) : 0);
+                lineResult = result;
+                lineLength = length;
+            }
+
+            for(int d = dims - 1; d >= 0; d--)
+            {
+                if(++digits[d] <= (quint64)_ranges.at(d).last - _ranges.at(d).first)
+                    break;
+                digits[d] = 0;
+            }
+            p += length;
+        }
+    }
+    flush();
+}
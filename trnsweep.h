@@ -0,0 +1,66 @@
+#ifndef TRNSWEEP_H
+#define TRNSWEEP_H
+#include <QVector>
+#include <QTextStream>
+#include <atomic>
+#include "trnfastemu.h"
+
+// Runs a program on every combination of inputs from a list of ranges, one range per INP in the order they are read
+// The machine runs up to its first INP only once, and is then forked for every value there, and likewise at every INP
+// after that, so whatever the runs have in common is only executed once. A fork is a plain copy of the engine,
+// which shares the memory with its parent until it first writes to it
+class TrnSweep
+{
+public:
+    typedef struct {
+        quint32 first;
+        quint32 last;
+    } Range;
+
+    enum {
+        // Results are kept in memory until the table is written, at least two words each
+        MaxCombinations = 1 << 24,
+        // Every worker takes this many values of the first input at a time, so they all finish at about the same time
+        ChunksPerThread = 16,
+    };
+
+    TrnSweep(const QVector<quint32>& pgm, const QVector<Range>& ranges, quint64 maxInstructions);
+    // The number of input combinations, or 0 if there are more than MaxCombinations
+    quint64 combinations() const;
+    // Blocks until every combination has been run
+    void run(int threads);
+    // One line per run of combinations that only differ in the last input, and give the same result:
+    // the inputs, the status and the outputs, separated by tabs
+    void writeTable(QTextStream& out) const;
+    // Instructions actually executed, and how many running every combination from the start would have taken
+    inline quint64 instructionsExecuted() const { return _executed.load(); }
+    inline quint64 instructionsUnshared() const { return _unshared.load(); }
+    // How many of the executed ones were skipped by loop acceleration
+    inline quint64 instructionsAccelerated() const { return _accelerated.load(); }
+
+    // Called by the worker threads
+    void work();
+
+private:
+    QVector<quint32> _pgm;
+    QVector<Range> _ranges;
+    quint64 _maxInstructions;
+    // Combinations per value of each input, which is how many of them a run that stops there stands for
+    QVector<quint64> _weight;
+    quint64 _combinations;
+    TrnFastEmu _prefix;
+    quint32 _chunkValues;
+    int _chunkCount;
+    std::atomic<int> _nextChunk;
+    // The results of every chunk, in order. For each combination: the status, the number of outputs and the outputs
+    QVector<QVector<quint32>> _results;
+    QVector<quint32>* _chunkResults;
+    std::atomic<quint64> _executed;
+    std::atomic<quint64> _unshared;
+    std::atomic<quint64> _accelerated;
+
+    void sweep(const TrnFastEmu& parent, int depth, quint32 first, quint32 last, QVector<quint32>& out, quint64& executed, quint64& unshared, quint64& accelerated);
+    void record(const TrnFastEmu& emu, TrnFastEmu::Status st, quint64 count, QVector<quint32>& out);
+};
+
+#endif // TRNSWEEP_H
@@ -0,0 +1,106 @@
+#ifndef TRNTRACE_H
+#define TRNTRACE_H
+#include <QtGlobal>
+#include "trnemu.h"
+#include "trnstate.h"
+
+#define TRNTRACE_MAGIC "TRNTRACE"
+
+// On-disk format of execution traces
+// A trace starts with a Header, followed by the initial registers (RegisterCount words) and the initial memory (memorySize words)
+// After that, there is one Record for every F cycle (fetch, indexed, indirect or execute) that was executed
+// Everything is little endian
+class TrnTrace
+{
+public:
+    enum {
+        Version = 1,
+        // Registers are indexed like TrnEmu::Register, plus the overflow latch,
+        // which isn't visible but is needed to replay a trace exactly
+        Overflow = TrnEmu::REG_MAX,
+        RegisterCount,
+        // Register/value pairs that fit in a single record
+        PairsPerRecord = 4,
+    };
+
+    typedef enum {
+        MemRead = 0b1,
+        MemWrite = 0b10,
+        // More register/value pairs follow in continuation records
+        Continued = 0b100,
+        // This record only carries register/value pairs of the one before it
+        Continuation = 0b1000,
+        // The engine stopped after this cycle (halt or error)
+        Stopped = 0b10000,
+    } RecordFlag;
+
+    typedef struct {
+        char magic[8];
+        quint32 version;
+        quint32 recordSize;
+        quint32 registerCount;
+        quint32 memorySize;
+    } Header;
+
+    // Only the registers that changed during the cycle are stored. CLOCK never is, since every record has it
+    typedef struct {
+        quint32 clock; // At the end of the cycle
+        quint16 pc; // At the start of the cycle
+        quint8 f; // At the start of the cycle, so this is the kind of cycle
+        quint8 flags;
+        quint32 ir; // At the end of the cycle
+        quint16 memAddr;
+        quint8 pairCount;
+        quint8 reserved;
+        quint32 memData;
+        quint8 reg[PairsPerRecord];
+        quint32 val[PairsPerRecord];
+    } Record;
+
+    typedef quint32 Registers[RegisterCount];
+
+    static void fromState(const TrnState& s, Registers r)
+    {
+        r[TrnEmu::BR] = s.BR;
+        r[TrnEmu::A] = s.A;
+        r[TrnEmu::X] = s.X;
+        r[TrnEmu::IR] = s.IR;
+        r[TrnEmu::SP] = s.SP;
+        r[TrnEmu::I] = s.I;
+        r[TrnEmu::PC] = s.PC;
+        r[TrnEmu::AR] = s.AR;
+        r[TrnEmu::SC] = s.SC;
+        r[TrnEmu::CLOCK] = s.CLOCK;
+        r[TrnEmu::F] = s.F;
+        r[TrnEmu::V] = s.V;
+        r[TrnEmu::Z] = s.Z;
+        r[TrnEmu::S] = s.S;
+        r[TrnEmu::H] = s.H;
+        r[Overflow] = s.overflow;
+    }
+
+    static void toState(const Registers r, TrnState& s)
+    {
+        s.BR = r[TrnEmu::BR];
+        s.A = r[TrnEmu::A];
+        s.X = r[TrnEmu::X];
+        s.IR = r[TrnEmu::IR];
+        s.SP = r[TrnEmu::SP];
+        s.I = r[TrnEmu::I];
+        s.PC = r[TrnEmu::PC];
+        s.AR = r[TrnEmu::AR];
+        s.SC = r[TrnEmu::SC];
+        s.CLOCK = r[TrnEmu::CLOCK];
+        s.F = r[TrnEmu::F];
+        s.V = r[TrnEmu::V];
+        s.Z = r[TrnEmu::Z];
+        s.S = r[TrnEmu::S];
+        s.H = r[TrnEmu::H];
+        s.overflow = r[Overflow];
+    }
+};
+
+static_assert(sizeof(TrnTrace::Header) == 24, "Trace header must not have padding");
+static_assert(sizeof(TrnTrace::Record) == 40, "Trace records must not have padding");
+
+#endif // TRNTRACE_H
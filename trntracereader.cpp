@@ -0,0 +1,181 @@
+#include "trntracereader.h"
+#include <QObject>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+TrnTraceReader::TrnTraceReader() :
+    _map(nullptr), _records(nullptr), _recordCount(0), _cycleCount(0), _finalClock(0), _checkpointInterval(1)
+{
+}
+
+void TrnTraceReader::close()
+{
+    if(_map)
+        _file.unmap(_map);
+    _map = nullptr;
+    _file.close();
+    _records = nullptr;
+    _recordCount = _cycleCount = _finalClock = 0;
+    _index.clear();
+    _cursor = Checkpoint();
+}
+
+bool TrnTraceReader::fail(const QString& error)
+{
+    close();
+    _error = error;
+    return false;
+}
+
+bool TrnTraceReader::open(const QString& path)
+{
+    close();
+    _file.setFileName(path);
+    if(!_file.open(QIODevice::ReadOnly))
+        return fail(_file.errorString());
+
+    qint64 size = _file.size();
+    TrnTrace::Header h;
+    if(size < (qint64)sizeof(h))
+        return fail(QObject::tr("Not a trace file"));
+
+    // Multi gigabyte traces would need a 64 bit build here
+    _map = _file.map(0, size);
+    if(!_map)
+        return fail(QObject::tr("Could not map the trace into memory: %1").arg(_file.errorString()));
+
+    const uchar* map = _map;
+    memcpy(&h, map, sizeof(h));
+    if(memcmp(h.magic, TRNTRACE_MAGIC, sizeof(h.magic)))
+        return fail(QObject::tr("Not a trace file"));
+    if(qFromLittleEndian(h.version) != TrnTrace::Version || qFromLittleEndian(h.recordSize) != sizeof(TrnTrace::Record) ||
+       qFromLittleEndian(h.registerCount) != TrnTrace::RegisterCount)
+        return fail(QObject::tr("Unsupported trace version"));
+
+    quint64 memsize = qFromLittleEndian(h.memorySize);
+    quint64 start = sizeof(h) + sizeof(TrnTrace::Registers) + memsize * sizeof(quint32);
+    if(start > (quint64)size)
+        return fail(QObject::tr("The trace is truncated"));
+
+    Checkpoint c;
+    c.cycle = 0;
+    c.record = 0;
+    const quint32* words = (const quint32*)(map + sizeof(h));
+    for(int i = 0; i < TrnTrace::RegisterCount; i++)
+        c.regs[i] = qFromLittleEndian(words[i]);
+    words += TrnTrace::RegisterCount;
+    c.memory.resize(memsize);
+    for(quint64 i = 0; i < memsize; i++)
+        c.memory[i] = qFromLittleEndian(words[i]);
+    c.clock = c.regs[TrnEmu::CLOCK];
+
+    _records = (const TrnTrace::Record*)(map + start);
+    _recordCount = (size - start) / sizeof(TrnTrace::Record);
+    // Keep the index at around a thousand checkpoints, since each one holds a full copy of memory
+    _checkpointInterval = qMax<quint64>(4096, _recordCount / 1024);
+
+    // A single pass through the whole trace
+    _index.append(c);
+    while(c.record < _recordCount)
+    {
+        quint64 next = applyCycle(c.record, c.regs, c.memory);
+        // If the recording was cut short, the last cycle might be incomplete
+        if(next > _recordCount)
+            break;
+        c.record = next;
+        c.cycle++;
+        // Unwraps the 32 bit clock
+        c.clock += (quint32)(c.regs[TrnEmu::CLOCK] - (quint32)c.clock);
+        if(c.cycle % _checkpointInterval == 0)
+            _index.append(c);
+    }
+    _cycleCount = c.cycle;
+    _finalClock = c.clock;
+    _cursor = _index.first();
+    _error.clear();
+    return true;
+}
+
+quint64 TrnTraceReader::applyCycle(quint64 record, TrnTrace::Registers regs, QVector<quint32>& memory) const
+{
+    const TrnTrace::Record* r = &_records[record];
+    regs[TrnEmu::CLOCK] = qFromLittleEndian(r->clock);
+    if(r->flags & TrnTrace::MemWrite)
+    {
+        quint16 addr = qFromLittleEndian(r->memAddr);
+        if(addr < memory.size())
+            memory[addr] = qFromLittleEndian(r->memData);
+    }
+
+    while(true)
+    {
+        for(int i = 0; i < r->pairCount && i < TrnTrace::PairsPerRecord; i++)
+            if(r->reg[i] < TrnTrace::RegisterCount)
+                regs[r->reg[i]] = qFromLittleEndian(r->val[i]);
+        record++;
+        if(!(r->flags & TrnTrace::Continued))
+            return record;
+        if(record >= _recordCount)
+            return _recordCount + 1;
+        r = &_records[record];
+    }
+}
+
+const TrnTraceReader::Checkpoint& TrnTraceReader::nearestCheckpoint(quint64 cycle) const
+{
+    auto it = std::upper_bound(_index.constBegin(), _index.constEnd(), cycle, [](quint64 c, const Checkpoint& cp) { return c < cp.cycle; });
+    return *(it - 1);
+}
+
+void TrnTraceReader::replay(Checkpoint& c, quint64 cycles) const
+{
+    while(c.cycle < cycles)
+    {
+        c.record = applyCycle(c.record, c.regs, c.memory);
+        c.cycle++;
+        c.clock += (quint32)(c.regs[TrnEmu::CLOCK] - (quint32)c.clock);
+    }
+}
+
+TrnState TrnTraceReader::stateAfter(quint64 cycles)
+{
+    if(_index.isEmpty())
+        return TrnState();
+
+    cycles = qMin(cycles, _cycleCount);
+    const Checkpoint& cp = nearestCheckpoint(cycles);
+    // Only start over from the checkpoint if it gets us closer
+    if(cycles < _cursor.cycle || cp.cycle > _cursor.cycle)
+        _cursor = cp;
+    replay(_cursor, cycles);
+
+    TrnState s(_cursor.memory);
+    TrnTrace::toState(_cursor.regs, s);
+    return s;
+}
+
+quint64 TrnTraceReader::cyclesAtClock(quint64 clock) const
+{
+    if(_index.isEmpty())
+        return 0;
+
+    auto it = std::upper_bound(_index.constBegin(), _index.constEnd(), clock, [](quint64 c, const Checkpoint& cp) { return c < cp.clock; });
+    if(it != _index.constBegin())
+        it--;
+
+    quint64 cycle = it->cycle;
+    quint64 abs = it->clock;
+    for(quint64 rec = it->record; rec < _recordCount && cycle < _cycleCount; rec++)
+    {
+        const TrnTrace::Record& r = _records[rec];
+        if(r.flags & TrnTrace::Continuation)
+            continue;
+        quint64 next = abs + (quint32)(qFromLittleEndian(r.clock) - (quint32)abs);
+        if(next > clock)
+            break;
+        abs = next;
+        cycle++;
+    }
+    return cycle;
+}
@@ -0,0 +1,56 @@
+#ifndef TRNTRACEREADER_H
+#define TRNTRACEREADER_H
+#include <QFile>
+#include <QVector>
+#include "trntrace.h"
+
+// Random access to a recorded trace
+// The file is mapped into memory, and a sparse index of full state checkpoints is built on open,
+// so the state at any point can be reconstructed by replaying from the nearest checkpoint
+// Positions are counted in completed F cycles, from 0 (the initial state) to cycleCount()
+class TrnTraceReader
+{
+public:
+    TrnTraceReader();
+    bool open(const QString& path);
+    void close();
+    inline QString errorString() const { return _error; }
+
+    inline quint64 cycleCount() const { return _cycleCount; }
+    // The clock never wraps here, even if the 32 bit register did during the run
+    inline quint64 finalClock() const { return _finalClock; }
+    TrnState stateAfter(quint64 cycles);
+    // How many cycles had completed when the clock reached the given value
+    quint64 cyclesAtClock(quint64 clock) const;
+
+private:
+    typedef struct {
+        quint64 cycle;
+        quint64 record;
+        quint64 clock;
+        TrnTrace::Registers regs;
+        QVector<quint32> memory;
+    } Checkpoint;
+
+    QFile _file;
+    QString _error;
+    uchar* _map;
+    const TrnTrace::Record* _records;
+    quint64 _recordCount;
+    quint64 _cycleCount;
+    quint64 _finalClock;
+    quint64 _checkpointInterval;
+    QVector<Checkpoint> _index;
+    // Where the last reconstruction ended up. Scrubbing forwards continues from here instead of a checkpoint
+    Checkpoint _cursor;
+
+    // Closes the file again after open() went wrong, and returns false
+    bool fail(const QString& error);
+    const Checkpoint& nearestCheckpoint(quint64 cycle) const;
+    // Applies records from c.record on, until it has completed the given number of cycles in total
+    void replay(Checkpoint& c, quint64 cycles) const;
+    // Returns the index of the first record after the cycle
+    quint64 applyCycle(quint64 record, TrnTrace::Registers regs, QVector<quint32>& memory) const;
+};
+
+#endif // TRNTRACEREADER_H
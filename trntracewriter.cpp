@@ -0,0 +1,161 @@
+#include "trntracewriter.h"
+#include <QtEndian>
+#include <cstring>
+
+TrnTraceWriter::TrnTraceWriter(const QString& path, QObject* parent) :
+    QThread(parent), _file(path), _fill(0), _drain(0), _free(BufferCount - 1), _full(0), _started(false), _records(0), _stalls(0), _writeFailed(false)
+{
+    for(int i = 0; i < BufferCount; i++)
+    {
+        _buffers[i] = new TrnTrace::Record[BufferRecords];
+        _counts[i] = 0;
+    }
+}
+
+TrnTraceWriter::~TrnTraceWriter()
+{
+    finish();
+    for(int i = 0; i < BufferCount; i++)
+        delete[] _buffers[i];
+}
+
+bool TrnTraceWriter::open()
+{
+    return _file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+}
+
+bool TrnTraceWriter::begin(const TrnState& s)
+{
+    TrnTrace::Header h;
+    memcpy(h.magic, TRNTRACE_MAGIC, sizeof(h.magic));
+    h.version = qToLittleEndian<quint32>(TrnTrace::Version);
+    h.recordSize = qToLittleEndian<quint32>(sizeof(TrnTrace::Record));
+    h.registerCount = qToLittleEndian<quint32>(TrnTrace::RegisterCount);
+    h.memorySize = qToLittleEndian<quint32>(s.memory.size());
+
+    TrnTrace::Registers regs;
+    TrnTrace::fromState(s, regs);
+    for(quint32& r : regs)
+        r = qToLittleEndian(r);
+
+    QVector<quint32> mem(s.memory.size());
+    for(int i = 0; i < mem.size(); i++)
+        mem[i] = qToLittleEndian(s.memory.at(i));
+
+    if(_file.write((const char*)&h, sizeof(h)) != sizeof(h) ||
+       _file.write((const char*)regs, sizeof(regs)) != sizeof(regs) ||
+       _file.write((const char*)mem.constData(), mem.size() * sizeof(quint32)) != (qint64)(mem.size() * sizeof(quint32)))
+    {
+        _writeFailed = true;
+        return false;
+    }
+
+    _started = true;
+    start();
+    return true;
+}
+
+void TrnTraceWriter::recordCycle(const TrnTrace::Registers before, const TrnTrace::Registers after, quint8 memFlags, quint16 memAddr, quint32 memData, bool stopped)
+{
+    const quint32 clock = qToLittleEndian(after[TrnEmu::CLOCK]);
+    const quint16 pc = qToLittleEndian<quint16>(before[TrnEmu::PC]);
+    const quint8 f = before[TrnEmu::F];
+    const quint32 ir = qToLittleEndian(after[TrnEmu::IR]);
+
+    TrnTrace::Record* r = &nextRecord();
+    r->clock = clock;
+    r->pc = pc;
+    r->f = f;
+    r->flags = memFlags | (stopped ? TrnTrace::Stopped : 0);
+    r->ir = ir;
+    r->memAddr = qToLittleEndian(memAddr);
+    r->pairCount = 0;
+    r->reserved = 0;
+    r->memData = qToLittleEndian(memData);
+
+    int n = 0;
+    for(int i = 0; i < TrnTrace::RegisterCount; i++)
+    {
+        if(i == TrnEmu::CLOCK || before[i] == after[i])
+            continue;
+
+        if(n == TrnTrace::PairsPerRecord)
+        {
+            // This must be complete before asking for the next one, as that might hand its buffer over
+            r->pairCount = n;
+            r->flags |= TrnTrace::Continued;
+
+            r = &nextRecord();
+            r->clock = clock;
+            r->pc = pc;
+            r->f = f;
+            r->flags = TrnTrace::Continuation;
+            r->ir = ir;
+            r->memAddr = 0;
+            r->reserved = 0;
+            r->memData = 0;
+            n = 0;
+        }
+        r->reg[n] = i;
+        r->val[n] = qToLittleEndian(after[i]);
+        n++;
+    }
+    r->pairCount = n;
+    // So that identical runs produce identical files
+    for(int i = n; i < TrnTrace::PairsPerRecord; i++)
+    {
+        r->reg[i] = 0;
+        r->val[i] = 0;
+    }
+}
+
+void TrnTraceWriter::submit()
+{
+    _full.release();
+    _fill = (_fill + 1) % BufferCount;
+    if(_free.tryAcquire())
+        return;
+    // The disk can't keep up
+    _stalls++;
+    _free.acquire();
+}
+
+void TrnTraceWriter::finish()
+{
+    if(!_started)
+        return;
+    _started = false;
+
+    if(_counts[_fill])
+        submit();
+    // An empty buffer tells the writer thread to stop
+    _full.release();
+    wait();
+    _file.close();
+}
+
+void TrnTraceWriter::run()
+{
+    while(true)
+    {
+        _full.acquire();
+        qint64 len = _counts[_drain] * sizeof(TrnTrace::Record);
+        if(!len)
+            break;
+
+        // Keep draining even after an error, so that the emulator never blocks on us
+        if(!_writeFailed && _file.write((const char*)_buffers[_drain], len) != len)
+            _writeFailed = true;
+
+        _counts[_drain] = 0;
+        _drain = (_drain + 1) % BufferCount;
+        _free.release();
+    }
+}
+
+QString TrnTraceWriter::errorString() const
+{
+    if(_writeFailed)
+        return _file.errorString();
+    return QString();
+}
@@ -0,0 +1,60 @@
+#ifndef TRNTRACEWRITER_H
+#define TRNTRACEWRITER_H
+#include <QThread>
+#include <QFile>
+#include <QSemaphore>
+#include <atomic>
+#include "trntrace.h"
+
+// Streams trace records to a file
+// The emulator thread only fills in buffers in memory. Full buffers are handed over to this thread,
+// which writes them out while the emulator keeps filling the next one
+class TrnTraceWriter : public QThread
+{
+public:
+    explicit TrnTraceWriter(const QString& path, QObject* parent = nullptr);
+    ~TrnTraceWriter();
+    bool open();
+    // Writes the header with the state the trace starts from, and starts the writer thread
+    // From here on, it must only be used by a single (emulator) thread
+    bool begin(const TrnState& s);
+    // Called after every F cycle
+    void recordCycle(const TrnTrace::Registers before, const TrnTrace::Registers after, quint8 memFlags, quint16 memAddr, quint32 memData, bool stopped);
+    // Writes out whatever is left and stops the writer thread
+    void finish();
+
+    QString errorString() const;
+    inline quint64 recordCount() const { return _records; }
+    // How many times the emulator had to wait for the disk
+    inline quint64 stallCount() const { return _stalls; }
+
+protected:
+    void run();
+
+private:
+    enum {
+        BufferCount = 4,
+        BufferRecords = 32768,
+    };
+    QFile _file;
+    TrnTrace::Record* _buffers[BufferCount];
+    int _counts[BufferCount];
+    int _fill; // emu thread only
+    int _drain; // writer thread only
+    QSemaphore _free;
+    QSemaphore _full;
+    bool _started;
+    quint64 _records;
+    quint64 _stalls;
+    std::atomic<bool> _writeFailed;
+    inline TrnTrace::Record& nextRecord()
+    {
+        if(_counts[_fill] == BufferRecords)
+            submit();
+        _records++;
+        return _buffers[_fill][_counts[_fill]++];
+    }
+    void submit();
+};
+
+#endif // TRNTRACEWRITER_H